@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -63,6 +64,72 @@ static int str_isalnum_(const char *s)
 	return 1;
 }
 
+#if ENABLE_FEATURE_APPLET_HASH
+/* Finds a seed for every bucket so that all applets land in distinct
+ * slots. Buckets are placed largest first, which is when it's hardest.
+ */
+static int gen_applet_hash(unsigned nbuckets, uint8_t *seed, uint16_t *slot_to_applet)
+{
+	unsigned char taken[NUM_APPLETS];
+	unsigned bucket_of[NUM_APPLETS];
+	unsigned order[NUM_APPLETS];
+	unsigned size[NUM_APPLETS];
+	unsigned i, j, b, n;
+
+	memset(size, 0, sizeof(size));
+	for (i = 0; i < NUM_APPLETS; i++) {
+		bucket_of[i] = applet_name_hash(applets[i].name) % nbuckets;
+		size[bucket_of[i]]++;
+	}
+	/* Order buckets by size, descending */
+	n = 0;
+	for (j = NUM_APPLETS; j > 0; j--)
+		for (b = 0; b < nbuckets; b++)
+			if (size[b] == j)
+				order[n++] = b;
+
+	memset(taken, 0, sizeof(taken));
+	memset(seed, 0, nbuckets);
+	for (j = 0; j < n; j++) {
+		unsigned s;
+
+		b = order[j];
+		for (s = 0; s < 256; s++) {
+			unsigned slots[NUM_APPLETS];
+			unsigned cnt = 0;
+
+			for (i = 0; i < NUM_APPLETS; i++) {
+				unsigned k, sl;
+
+				if (bucket_of[i] != b)
+					continue;
+				sl = applet_hash_mix(applet_name_hash(applets[i].name), s) % NUM_APPLETS;
+				if (taken[sl])
+					goto next_seed;
+				for (k = 0; k < cnt; k++)
+					if (slots[k] == sl)
+						goto next_seed;
+				slots[cnt++] = sl;
+			}
+			/* This seed works, take the slots */
+			cnt = 0;
+			for (i = 0; i < NUM_APPLETS; i++) {
+				if (bucket_of[i] != b)
+					continue;
+				taken[slots[cnt]] = 1;
+				slot_to_applet[slots[cnt++]] = i;
+			}
+			seed[b] = s;
+			break;
+ next_seed: ;
+		}
+		if (s == 256)
+			return 0;
+	}
+	return 1;
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	int i, j;
@@ -83,7 +150,7 @@ int main(int argc, char **argv)
 	// and 1..16 strcmp's in the second. With 256 apps, second search does 1..32 strcmp's.
 	if (NUM_APPLETS < 128)
 		KNOWN_APPNAME_OFFSETS = 4;
-	if (NUM_APPLETS < 32)
+	if (NUM_APPLETS < 32 || ENABLE_FEATURE_APPLET_HASH)
 		KNOWN_APPNAME_OFFSETS = 0;
 
 	qsort(applets, NUM_APPLETS, sizeof(applets[0]), cmp_name);
@@ -135,6 +202,40 @@ int main(int argc, char **argv)
 		printf("};\n\n");
 	}
 
+#if ENABLE_FEATURE_APPLET_HASH
+	{
+		uint8_t seed[NUM_APPLETS];
+		uint16_t slot_to_applet[NUM_APPLETS];
+		unsigned nbuckets, ofs;
+
+		/* Start with ~3 names per bucket, use more buckets if that fails */
+		for (nbuckets = (NUM_APPLETS + 2) / 3; ; nbuckets++) {
+			if (nbuckets > NUM_APPLETS)
+				return 1;
+			if (gen_applet_hash(nbuckets, seed, slot_to_applet))
+				break;
+		}
+		printf("#define APPLET_HASH_BUCKETS %u\n", nbuckets);
+		printf("const uint8_t applet_hash_seed[] ALIGN1 = {\n");
+		for (i = 0; i < nbuckets; i++)
+			printf("%u,\n", seed[i]);
+		printf("};\n");
+		printf("const uint16_t applet_hash_slot[] ALIGN2 = {\n");
+		for (i = 0; i < NUM_APPLETS; i++)
+			printf("%u,\n", slot_to_applet[i]);
+		printf("};\n");
+		printf("const uint16_t applet_name_ofs[] ALIGN2 = {\n");
+		ofs = 0;
+		for (i = 0; i < NUM_APPLETS; i++) {
+			printf("%u,\n", ofs);
+			ofs += strlen(applets[i].name) + 1;
+		}
+		printf("};\n\n");
+		if (ofs > 0xffff)
+			return 1;
+	}
+#endif
+
 	//printf("#ifndef SKIP_definitions\n");
 	printf("const char applet_names[] ALIGN1 = \"\"\n");
 	for (i = 0; i < NUM_APPLETS; i++) {
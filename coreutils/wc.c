@@ -105,6 +105,80 @@ enum {
 	NUM_WCS     = 5,
 };
 
+enum { WC_BUFSIZE = 64 * 1024 };
+
+/* Without -L or Unicode -m, we don't need to look at each byte:
+ * lines are counted by memchr(), words a long at a time.
+ * For words, each byte is either a word char (printable non-space),
+ * or a separator (space, \t\n\v\f\r), or neither. In a long
+ * without "neither" bytes, words end where a separator
+ * follows a word char.
+ */
+#define ONES  (~0UL / 0xff)
+#define HIGHS (ONES * 0x80)
+/* High bit of each byte of x (all < 0x80) is set if the byte is >= n */
+#define GE(x, n) (((x) + ONES * (0x80 - (n))) & HIGHS)
+
+static COUNT_T count_lines(const char *p, const char *end)
+{
+	COUNT_T n = 0;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		n++;
+		p++;
+	}
+	return n;
+}
+
+static unsigned count_words_bytewise(const unsigned char *p, const unsigned char *end, smallint *in_word)
+{
+	unsigned n = 0;
+
+	while (p < end) {
+		unsigned c = *p++;
+		if (c - 0x21 < 0x7f - 0x21) {
+			*in_word = 1;
+		} else if (c == ' ' || c - 9 <= 4) {
+			n += *in_word;
+			*in_word = 0;
+		}
+	}
+	return n;
+}
+
+static COUNT_T count_words(const unsigned char *p, const unsigned char *end, smallint *in_word)
+{
+	COUNT_T n = 0;
+
+	while (end - p >= (int)sizeof(long)) {
+		unsigned long x, hi, word, sep;
+
+		move_from_unaligned_long(x, p);
+		hi = x & HIGHS;
+		x ^= hi;
+		word = GE(x, 0x21) & ~GE(x, 0x7f) & ~hi;
+		sep = ((GE(x, 0x20) & ~GE(x, 0x21)) | (GE(x, 9) & ~GE(x, 0x0e))) & ~hi;
+		if ((word | sep) != HIGHS) {
+			n += count_words_bytewise(p, p + sizeof(long), in_word);
+		} else {
+			/* Separators preceded by a word char.
+			 * The byte before the first one is *in_word */
+			unsigned long prev;
+			if (BB_LITTLE_ENDIAN) {
+				prev = (word << 8) | (*in_word ? 0x80 : 0);
+				*in_word = word >> (sizeof(long) * 8 - 1);
+			} else {
+				prev = (word >> 8) | (*in_word ? HIGHS & ~(HIGHS >> 8) : 0);
+				*in_word = (word >> 7) & 1;
+			}
+			/* Sum of bytes which are 0 or 1 */
+			n += (((sep & prev) >> 7) * ONES) >> (sizeof(long) * 8 - 8);
+		}
+		p += sizeof(long);
+	}
+	return n + count_words_bytewise(p, end, in_word);
+}
+
 int wc_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int wc_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -114,8 +188,10 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 	COUNT_T *pcounts;
 	COUNT_T counts[NUM_WCS];
 	COUNT_T totals[NUM_WCS];
+	unsigned char *buf;
 	int num_files;
 	smallint status = EXIT_SUCCESS;
+	smallint bytewise;
 	unsigned print_type;
 
 	init_unicode();
@@ -136,21 +212,29 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 			start_fmt = "%"COUNT_FMT;
 	}
 
+	/* Only -L and Unicode -m need to look at every byte */
+	bytewise = (print_type & (1 << WC_LENGTH))
+		|| (unicode_status == UNICODE_ON && (print_type & (1 << WC_UNICHARS)));
+	buf = xmalloc(WC_BUFSIZE);
+
 	memset(totals, 0, sizeof(totals));
 
 	pcounts = counts;
 
 	num_files = 0;
 	while ((arg = *argv++) != NULL) {
-		FILE *fp;
 		const char *s;
 		unsigned u;
 		unsigned linepos;
 		smallint in_word;
+		int fd;
 
 		++num_files;
-		fp = fopen_or_warn_stdin(arg);
-		if (!fp) {
+		fd = STDIN_FILENO;
+		if (arg != bb_msg_standard_input && NOT_LONE_DASH(arg))
+			fd = open(arg, O_RDONLY);
+		if (fd < 0) {
+			bb_simple_perror_msg(arg);
 			status = EXIT_FAILURE;
 			continue;
 		}
@@ -160,65 +244,82 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 		in_word = 0;
 
 		while (1) {
-			int c;
-			/* Our -w doesn't match GNU wc exactly... oh well */
+			unsigned char *p;
+			ssize_t len = safe_read(fd, buf, WC_BUFSIZE);
 
-			c = getc(fp);
-			if (c == EOF) {
-				if (ferror(fp)) {
+			if (len <= 0) {
+				if (len < 0) {
 					bb_simple_perror_msg(arg);
 					status = EXIT_FAILURE;
 				}
-				goto DO_EOF;  /* Treat an EOF as '\r'. */
+				break;
 			}
 
 			/* Cater for -c and -m */
-			++counts[WC_BYTES];
-			if (unicode_status != UNICODE_ON /* every byte is a new char */
-			 || (c & 0xc0) != 0x80 /* it isn't a 2nd+ byte of a Unicode char */
-			) {
-				++counts[WC_UNICHARS];
+			counts[WC_BYTES] += len;
+			if (!bytewise) {
+				counts[WC_UNICHARS] += len;
+				if (print_type & (1 << WC_LINES))
+					counts[WC_LINES] += count_lines((char*)buf, (char*)buf + len);
+				if (print_type & (1 << WC_WORDS))
+					counts[WC_WORDS] += count_words(buf, buf + len, &in_word);
+				continue;
 			}
 
-			if (isprint_asciionly(c)) { /* FIXME: not unicode-aware */
-				++linepos;
-				if (!isspace(c)) {
-					in_word = 1;
-					continue;
+			p = buf;
+			do {
+				unsigned c = *p;
+				/* Our -w doesn't match GNU wc exactly... oh well */
+
+				if (unicode_status != UNICODE_ON /* every byte is a new char */
+				 || (c & 0xc0) != 0x80 /* it isn't a 2nd+ byte of a Unicode char */
+				) {
+					++counts[WC_UNICHARS];
 				}
-			} else if ((unsigned)(c - 9) <= 4) {
-				/* \t  9
-				 * \n 10
-				 * \v 11
-				 * \f 12
-				 * \r 13
-				 */
-				if (c == '\t') {
-					linepos = (linepos | 7) + 1;
-				} else {  /* '\n', '\r', '\f', or '\v' */
- DO_EOF:
-					if (linepos > counts[WC_LENGTH]) {
-						counts[WC_LENGTH] = linepos;
-					}
-					if (c == '\n') {
-						++counts[WC_LINES];
+
+				if (isprint_asciionly(c)) { /* FIXME: not unicode-aware */
+					++linepos;
+					if (!isspace(c)) {
+						in_word = 1;
+						continue;
 					}
-					if (c != '\v') {
-						linepos = 0;
+				} else if (c - 9 <= 4) {
+					/* \t  9
+					 * \n 10
+					 * \v 11
+					 * \f 12
+					 * \r 13
+					 */
+					if (c == '\t') {
+						linepos = (linepos | 7) + 1;
+					} else {  /* '\n', '\r', '\f', or '\v' */
+						if (linepos > counts[WC_LENGTH]) {
+							counts[WC_LENGTH] = linepos;
+						}
+						if (c == '\n') {
+							++counts[WC_LINES];
+						}
+						if (c != '\v') {
+							linepos = 0;
+						}
 					}
+				} else {
+					continue;
 				}
-			} else {
-				continue;
-			}
 
-			counts[WC_WORDS] += in_word;
-			in_word = 0;
-			if (c == EOF) {
-				break;
-			}
+				counts[WC_WORDS] += in_word;
+				in_word = 0;
+			} while (++p != buf + len);
+		}
+
+		/* EOF ends the last line and word */
+		if (linepos > counts[WC_LENGTH]) {
+			counts[WC_LENGTH] = linepos;
 		}
+		counts[WC_WORDS] += in_word;
 
-		fclose_if_not_stdin(fp);
+		if (fd != STDIN_FILENO)
+			close(fd);
 
 		if (totals[WC_LENGTH] < counts[WC_LENGTH]) {
 			totals[WC_LENGTH] = counts[WC_LENGTH];
@@ -134,6 +134,7 @@ typedef struct chain_s {
 	struct node_s *first;
 	struct node_s *last;
 	const char *programname;
+	struct code_s *code;    /* compiled chain, see compile_chain() */
 } chain;
 
 /* Function */
@@ -159,16 +160,34 @@ typedef struct hash_item_s {
 		struct rstream_s rs;    /* redirect streams hash */
 		struct func_s f;        /* functions hash */
 	} data;
-	struct hash_item_s *next;       /* next in chain */
+	unsigned hval;                  /* hashidx(name) */
 	char name[1];                   /* really it's longer */
 } hash_item;
 
+/* Open addressing: a slot has the hash of the name and the index+1
+ * of the item in items[] (0: empty slot). items[] are in the order
+ * of insertion, NULL if removed (then its slot is a tombstone) */
+typedef struct hash_slot_s {
+	unsigned hval;
+	unsigned idx;
+} hash_slot;
+
+/* Bigger items are malloced one by one */
+#define HASH_ITEM_MAX 256
+
 typedef struct xhash_s {
 	unsigned nel;           /* num of elements */
-	unsigned csize;         /* current hash size */
-	unsigned nprime;        /* next hash size in PRIMES[] */
+	unsigned nitems;        /* used items[], including removed ones */
+	unsigned mask;          /* slot[] size - 1 */
 	unsigned glen;          /* summary length of item names */
+	hash_slot *slot;
 	struct hash_item_s **items;
+	/* Items are carved from arena blocks, removed ones are kept
+	 * on free lists by size */
+	char *arena, *arena_end;
+	void *blocks;           /* chained by their first word */
+	unsigned block_size;
+	struct hash_item_s *free_items[HASH_ITEM_MAX / 16 + 1];
 } xhash;
 
 /* Tree node */
@@ -190,6 +209,10 @@ typedef struct node_s {
 	union {
 		struct node_s *n;
 	} a;
+	union {
+		struct code_s *code;    /* expression: compiled by evaluate() */
+		unsigned pc;            /* statement: its position+1, while compiling */
+	} c;
 } node;
 
 typedef struct tsplitter_s {
@@ -197,6 +220,69 @@ typedef struct tsplitter_s {
 	regex_t re[2];
 } tsplitter;
 
+/* Bytecode instructions: name, and how many stack cells it pushes
+ * (or pops, if negative). See execute() for what each one does */
+#define BYTECODE \
+	BC(VAR,        1) BC(VARNF,      1) BC(ARG,        1) BC(ELEM,       0) \
+	BC(ELEMARG,    0) BC(CLEAR,      1) BC(EVAL,       1) BC(TONUM,      0) \
+	BC(TOSTR,      0) BC(NUMVAR,     0) BC(POP,       -1) BC(FIELD,      0) \
+	BC(REGEXP,     1) BC(MATCH,      0) BC(MATCHDYN,  -1) BC(IN,        -1) \
+	BC(CONCAT,    -1) BC(COMMA,     -1) BC(ADD,       -1) BC(SUB,       -1) \
+	BC(MUL,       -1) BC(ARITH,     -1) BC(NEG,        0) BC(NOT,        0) \
+	BC(BOOL,       0) BC(TRUTH,      0) BC(PREINC,     0) BC(POSTINC,    0) \
+	BC(MOVE,      -1) BC(MOVEN,     -1) BC(GETNUM,     1) BC(OPSET,     -2) \
+	BC(CMP,       -1) BC(CMPN,      -1) BC(PUSHN,      1) BC(JMP,        0) \
+	BC(JF,        -1) BC(JT,        -1) BC(JFN,       -1) BC(JTN,       -1) \
+	BC(CALLSETUP,  1) BC(PUTARG,    -1) BC(DROPARG,   -1) BC(CALL,       0) \
+	BC(RETV,      -1) BC(RETN,      -1) BC(ERROR,      0) BC(LINE,       0) \
+	BC(PROGNAME,   0) BC(STDOUT,     1) BC(OUTFILE,    0) BC(PRINTARG,  -1) \
+	BC(PRINT0,     0) BC(PRINTEND,  -1) BC(PRINTF,    -1) BC(DELELEM,   -2) \
+	BC(DELARR,    -1) BC(WALKINIT,  -2) BC(WALKNEXT,  -1) BC(RANGE,      0) \
+	BC(RETURN,    -1) BC(NEXTFILE,   0) BC(NEXT,       0) BC(DONE,       0) \
+	BC(NEXTCHK,    0) BC(EXIT,       0)
+
+enum {
+#define BC(name, n) BC_##name,
+	BYTECODE
+#undef BC
+};
+
+typedef struct insn_s {
+	uint32_t op;
+	int arg;                /* jump target, function arg index, opn... */
+	union {
+		var *v;
+		node *n;
+		func *f;
+		const char *s;
+		double d;
+	} a;
+} insn;
+
+typedef struct code_s {
+	insn *ins;
+	int depth;              /* max stack cells in use */
+} code;
+
+/* A stack cell. The compiler knows which of these it holds */
+typedef union cell_u {
+	var *v;
+	double d;
+	const char *s;
+	FILE *F;
+} cell;
+
+/* Block of the temporary variables stack, see nvalloc() */
+typedef struct nvblock_s {
+	var *pos;
+	var *end;
+	struct nvblock_s *prev;
+	struct nvblock_s *next;
+	var nv[];
+} nvblock;
+
+#define NVBLOCK_SIZE 256
+
 /* simple token classes */
 /* order and hex values are very important!!!  See next_token() */
 #define TC_LPAREN       (1 << 0)        /* ( */
@@ -531,9 +617,8 @@ static const char vValues[] ALIGN1 =
 	"\n\0"      "\n\0"      "\0"        "\0"
 	"\034\0"    "\0"        "\377";
 
-/* hash size may grow to these values */
-#define FIRST_PRIME 61
-static const uint16_t PRIMES[] ALIGN2 = { 251, 1021, 4093, 16381, 65521 };
+/* hash has this many slots at first, grows by doubling */
+#define HASH_FIRST_SIZE 16
 
 
 /* Globals. Split in two parts so that first one is addressed
@@ -556,7 +641,9 @@ struct globals {
 	int g_lineno;
 	int nfields;
 	int maxfields; /* used in fsrealloc() only */
+	int split_upto; /* highest $N the program reads, see split_f0() */
 	var *Fields;
+	nvblock *g_cb;
 	char *g_pos;
 	char g_saved_ch;
 	smallint icase;
@@ -564,6 +651,7 @@ struct globals {
 	smallint nextrec;
 	smallint nextfile;
 	smallint is_f0_split;
+	smallint is_f0_partial;
 	smallint t_rollback;
 
 	/* former statics from various functions */
@@ -576,6 +664,9 @@ struct globals2 {
 	uint32_t t_tclass;
 	char *t_string;
 	int t_lineno;
+	/* $exprs not (yet) known to be constant, plus stores into fields:
+	 * if nonzero after parsing, every record is split completely */
+	int full_split;
 
 	var *intvar[NUM_INTERNAL_VARS]; /* often used */
 
@@ -631,6 +722,7 @@ struct globals2 {
 #define nfields      (G1.nfields     )
 #define maxfields    (G1.maxfields   )
 #define Fields       (G1.Fields      )
+#define g_cb         (G1.g_cb        )
 #define g_pos        (G1.g_pos       )
 #define g_saved_ch   (G1.g_saved_ch  )
 #define icase        (G1.icase       )
@@ -638,6 +730,8 @@ struct globals2 {
 #define nextrec      (G1.nextrec     )
 #define nextfile     (G1.nextfile    )
 #define is_f0_split  (G1.is_f0_split )
+#define is_f0_partial (G1.is_f0_partial)
+#define split_upto   (G1.split_upto  )
 #define t_rollback   (G1.t_rollback  )
 #define t_info       (G.t_info      )
 #define t_tclass     (G.t_tclass    )
@@ -674,23 +768,73 @@ static void syntax_error(const char *message)
 
 /* ---- hash stuff ---- */
 
+/* FNV-1a, with a final mix so that low bits depend on all of name */
 static unsigned hashidx(const char *name)
 {
-	unsigned idx = 0;
+	unsigned idx = 0x811c9dc5;
 
 	while (*name)
-		idx = *name++ + (idx << 6) - idx;
+		idx = (idx ^ (unsigned char)*name++) * 0x01000193;
+	idx ^= idx >> 16;
+	idx *= 0x85ebca6b;
+	idx ^= idx >> 13;
+	idx *= 0xc2b2ae35;
+	idx ^= idx >> 16;
 	return idx;
 }
 
+#define HASH_ITEM_SIZE(len) ((offsetof(hash_item, name) + (len) + 15) & ~15)
+
+static hash_item *hash_alloc(xhash *hash, unsigned size)
+{
+	hash_item *hi;
+
+	if (size > HASH_ITEM_MAX)
+		return xzalloc(size);
+	hi = hash->free_items[size / 16];
+	if (hi) {
+		hash->free_items[size / 16] = *(hash_item **)hi;
+	} else {
+		if (hash->arena_end - hash->arena < (int)size) {
+			char *b;
+			/* small arrays get small blocks */
+			hash->block_size = hash->block_size ? hash->block_size * 2 : 1024;
+			if (hash->block_size > 64 * 1024)
+				hash->block_size = 64 * 1024;
+			b = xmalloc(hash->block_size);
+			*(void **)b = hash->blocks;
+			hash->blocks = b;
+			hash->arena = b + 16;
+			hash->arena_end = b + hash->block_size;
+		}
+		hi = (hash_item *)hash->arena;
+		hash->arena += size;
+	}
+	memset(hi, 0, size);
+	return hi;
+}
+
+static void hash_free_item(xhash *hash, hash_item *hi)
+{
+	unsigned size = HASH_ITEM_SIZE(strlen(hi->name) + 1);
+
+	if (size > HASH_ITEM_MAX) {
+		free(hi);
+		return;
+	}
+	*(hash_item **)hi = hash->free_items[size / 16];
+	hash->free_items[size / 16] = hi;
+}
+
 /* create new hash */
 static xhash *hash_init(void)
 {
 	xhash *newhash;
 
 	newhash = xzalloc(sizeof(*newhash));
-	newhash->csize = FIRST_PRIME;
-	newhash->items = xzalloc(FIRST_PRIME * sizeof(newhash->items[0]));
+	newhash->mask = HASH_FIRST_SIZE - 1;
+	newhash->slot = xzalloc(HASH_FIRST_SIZE * sizeof(newhash->slot[0]));
+	newhash->items = xmalloc(HASH_FIRST_SIZE / 2 * sizeof(newhash->items[0]));
 
 	return newhash;
 }
@@ -698,100 +842,121 @@ static xhash *hash_init(void)
 static void hash_clear(xhash *hash)
 {
 	unsigned i;
-	hash_item *hi, *thi;
+	hash_item *hi;
 
-	for (i = 0; i < hash->csize; i++) {
+	for (i = 0; i < hash->nitems; i++) {
 		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = hi->next;
+		if (!hi)
+			continue;
 //FIXME: this assumes that it's a hash of *variables*:
-			free(thi->data.v.string);
-			free(thi);
-		}
-		hash->items[i] = NULL;
+		free(hi->data.v.string);
+		if (HASH_ITEM_SIZE(strlen(hi->name) + 1) > HASH_ITEM_MAX)
+			free(hi);
 	}
-	hash->glen = hash->nel = 0;
+	while (hash->blocks) {
+		void *b = hash->blocks;
+		hash->blocks = *(void **)b;
+		free(b);
+	}
+	hash->arena = hash->arena_end = NULL;
+	hash->block_size = 0;
+	memset(hash->free_items, 0, sizeof(hash->free_items));
+	memset(hash->slot, 0, (hash->mask + 1) * sizeof(hash->slot[0]));
+	hash->glen = hash->nel = hash->nitems = 0;
 }
 
-#if 0 //UNUSED
 static void hash_free(xhash *hash)
 {
 	hash_clear(hash);
+	free(hash->slot);
 	free(hash->items);
 	free(hash);
 }
-#endif
 
-/* find item in hash, return ptr to data, NULL if not found */
-static NOINLINE void *hash_search3(xhash *hash, const char *name, unsigned idx)
+/* find the slot of name, or the empty slot where it would go */
+static hash_slot *hash_lookup(xhash *hash, const char *name, unsigned hval)
 {
-	hash_item *hi;
+	unsigned i = hval;
 
-	hi = hash->items[idx % hash->csize];
-	while (hi) {
-		if (strcmp(hi->name, name) == 0)
-			return &hi->data;
-		hi = hi->next;
+	for (;;) {
+		hash_slot *sl = &hash->slot[i & hash->mask];
+		hash_item *hi;
+
+		if (sl->idx == 0)
+			return sl;
+		hi = hash->items[sl->idx - 1];
+		if (sl->hval == hval && hi && strcmp(hi->name, name) == 0)
+			return sl;
+		i++;
 	}
-	return NULL;
 }
 
-static void *hash_search(xhash *hash, const char *name)
+/* find item in hash, return ptr to data, NULL if not found */
+static NOINLINE void *hash_search(xhash *hash, const char *name)
 {
-	return hash_search3(hash, name,	hashidx(name));
+	hash_slot *sl = hash_lookup(hash, name, hashidx(name));
+
+	return sl->idx ? &hash->items[sl->idx - 1]->data : NULL;
 }
 
-/* grow hash if it becomes too big */
+/* drop tombstones, and grow hash if it becomes too full */
 static void hash_rebuild(xhash *hash)
 {
-	unsigned newsize, i, idx;
-	hash_item **newitems, *hi, *thi;
+	unsigned size, i, n, j;
+	hash_item *hi;
 
-	if (hash->nprime == ARRAY_SIZE(PRIMES))
-		return;
+	size = hash->mask + 1;
+	if (hash->nel >= size / 4)
+		size *= 2;
 
-	newsize = PRIMES[hash->nprime++];
-	newitems = xzalloc(newsize * sizeof(newitems[0]));
+	n = 0;
+	for (i = 0; i < hash->nitems; i++) {
+		if (hash->items[i])
+			hash->items[n++] = hash->items[i];
+	}
+	hash->nitems = n;
 
-	for (i = 0; i < hash->csize; i++) {
+	free(hash->slot);
+	hash->slot = xzalloc(size * sizeof(hash->slot[0]));
+	hash->mask = size - 1;
+	hash->items = xrealloc(hash->items, size / 2 * sizeof(hash->items[0]));
+	for (i = 0; i < n; i++) {
 		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = thi->next;
-			idx = hashidx(thi->name) % newsize;
-			thi->next = newitems[idx];
-			newitems[idx] = thi;
-		}
+		j = hi->hval;
+		while (hash->slot[j & hash->mask].idx)
+			j++;
+		hash->slot[j & hash->mask].hval = hi->hval;
+		hash->slot[j & hash->mask].idx = i + 1;
 	}
-
-	free(hash->items);
-	hash->csize = newsize;
-	hash->items = newitems;
 }
 
 /* find item in hash, add it if necessary. Return ptr to data */
 static void *hash_find(xhash *hash, const char *name)
 {
+	hash_slot *sl;
 	hash_item *hi;
-	unsigned idx;
+	unsigned hval;
 	int l;
 
-	idx = hashidx(name);
-	hi = hash_search3(hash, name, idx);
-	if (!hi) {
-		if (++hash->nel > hash->csize * 8)
-			hash_rebuild(hash);
+	hval = hashidx(name);
+	sl = hash_lookup(hash, name, hval);
+	if (sl->idx)
+		return &hash->items[sl->idx - 1]->data;
 
-		l = strlen(name) + 1;
-		hi = xzalloc(sizeof(*hi) + l);
-		strcpy(hi->name, name);
-
-		idx = idx % hash->csize;
-		hi->next = hash->items[idx];
-		hash->items[idx] = hi;
-		hash->glen += l;
+	/* keep at least half of the slots empty */
+	if (hash->nitems >= (hash->mask + 1) / 2) {
+		hash_rebuild(hash);
+		sl = hash_lookup(hash, name, hval);
 	}
+	l = strlen(name) + 1;
+	hi = hash_alloc(hash, HASH_ITEM_SIZE(l));
+	hi->hval = hval;
+	strcpy(hi->name, name);
+	hash->items[hash->nitems++] = hi;
+	sl->hval = hval;
+	sl->idx = hash->nitems;
+	hash->nel++;
+	hash->glen += l;
 	return &hi->data;
 }
 
@@ -802,19 +967,17 @@ static void *hash_find(xhash *hash, const char *name)
 
 static void hash_remove(xhash *hash, const char *name)
 {
-	hash_item *hi, **phi;
+	hash_slot *sl;
+	hash_item *hi;
 
-	phi = &hash->items[hashidx(name) % hash->csize];
-	while (*phi) {
-		hi = *phi;
-		if (strcmp(hi->name, name) == 0) {
-			hash->glen -= (strlen(name) + 1);
-			hash->nel--;
-			*phi = hi->next;
-			free(hi);
-			break;
-		}
-		phi = &hi->next;
+	sl = hash_lookup(hash, name, hashidx(name));
+	if (sl->idx) {
+		/* the slot stays, as a tombstone */
+		hi = hash->items[sl->idx - 1];
+		hash->items[sl->idx - 1] = NULL;
+		hash->glen -= (strlen(name) + 1);
+		hash->nel--;
+		hash_free_item(hash, hi);
 	}
 }
 
@@ -1337,6 +1500,23 @@ static void mk_re_node(const char *s, node *n, regex_t *re)
 }
 
 static node *parse_expr(uint32_t);
+static node *nextarg(node **pn);
+
+/* does op store into the operand which follows it? */
+static int is_store_prefix(uint32_t info)
+{
+	return info == TI_PREINC || info == TI_PREDEC
+		|| (info & OPCLSMASK) == OC_GETLINE
+		|| (info & OPCLSMASK) == OC_PGETLINE;
+}
+
+/* Storing into $N needs NF and all fields to rebuild $0:
+ * such programs can't split records lazily */
+static void note_field_store(node *n)
+{
+	if (n && (n->info & OPCLSMASK) == OC_FIELD)
+		G.full_split++;
+}
 
 static node *parse_lrparen_list(void)
 {
@@ -1391,6 +1571,11 @@ static node *parse_expr(uint32_t term_tc)
 			cn->a.n = vn->a.n;
 			if (tc & TS_BINOP) {
 				cn->l.n = vn;
+				if ((t_info & OPCLSMASK) == OC_MOVE
+				 || (t_info & OPCLSMASK) == OC_REPLACE
+				) {
+					note_field_store(vn);
+				}
 //FIXME: this is the place to detect and reject assignments to non-lvalues.
 //Currently we allow "assignments" to consts and temporaries, nonsense like this:
 // awk 'BEGIN { "qwe" = 1 }'
@@ -1407,6 +1592,7 @@ static node *parse_expr(uint32_t term_tc)
 				}
 			} else {
 				cn->r.n = vn;
+				note_field_store(vn); /* postfix ++ or -- */
 				expected_tc = TS_OPERAND | TS_UOPPRE | TS_BINOP | term_tc;
 			}
 			vn->a.n = cn;
@@ -1419,6 +1605,12 @@ static node *parse_expr(uint32_t term_tc)
 		vn = cn;
 		cn = vn->r.n = new_node(t_info);
 		cn->a.n = vn;
+		if ((tc & TC_UOPPRE1) && (t_info & OPCLSMASK) == OC_FIELD) {
+			/* until we see it is followed by a number */
+			G.full_split++;
+			if (is_store_prefix(vn->info))
+				note_field_store(cn);
+		}
 
 		expected_tc = TS_OPERAND | TS_UOPPRE | TC_REGEXP;
 		if (t_info == TI_PREINC || t_info == TI_PREDEC)
@@ -1454,9 +1646,15 @@ static node *parse_expr(uint32_t term_tc)
 			debug_printf_parse("%s: TC_NUMBER | TC_STRING\n", __func__);
 			cn->info = OC_VAR;
 			v = cn->l.v = xzalloc(sizeof(var));
-			if (tc & TC_NUMBER)
+			if (tc & TC_NUMBER) {
 				setvar_i(v, t_double);
-			else {
+				if ((vn->info & OPCLSMASK) == OC_FIELD) {
+					/* $NNN */
+					G.full_split--;
+					if (split_upto < t_double)
+						split_upto = t_double < INT_MAX ? t_double : INT_MAX;
+				}
+			} else {
 				setvar_s(v, t_string);
 				expected_tc &= ~TC_UOPPOST; /* "str"++ is not allowed */
 			}
@@ -1480,6 +1678,8 @@ static node *parse_expr(uint32_t term_tc)
 			if (!cn)
 				syntax_error("Empty sequence");
 			cn->a.n = vn;
+			if (is_store_prefix(vn->info))
+				note_field_store(cn);
 			break;
 
 		case TC_GETLINE:
@@ -1491,6 +1691,15 @@ static node *parse_expr(uint32_t term_tc)
 		case TC_BUILTIN:
 			debug_printf_parse("%s: TC_BUILTIN\n", __func__);
 			cn->l.n = parse_lrparen_list();
+			if ((cn->info & OPCLSMASK) == OC_BUILTIN
+			 && ((cn->info & OPNMASK) == B_su || (cn->info & OPNMASK) == B_gs)
+			) {
+				/* sub() and gsub() store into their 3rd argument */
+				vn = cn->l.n;
+				nextarg(&vn);
+				nextarg(&vn);
+				note_field_store(nextarg(&vn));
+			}
 			break;
 
 		case TC_LENGTH:
@@ -1652,6 +1861,7 @@ static void chain_group(void)
 		if (t_tclass & TC_RPAREN) {	/* for (I in ARRAY) */
 			if (!n2 || n2->info != TI_IN)
 				syntax_error(EMSG_UNEXP_TOKEN);
+			note_field_store(n2->l.n);
 			n = chain_node(OC_WALKINIT | VV);
 			n->l.n = n2->l.n;
 			n->r.n = n2->r.n;
@@ -1817,12 +2027,489 @@ static void parse_program(char *p)
 	} /* for (;;) */
 }
 
+/* -------- compiling to bytecode -------- */
+
+/* Chains and expressions are compiled to code for a stack machine,
+ * see execute(). The compiler knows the type of each stack cell */
+enum { T_V, T_N, T_S };
+
+typedef struct cstate_s {
+	insn *ins;
+	int n;          /* instructions so far */
+	int sp, depth;  /* stack cells in use now, and at most */
+	int calls;      /* calls out of this code so far, see BC_NEXTCHK */
+	unsigned lineno; /* g_lineno at this point, 0: not known */
+	int nfix;
+	struct {
+		int at;         /* jump at ins[at] goes to statement "to" */
+		node *to;
+	} *fix;
+} cstate;
+
+static insn *emit(cstate *cs, int op)
+{
+	static const signed char bc_stack[] ALIGN1 = {
+#define BC(name, n) n,
+		BYTECODE
+#undef BC
+	};
+	insn *i;
+
+	cs->ins = xrealloc_vector(cs->ins, 5, cs->n);
+	i = &cs->ins[cs->n++];
+	i->op = op;
+	cs->sp += bc_stack[op];
+	if (cs->depth < cs->sp)
+		cs->depth = cs->sp;
+	return i;
+}
+
+static code *compiled(cstate *cs)
+{
+	code *c = xzalloc(sizeof(*c));
+
+	c->ins = cs->ins;
+	c->depth = cs->depth;
+	return c;
+}
+
+/* builtins and getline are run by evaluate(), see BC_EVAL */
+static int evaluated_by_tree(uint32_t info)
+{
+	info &= OPCLSMASK;
+	return info == OC_BUILTIN || info == OC_FBLTIN || info == OC_SPRINTF
+		|| info == OC_GETLINE || info == OC_PGETLINE;
+}
+
+/* type of the value compile_value() leaves on the stack for n */
+static int natural_type(node *n)
+{
+	switch (n ? n->info & OPCLSMASK : 0) {
+	case OC_BINARY: case OC_COMPARE: case OC_IN: case OC_LAND:
+	case OC_LOR: case OC_MATCH: case OC_REGEXP: case OC_UNARY:
+		return T_N;
+	}
+	return T_V;
+}
+
+static int compile_value(cstate *cs, node *n);
+
+static void compile_expr(cstate *cs, node *n, int want)
+{
+	int t = compile_value(cs, n);
+
+	if (t == T_N && want != T_N) {
+		emit(cs, BC_NUMVAR);
+		t = T_V;
+	}
+	if (t == T_V && want == T_N)
+		emit(cs, BC_TONUM);
+	if (t == T_V && want == T_S)
+		emit(cs, BC_TOSTR);
+}
+
+/* evaluate n and jump if its truth is "sense", return the jump */
+static int compile_jump(cstate *cs, node *n, int sense)
+{
+	if (compile_value(cs, n) == T_N)
+		emit(cs, sense ? BC_JTN : BC_JFN);
+	else
+		emit(cs, sense ? BC_JT : BC_JF);
+	return cs->n - 1;
+}
+
+static int compile_value(cstate *cs, node *n)
+{
+	uint32_t info;
+	int opn, i, j;
+	insn *p;
+
+	if (!n) {
+		emit(cs, BC_CLEAR);
+		return T_V;
+	}
+	/* error messages tell the line of the failing expression */
+	if (n->lineno != cs->lineno) {
+		emit(cs, BC_LINE)->arg = n->lineno;
+		cs->lineno = n->lineno;
+	}
+	info = n->info;
+	opn = info & OPNMASK;
+	switch (info & OPCLSMASK) {
+	case OC_VAR:
+		if (n->r.n) {
+			compile_expr(cs, n->r.n, T_S);
+			emit(cs, BC_ELEM)->a.v = n->l.v;
+		} else {
+			emit(cs, n->l.v == intvar[NF] ? BC_VARNF : BC_VAR)->a.v = n->l.v;
+		}
+		return T_V;
+
+	case OC_FNARG:
+		if (n->r.n) {
+			compile_expr(cs, n->r.n, T_S);
+			emit(cs, BC_ELEMARG)->arg = n->l.aidx;
+		} else {
+			emit(cs, BC_ARG)->arg = n->l.aidx;
+		}
+		return T_V;
+
+	case OC_FIELD:
+		compile_expr(cs, n->r.n, T_N);
+		emit(cs, BC_FIELD);
+		return T_V;
+
+	case OC_REGEXP:
+		emit(cs, BC_REGEXP)->a.n = n;
+		return T_N;
+
+	case OC_MATCH:
+		compile_expr(cs, n->l.n, T_S);
+		if (n->r.n->info == TI_REGEXP) {
+			p = emit(cs, BC_MATCH);
+			p->a.n = n->r.n;
+		} else {
+			compile_expr(cs, n->r.n, T_S);
+			p = emit(cs, BC_MATCHDYN);
+		}
+		p->arg = opn;
+		return T_N;
+
+	case OC_IN:
+		compile_expr(cs, n->l.n, T_S);
+		compile_expr(cs, n->r.n, T_V);
+		emit(cs, BC_IN);
+		return T_N;
+
+	/* concatenation (" ") and index joining (",") */
+	case OC_CONCAT:
+	case OC_COMMA:
+		compile_expr(cs, n->l.n, T_S);
+		compile_expr(cs, n->r.n, T_S);
+		emit(cs, (info & OPCLSMASK) == OC_COMMA ? BC_COMMA : BC_CONCAT);
+		return T_V;
+
+	case OC_BINARY:
+		compile_expr(cs, n->l.n, T_N);
+		compile_expr(cs, n->r.n, T_N);
+		emit(cs, opn == '+' ? BC_ADD : opn == '-' ? BC_SUB
+			: opn == '*' ? BC_MUL : BC_ARITH)->arg = opn;
+		return T_N;
+
+	case OC_UNARY:
+		if (opn == '!') {
+			compile_expr(cs, n->r.n, T_V);
+			emit(cs, BC_NOT);
+		} else if (opn == 'P' || opn == 'M' || opn == 'p' || opn == 'm') {
+			compile_expr(cs, n->r.n, T_V);
+			emit(cs, (opn == 'P' || opn == 'M') ? BC_PREINC : BC_POSTINC)
+				->arg = (opn == 'P' || opn == 'p') ? 1 : -1;
+		} else {
+			compile_expr(cs, n->r.n, T_N);
+			if (opn == '-')
+				emit(cs, BC_NEG);
+		}
+		return T_N;
+
+	case OC_MOVE:
+		compile_expr(cs, n->l.n, T_V);
+		emit(cs, compile_value(cs, n->r.n) == T_N ? BC_MOVEN : BC_MOVE);
+		return T_V;
+
+	case OC_REPLACE:
+		compile_expr(cs, n->l.n, T_V);
+		emit(cs, BC_GETNUM);
+		compile_expr(cs, n->r.n, T_N);
+		emit(cs, BC_OPSET)->arg = opn;
+		return T_V;
+
+	case OC_COMPARE:
+		/* numbers compare as numbers, no need to make vars of them */
+		i = compile_value(cs, n->l.n);
+		if (i == T_N && natural_type(n->r.n) == T_N) {
+			compile_expr(cs, n->r.n, T_N);
+			emit(cs, BC_CMPN)->arg = opn;
+			return T_N;
+		}
+		if (i == T_N)
+			emit(cs, BC_NUMVAR);
+		compile_expr(cs, n->r.n, T_V);
+		emit(cs, BC_CMP)->arg = opn;
+		return T_N;
+
+	case OC_LAND:
+	case OC_LOR:
+		/* 0 or 1 */
+		i = compile_jump(cs, n->l.n, (info & OPCLSMASK) == OC_LOR);
+		emit(cs, compile_value(cs, n->r.n) == T_N ? BC_BOOL : BC_TRUTH);
+		j = cs->n;
+		emit(cs, BC_JMP);
+		cs->sp--;
+		cs->ins[i].arg = cs->n;
+		emit(cs, BC_PUSHN)->a.d = ((info & OPCLSMASK) == OC_LOR);
+		cs->ins[j].arg = cs->n;
+		cs->lineno = 0;
+		return T_N;
+
+	case OC_TERNARY:
+		if (n->r.n->info != TI_COLON)
+			break;
+		i = compile_jump(cs, n->l.n, 0);
+		compile_expr(cs, n->r.n->l.n, T_V);
+		j = cs->n;
+		emit(cs, BC_JMP);
+		cs->sp--;
+		cs->ins[i].arg = cs->n;
+		compile_expr(cs, n->r.n->r.n, T_V);
+		cs->ins[j].arg = cs->n;
+		cs->lineno = 0;
+		return T_V;
+
+	case OC_FUNC: {
+		func *f = n->r.f;
+		node *args = n->l.n;
+
+		emit(cs, BC_CALLSETUP)->a.f = f;
+		cs->calls++;
+		i = 0;
+		while (args) {
+			compile_expr(cs, nextarg(&args), T_V);
+			/* call with more arguments than function takes:
+			 * they are still evaluated, but discarded */
+			if (i == (int)f->nargs)
+				emit(cs, BC_DROPARG);
+			else
+				emit(cs, BC_PUTARG)->arg = i++;
+		}
+		emit(cs, BC_CALL)->a.f = f;
+		return T_V;
+	}
+
+	case OC_BUILTIN:
+	case OC_FBLTIN:
+	case OC_SPRINTF:
+	case OC_GETLINE:
+	case OC_PGETLINE:
+		emit(cs, BC_EVAL)->a.n = n;
+		cs->calls++;
+		return T_V;
+	}
+	emit(cs, BC_ERROR)->a.s = EMSG_POSSIBLE_ERROR;
+	cs->sp++; /* as if it pushed something */
+	return T_V;
+}
+
+/* compile expression which evaluate() is asked for */
+static code *compile_root(node *n)
+{
+	cstate cs;
+
+	memset(&cs, 0, sizeof(cs));
+	emit(&cs, compile_value(&cs, n) == T_N ? BC_RETN : BC_RETV);
+	return compiled(&cs);
+}
+
+/* jump just emitted goes to statement "to" */
+static void stmt_jump(cstate *cs, node *to)
+{
+	cs->fix = xrealloc_vector(cs->fix, 4, cs->nfix);
+	cs->fix[cs->nfix].at = cs->n - 1;
+	cs->fix[cs->nfix].to = to;
+	cs->nfix++;
+}
+
+/* compile statements from op on, following op->a.n.
+ * Branches to op->r.n are compiled later, see compile_chain() */
+static void compile_stmts(cstate *cs, node *op)
+{
+	while (op) {
+		uint32_t info = op->info;
+		node *op1 = op->l.n;
+		node *next = op->a.n;
+		int calls = cs->calls;
+		int t;
+
+		if (op->c.pc) {
+			emit(cs, BC_JMP);
+			stmt_jump(cs, op);
+			return;
+		}
+		op->c.pc = cs->n + 1;
+		/* can be jumped to. Expressions set the line
+		 * for their errors, see compile_value() */
+		cs->lineno = 0;
+
+		switch (info & OPCLSMASK) {
+		case OC_TEST:
+			if (op1->info == TI_COMMA) {
+				/* range pattern */
+				emit(cs, BC_RANGE)->a.n = op;
+				stmt_jump(cs, op->r.n);
+				break;
+			}
+			/* fall through */
+		/* branch, used in if-else and various loops */
+		case OC_BR:
+			t = compile_value(cs, op1);
+			if (cs->calls != calls)
+				emit(cs, BC_NEXTCHK);
+			calls = cs->calls;
+			emit(cs, t == T_N ? BC_JFN : BC_JF);
+			stmt_jump(cs, op->r.n);
+			break;
+
+		/* just evaluate an expression, also used as unconditional jump */
+		case OC_EXEC:
+			if ((info & OF_RES1) && op1) {
+				compile_value(cs, op1);
+				emit(cs, BC_POP);
+			}
+			break;
+
+		case OC_WALKINIT:
+			compile_expr(cs, op1, T_V);
+			compile_expr(cs, op->r.n, T_V);
+			emit(cs, BC_WALKINIT);
+			break;
+
+		case OC_WALKNEXT:
+			compile_expr(cs, op1, T_V);
+			emit(cs, BC_WALKNEXT);
+			stmt_jump(cs, op->r.n);
+			break;
+
+		case OC_PRINT:
+		case OC_PRINTF:
+			if (op->r.n) {
+				compile_expr(cs, op->r.n, T_S);
+				emit(cs, BC_OUTFILE)->arg = info & OPNMASK;
+			} else {
+				emit(cs, BC_STDOUT);
+			}
+			if ((info & OPCLSMASK) == OC_PRINTF) {
+				/* for format errors */
+				emit(cs, BC_LINE)->arg = op->lineno;
+				emit(cs, BC_PRINTF)->a.n = op1;
+				cs->calls++;
+				break;
+			}
+			if (!op1)
+				emit(cs, BC_PRINT0);
+			while (op1) {
+				compile_expr(cs, nextarg(&op1), T_V);
+				emit(cs, BC_PRINTARG)->arg = (op1 != NULL);
+			}
+			emit(cs, BC_PRINTEND);
+			break;
+
+		case OC_DELETE:
+			if ((op1->info & OPCLSMASK) == OC_VAR) {
+				emit(cs, BC_VAR)->a.v = op1->l.v;
+			} else if ((op1->info & OPCLSMASK) == OC_FNARG) {
+				emit(cs, BC_ARG)->arg = op1->l.aidx;
+			} else {
+				emit(cs, BC_LINE)->arg = op->lineno;
+				emit(cs, BC_ERROR)->a.s = EMSG_NOT_ARRAY;
+				break;
+			}
+			/* "delete array[var--]" must evaluate index expr only once */
+			if (op1->r.n) {
+				compile_expr(cs, op1->r.n, T_S);
+				emit(cs, BC_DELELEM);
+			} else {
+				emit(cs, BC_DELARR);
+			}
+			break;
+
+		case OC_NEWSOURCE:
+			emit(cs, BC_PROGNAME)->a.s = op->l.new_progname;
+			break;
+
+		case OC_RETURN:
+			compile_expr(cs, op1, T_V);
+			emit(cs, BC_RETURN);
+			return;
+
+		case OC_NEXTFILE:
+			emit(cs, BC_NEXTFILE);
+			return;
+
+		case OC_NEXT:
+			emit(cs, BC_NEXT);
+			return;
+
+		case OC_EXIT:
+			if (op1) {
+				compile_expr(cs, op1, T_N);
+				cs->sp--;
+			}
+			emit(cs, BC_EXIT)->arg = (op1 != NULL);
+			return;
+
+		default:
+			emit(cs, BC_LINE)->arg = op->lineno;
+			emit(cs, BC_ERROR)->a.s = EMSG_POSSIBLE_ERROR;
+			/* fall through */
+		case OC_DONE:
+			emit(cs, BC_DONE);
+			return;
+		}
+		if (cs->calls != calls)
+			emit(cs, BC_NEXTCHK);
+		op = next;
+	}
+	emit(cs, BC_DONE);
+}
+
+static void compile_chain(chain *ch)
+{
+	cstate cs;
+	int i;
+
+	memset(&cs, 0, sizeof(cs));
+	compile_stmts(&cs, ch->first);
+	/* jump targets not compiled yet (this adds more jumps) */
+	for (i = 0; i < cs.nfix; i++) {
+		if (!cs.fix[i].to->c.pc)
+			compile_stmts(&cs, cs.fix[i].to);
+	}
+	for (i = 0; i < cs.nfix; i++)
+		cs.ins[cs.fix[i].at].arg = cs.fix[i].to->c.pc - 1;
+	free(cs.fix);
+	ch->code = compiled(&cs);
+}
+
 /* -------- program execution part -------- */
 
-/* temporary variables allocator */
+/* Temporary variables allocator. Temporaries are freed in reverse
+ * order of allocation, so they are taken from a stack of blocks,
+ * not malloced one by one: evaluate() and execute() take some per call */
 static var *nvalloc(int sz)
 {
-	return xzalloc(sz * sizeof(var));
+	nvblock *cb = g_cb;
+	var *v;
+
+	if (!cb || cb->end - cb->pos < sz) {
+		/* blocks after the current one are all unused */
+		nvblock *nb = cb ? cb->next : NULL;
+
+		if (!nb || nb->end - nb->nv < sz) {
+			int size = sz > NVBLOCK_SIZE ? sz : NVBLOCK_SIZE;
+
+			nb = xmalloc(sizeof(*nb) + size * sizeof(var));
+			nb->end = nb->nv + size;
+			nb->next = cb ? cb->next : NULL;
+			if (cb)
+				cb->next = nb;
+		}
+		nb->prev = cb;
+		nb->pos = nb->nv;
+		g_cb = cb = nb;
+	}
+
+	v = cb->pos;
+	cb->pos += sz;
+	return memset(v, 0, sz * sizeof(var));
 }
 
 static void nvfree(var *v, int sz)
@@ -1831,9 +2518,7 @@ static void nvfree(var *v, int sz)
 
 	while (--sz >= 0) {
 		if ((p->type & (VF_ARRAY | VF_CHILD)) == VF_ARRAY) {
-			clear_array(iamarray(p));
-			free(p->x.array->items);
-			free(p->x.array);
+			hash_free(iamarray(p));
 		}
 		if (p->type & VF_WALK) {
 			walker_list *n;
@@ -1851,7 +2536,9 @@ static void nvfree(var *v, int sz)
 		p++;
 	}
 
-	free(v);
+	g_cb->pos = v;
+	while (g_cb->pos == g_cb->nv && g_cb->prev)
+		g_cb = g_cb->prev;
 }
 
 static node *mk_splitter(const char *s, tsplitter *spl)
@@ -1877,13 +2564,29 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 
 static var *evaluate(node *, var *);
 
+/* Compile string s to a regex in preg, for dynamic regexps */
+static void mk_regex(const char *s, regex_t *preg)
+{
+	int cflags;
+
+	cflags = icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED;
+	/* Testcase where REG_EXTENDED fails (unpaired '{'):
+	 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
+	 * gawk 3.1.5 eats this. We revert to ~REG_EXTENDED
+	 * (maybe gsub is not supposed to use REG_EXTENDED?).
+	 */
+	if (regcomp(preg, s, cflags)) {
+		cflags &= ~REG_EXTENDED;
+		xregcomp(preg, s, cflags);
+	}
+}
+
 /* Use node as a regular expression. Supplied with node ptr and regex_t
  * storage space. Return ptr to regex (if result points to preg, it should
  * be later regfree'd manually).
  */
 static regex_t *as_regex(node *op, regex_t *preg)
 {
-	int cflags;
 	const char *s;
 
 	if (op->info == TI_REGEXP) {
@@ -1897,17 +2600,7 @@ static regex_t *as_regex(node *op, regex_t *preg)
 	// The rule to work safely is to never call evaluate() while our static
 	// TMPVAR's value is still needed.
 	s = getvar_s(evaluate(op, TMPVAR));
-
-	cflags = icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED;
-	/* Testcase where REG_EXTENDED fails (unpaired '{'):
-	 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
-	 * gawk 3.1.5 eats this. We revert to ~REG_EXTENDED
-	 * (maybe gsub is not supposed to use REG_EXTENDED?).
-	 */
-	if (regcomp(preg, s, cflags)) {
-		cflags &= ~REG_EXTENDED;
-		xregcomp(preg, s, cflags);
-	}
+	mk_regex(s, preg);
 	//nvfree(tmpvar, 1);
 #undef TMPVAR
 	return preg;
@@ -1980,7 +2673,8 @@ static int regexec1_nonempty(const regex_t *preg, const char *s, regmatch_t pmat
 	return r;
 }
 
-static int awk_split(const char *s, node *spl, char **slist)
+/* split s into at most limit fields, return their number */
+static int awk_split(const char *s, node *spl, char **slist, int limit)
 {
 	int n;
 	char c[4];
@@ -2019,17 +2713,17 @@ static int awk_split(const char *s, node *spl, char **slist)
 			s1 = mempcpy(s1, s, l);
 			*s1++ = '\0';
 			s += pmatch[0].rm_eo;
-		} while (*s);
+		} while (*s && n <= limit);
 
 		/* echo a-- | awk -F-- '{ print NF, length($NF), $NF }'
 		 * should print "2 0 ":
 		 */
 		*s1 = '\0';
 
-		return n;
+		return n > limit ? limit : n;
 	}
 	if (c[0] == '\0') {  /* null split */
-		while (*s) {
+		while (*s && n < limit) {
 			*s1++ = *s++;
 			*s1++ = '\0';
 			n++;
@@ -2043,14 +2737,20 @@ static int awk_split(const char *s, node *spl, char **slist)
 		}
 		if (*s1)
 			n++;
-		while ((s1 = strpbrk(s1, c)) != NULL) {
+		while (n < limit && (s1 = strpbrk(s1, c)) != NULL) {
 			*s1++ = '\0';
 			n++;
 		}
+		if (n == limit) {
+			/* terminate the last field we were asked for */
+			s1 = strpbrk(s1, c);
+			if (s1)
+				*s1 = '\0';
+		}
 		return n;
 	}
 	/* space split */
-	while (*s) {
+	while (*s && n < limit) {
 		s = skip_whitespace(s);
 		if (!*s)
 			break;
@@ -2062,7 +2762,13 @@ static int awk_split(const char *s, node *spl, char **slist)
 	return n;
 }
 
-static void split_f0(void)
+/* Split $0 into at least the first upto fields (all of them if there
+ * are fewer). $N reads ask only for split_upto fields: the highest
+ * constant $N in the program, unless it has $expr or stores to fields.
+ * The rest of a long record is then never looked at. NF, FS changes
+ * and the like ask for INT_MAX.
+ */
+static void split_f0(int upto)
 {
 /* static char *fstrings; */
 #define fstrings (G.split_f0__fstrings)
@@ -2070,13 +2776,17 @@ static void split_f0(void)
 	int i, n;
 	char *s;
 
-	if (is_f0_split)
+	if (is_f0_split && (!is_f0_partial || upto <= nfields))
 		return;
 
 	is_f0_split = TRUE;
 	free(fstrings);
 	fsrealloc(0);
-	n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings);
+	n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings, upto);
+	/* NB: NF is wrong after a partial split. Reading NF splits
+	 * completely first, and programs which store into fields
+	 * (the only other users of NF) never split partially */
+	is_f0_partial = (n == upto);
 	fsrealloc(n);
 	s = fstrings;
 	for (i = 0; i < n; i++) {
@@ -2128,6 +2838,7 @@ static void handle_special(var *v)
 			b[len] = '\0';
 		setvar_p(intvar[F0], b);
 		is_f0_split = TRUE;
+		is_f0_partial = FALSE;
 
 	} else if (v == intvar[F0]) {
 		is_f0_split = FALSE;
@@ -2143,7 +2854,7 @@ static void handle_special(var *v)
 		 *
 		 * So, split up current line before assignment to FS:
 		 */
-		split_f0();
+		split_f0(INT_MAX);
 
 		mk_splitter(getvar_s(v), &fsplitter);
 	} else if (v == intvar[RS]) {
@@ -2191,12 +2902,10 @@ static void hashwalk_init(var *v, xhash *array)
 	debug_printf_walker(" walker@%p=%p\n", &v->x.walker, w);
 	w->cur = w->end = w->wbuf;
 	w->prev = prev_walker;
-	for (i = 0; i < array->csize; i++) {
+	for (i = 0; i < array->nitems; i++) {
 		hi = array->items[i];
-		while (hi) {
+		if (hi)
 			w->end = stpcpy(w->end, hi->name) + 1;
-			hi = hi->next;
-		}
 	}
 }
 
@@ -2658,7 +3367,7 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 			spl = &fsplitter.n;
 		}
 
-		n = awk_split(as[0], spl, &s);
+		n = awk_split(as[0], spl, &s, INT_MAX);
 		s1 = s;
 		clear_array(iamarray(av[1]));
 		for (i = 1; i <= n; i++)
@@ -2851,12 +3560,453 @@ static rstream *next_input_file(void)
 #undef files_happen
 }
 
+/* Open output redirection "name", opn is 'w', 'a' or '|' */
+static FILE *output_stream(const char *name, int opn)
+{
+	rstream *rsm = newfile(name);
+
+	if (!rsm->F) {
+		if (opn == '|') {
+			rsm->F = popen(name, "w");
+			if (rsm->F == NULL)
+				bb_simple_perror_msg_and_die("popen");
+			rsm->is_pipe = 1;
+		} else {
+			rsm->F = xfopen(name, opn=='w' ? "w" : "a");
+		}
+	}
+	return rsm->F;
+}
+
+static double arith(int opn, double L_d, double R_d)
+{
+	switch (opn) {
+	case '+':
+		L_d += R_d;
+		break;
+	case '-':
+		L_d -= R_d;
+		break;
+	case '*':
+		L_d *= R_d;
+		break;
+	case '/':
+		if (R_d == 0)
+			syntax_error(EMSG_DIV_BY_ZERO);
+		L_d /= R_d;
+		break;
+	case '&':
+		if (ENABLE_FEATURE_AWK_LIBM)
+			L_d = pow(L_d, R_d);
+		else
+			syntax_error(EMSG_NO_MATH);
+		break;
+	case '%':
+		if (R_d == 0)
+			syntax_error(EMSG_DIV_BY_ZERO);
+		L_d -= (long long)(L_d / R_d) * R_d;
+		break;
+	}
+	return L_d;
+}
+
+/* Ld is the difference of compared values */
+static int compare_result(int opn, double Ld)
+{
+	int i = i; /* for compiler */
+
+	switch (opn & 0xfe) {
+	case 0:
+		i = (Ld > 0);
+		break;
+	case 2:
+		i = (Ld >= 0);
+		break;
+	case 4:
+		i = (Ld == 0);
+		break;
+	}
+	return (i == 0) ^ (opn & 1);
+}
+
 /*
- * Evaluate node - the heart of the program. Supplied with subtree
- * and "res" variable to assign the result to if we evaluate an expression.
- * If node refers to e.g. a variable or a field, no assignment happens.
+ * Execute compiled code, see compile_chain() and compile_root().
+ * Each stack cell k owns the temporary variable tmps[k]: results
+ * which are not somebody else's variables are made there.
  * Return ptr to the result (which may or may not be the "res" variable!)
  */
+static var *execute(const code *c, var *res)
+{
+/* This procedure is recursive so we should count every byte */
+#define fnargs (G.evaluate__fnargs)
+#define sreg   (G.evaluate__sreg)
+	static const void *const jump[] = {
+#define BC(name, n) &&do_##name,
+		BYTECODE
+#undef BC
+	};
+	const insn *ins = c->ins;
+	const insn *pc = ins;
+	var *tmps = nvalloc(c->depth);
+	var *args = fnargs;
+	/* st[0] is unused, sp points to the top cell */
+	cell st[c->depth + 1];
+	cell *sp = st;
+
+#define TMP(p)    (tmps + ((p) - st - 1))
+#define NEXT()    goto *jump[(++pc)->op]
+#define JUMP()    do { pc = ins + pc->arg; goto *jump[pc->op]; } while (0)
+
+	goto *jump[pc->op];
+
+ do_VAR:
+	(++sp)->v = pc->a.v;
+	NEXT();
+ do_VARNF:
+	/* reading NF splits $0 */
+	split_f0(INT_MAX);
+	(++sp)->v = pc->a.v;
+	NEXT();
+ do_ARG:
+	(++sp)->v = &args[pc->arg];
+	NEXT();
+ do_ELEM:
+	sp->v = findvar(iamarray(pc->a.v), sp->s);
+	NEXT();
+ do_ELEMARG:
+	sp->v = findvar(iamarray(&args[pc->arg]), sp->s);
+	NEXT();
+ do_CLEAR:
+	sp++;
+	sp->v = setvar_s(TMP(sp), NULL);
+	NEXT();
+ do_EVAL:
+	sp++;
+	sp->v = evaluate(pc->a.n, TMP(sp));
+	NEXT();
+ do_TONUM:
+	sp->d = getvar_i(sp->v);
+	NEXT();
+ do_TOSTR:
+	sp->s = getvar_s(sp->v);
+	NEXT();
+ do_NUMVAR:
+	sp->v = setvar_i(TMP(sp), sp->d);
+	NEXT();
+ do_POP:
+	sp--;
+	NEXT();
+ do_FIELD: {
+	int i = (int)sp->d;
+
+	if (i < 0)
+		syntax_error(EMSG_NEGATIVE_FIELD);
+	if (i == 0) {
+		sp->v = intvar[F0];
+	} else {
+		split_f0(split_upto);
+		if (i > nfields)
+			fsrealloc(i);
+		sp->v = &Fields[i - 1];
+	}
+	NEXT();
+ }
+ do_REGEXP: {
+	/* bare regexp matches $0 */
+	node *n = pc->a.n;
+
+	(++sp)->d = (regexec(icase ? n->r.ire : n->l.re,
+			getvar_s(intvar[F0]), 0, NULL, 0) == 0);
+	NEXT();
+ }
+ do_MATCH: {
+	node *n = pc->a.n;
+
+	sp->d = (regexec(icase ? n->r.ire : n->l.re, sp->s, 0, NULL, 0) == 0)
+		^ (pc->arg == '!');
+	NEXT();
+ }
+ do_MATCHDYN: {
+	int i;
+
+	mk_regex(sp->s, &sreg);
+	sp--;
+	i = regexec(&sreg, sp->s, 0, NULL, 0);
+	regfree(&sreg);
+	sp->d = (i == 0) ^ (pc->arg == '!');
+	NEXT();
+ }
+ do_IN:
+	sp--;
+	sp->d = (hash_search(iamarray(sp[1].v), sp->s) != NULL);
+	NEXT();
+ do_CONCAT:
+	sp--;
+	sp->v = setvar_p(TMP(sp), xasprintf("%s%s", sp->s, sp[1].s));
+	NEXT();
+ do_COMMA:
+	sp--;
+	sp->v = setvar_p(TMP(sp), xasprintf("%s%s%s", sp->s,
+			getvar_s(intvar[SUBSEP]), sp[1].s));
+	NEXT();
+ do_ADD:
+	sp--;
+	sp->d += sp[1].d;
+	NEXT();
+ do_SUB:
+	sp--;
+	sp->d -= sp[1].d;
+	NEXT();
+ do_MUL:
+	sp--;
+	sp->d *= sp[1].d;
+	NEXT();
+ do_ARITH:
+	sp--;
+	sp->d = arith(pc->arg, sp->d, sp[1].d);
+	NEXT();
+ do_NEG:
+	sp->d = -sp->d;
+	NEXT();
+ do_NOT:
+	sp->d = !istrue(sp->v);
+	NEXT();
+ do_BOOL:
+	sp->d = (sp->d != 0);
+	NEXT();
+ do_TRUTH:
+	sp->d = istrue(sp->v);
+	NEXT();
+ do_PREINC:
+ do_POSTINC: {
+	double d = getvar_i(sp->v);
+
+	setvar_i(sp->v, d + pc->arg);
+	sp->d = (pc->op == BC_PREINC) ? d + pc->arg : d;
+	NEXT();
+ }
+ do_MOVE:
+	sp--;
+	/* if source is a temporary string, just relink it to dest */
+	if (sp[1].v == TMP(sp + 1)
+	 && !(sp[1].v->type & VF_NUMBER)
+		/* Why check !NUMBER? if source is a number but has cached string,
+		 * dest ends up a string, which is wrong */
+	) {
+		setvar_p(sp->v, sp[1].v->string); /* avoids strdup */
+		sp[1].v->string = NULL;
+	} else {
+		copyvar(sp->v, sp[1].v);
+	}
+	NEXT();
+ do_MOVEN:
+	sp--;
+	setvar_i(sp->v, sp[1].d);
+	NEXT();
+ do_GETNUM:
+	sp[1].d = getvar_i(sp->v);
+	sp++;
+	NEXT();
+ do_OPSET:
+	sp -= 2;
+	setvar_i(sp->v, arith(pc->arg, sp[1].d, sp[2].d));
+	NEXT();
+ do_CMP: {
+	double Ld;
+
+	sp--;
+	if (is_numeric(sp->v) && is_numeric(sp[1].v)) {
+		Ld = getvar_i(sp->v) - getvar_i(sp[1].v);
+	} else {
+		const char *l = getvar_s(sp->v);
+		const char *r = getvar_s(sp[1].v);
+		Ld = icase ? strcasecmp(l, r) : strcmp(l, r);
+	}
+	sp->d = compare_result(pc->arg, Ld);
+	NEXT();
+ }
+ do_CMPN:
+	sp--;
+	sp->d = compare_result(pc->arg, sp->d - sp[1].d);
+	NEXT();
+ do_PUSHN:
+	(++sp)->d = pc->a.d;
+	NEXT();
+ do_JMP:
+	JUMP();
+ do_JF:
+	if (!istrue((sp--)->v))
+		JUMP();
+	NEXT();
+ do_JT:
+	if (istrue((sp--)->v))
+		JUMP();
+	NEXT();
+ do_JFN:
+	if ((sp--)->d == 0)
+		JUMP();
+	NEXT();
+ do_JTN:
+	if ((sp--)->d != 0)
+		JUMP();
+	NEXT();
+
+ do_CALLSETUP:
+	if (!pc->a.f->defined)
+		syntax_error(EMSG_UNDEF_FUNC);
+	/* the body might be empty, still has to eval the args */
+	(++sp)->v = nvalloc(pc->a.f->nargs);
+	NEXT();
+ do_PUTARG: {
+	var *argvars = sp[-1].v;
+
+	copyvar(&argvars[pc->arg], sp->v);
+	argvars[pc->arg].type |= VF_CHILD;
+	argvars[pc->arg].x.parent = sp->v;
+	sp--;
+	NEXT();
+ }
+ do_DROPARG:
+	/* (gawk warns: "warning: function 'f' called with more arguments than declared") */
+	clrvar((sp--)->v);
+	NEXT();
+ do_CALL: {
+	var *argvars = sp->v;
+	const char *sv_progname = g_progname;
+	unsigned sv_lineno = g_lineno;
+
+	fnargs = argvars;
+	sp->v = execute(pc->a.f->body.code, TMP(sp));
+	nvfree(argvars, pc->a.f->nargs);
+	fnargs = args;
+	g_progname = sv_progname;
+	g_lineno = sv_lineno;
+	NEXT();
+ }
+ do_RETV:
+	/* tmps are freed below */
+	res = (sp->v == tmps) ? copyvar(res, sp->v) : sp->v;
+	goto out;
+ do_RETN:
+	res = setvar_i(res, sp->d);
+	goto out;
+ do_ERROR:
+	syntax_error(pc->a.s);
+ do_LINE:
+	g_lineno = pc->arg;
+	NEXT();
+ do_PROGNAME:
+	g_progname = pc->a.s;
+	NEXT();
+
+ do_STDOUT:
+	(++sp)->F = stdout;
+	NEXT();
+ do_OUTFILE:
+	sp->F = output_stream(sp->s, pc->arg);
+	NEXT();
+ do_PRINTARG: {
+	var *v = (sp--)->v;
+
+	if (v->type & VF_NUMBER) {
+		fmt_num(getvar_s(intvar[OFMT]), getvar_i(v));
+		fputs(g_buf, sp->F);
+	} else {
+		fputs(getvar_s(v), sp->F);
+	}
+	if (pc->arg)
+		fputs(getvar_s(intvar[OFS]), sp->F);
+	NEXT();
+ }
+ do_PRINT0:
+	fputs(getvar_s(intvar[F0]), sp->F);
+	NEXT();
+ do_PRINTEND:
+	fputs(getvar_s(intvar[ORS]), sp->F);
+	fflush(sp->F);
+	sp--;
+	NEXT();
+ do_PRINTF: {
+	IF_FEATURE_AWK_GNU_EXTENSIONS(size_t len;)
+	char *s = awk_printf(pc->a.n, &len);
+#if ENABLE_FEATURE_AWK_GNU_EXTENSIONS
+	fwrite(s, len, 1, sp->F);
+#else
+	fputs(s, sp->F);
+#endif
+	free(s);
+	fflush(sp->F);
+	sp--;
+	NEXT();
+ }
+
+ do_DELELEM:
+	sp -= 2;
+	hash_remove(iamarray(sp[1].v), sp[2].s);
+	NEXT();
+ do_DELARR:
+	clear_array(iamarray((sp--)->v));
+	NEXT();
+ do_WALKINIT:
+	sp -= 2;
+	hashwalk_init(sp[1].v, iamarray(sp[2].v));
+	NEXT();
+ do_WALKNEXT:
+	if (!hashwalk_next((sp--)->v))
+		JUMP();
+	NEXT();
+ do_RANGE: {
+	node *op = pc->a.n;
+
+	if ((op->info & OF_CHECKED) || ptest(op->l.n->l.n)) {
+		op->info |= OF_CHECKED;
+		if (ptest(op->l.n->r.n))
+			op->info &= ~OF_CHECKED;
+		if (nextrec)
+			goto out;
+		NEXT();
+	}
+	if (nextrec)
+		goto out;
+	JUMP();
+ }
+ do_RETURN:
+	copyvar(res, sp->v);
+	goto out;
+ do_NEXTFILE:
+	nextfile = TRUE;
+ do_NEXT:
+	nextrec = TRUE;
+ do_DONE:
+	clrvar(res);
+	goto out;
+ do_NEXTCHK:
+	if (nextrec)
+		goto out;
+	NEXT();
+ do_EXIT:
+	if (pc->arg)
+		G.exitcode = (int)sp->d;
+	awk_exit();
+
+ out:
+	nvfree(tmps, c->depth);
+	return res;
+#undef TMP
+#undef NEXT
+#undef JUMP
+#undef fnargs
+#undef sreg
+}
+
+/*
+ * Evaluate node. Supplied with subtree and "res" variable to assign
+ * the result to. If node refers to e.g. a variable or a field,
+ * no assignment happens. Return ptr to the result (which may or may
+ * not be the "res" variable!)
+ * Expressions are compiled on first use and run by execute(),
+ * getline and builtins are evaluated here.
+ */
 #define XC(n) ((n) >> 8)
 
 static var *evaluate(node *op, var *res)
@@ -2865,674 +4015,275 @@ static var *evaluate(node *op, var *res)
 #define fnargs (G.evaluate__fnargs)
 /* seed is initialized to 1 */
 #define seed   (G.evaluate__seed)
-#define sreg   (G.evaluate__sreg)
 
 	var *tmpvars;
+	struct {
+		var *v;
+		const char *s;
+	} L = L; /* for compiler */
+	struct {
+		var *v;
+		const char *s;
+	} R = R;
+	double L_d = L_d;
+	uint32_t opinfo;
+	int opn;
+	node *op1;
 
 	if (!op)
 		return setvar_s(res, NULL);
 
+	opinfo = op->info;
+	/* Plain variables and constants are the most common operands.
+	 * Except NF: reading it splits $0 */
+	if (opinfo == OC_VAR && op->l.v != intvar[NF])
+		return op->l.v;
+	if (opinfo == OC_FNARG)
+		return &fnargs[op->l.aidx];
+	if (!evaluated_by_tree(opinfo)) {
+		if (!op->c.code)
+			op->c.code = compile_root(op);
+		return execute(op->c.code, res);
+	}
+
 	debug_printf_eval("entered %s()\n", __func__);
 
 	tmpvars = nvalloc(2);
 #define TMPVAR0 (tmpvars)
 #define TMPVAR1 (tmpvars + 1)
 
-	while (op) {
-		struct {
-			var *v;
-			const char *s;
-		} L = L; /* for compiler */
-		struct {
-			var *v;
-			const char *s;
-		} R = R;
-		double L_d = L_d;
-		uint32_t opinfo;
-		int opn;
-		node *op1;
-
-		opinfo = op->info;
-		opn = (opinfo & OPNMASK);
-		g_lineno = op->lineno;
-		op1 = op->l.n;
-		debug_printf_eval("opinfo:%08x opn:%08x\n", opinfo, opn);
-
-		/* execute inevitable things */
-		if (opinfo & OF_RES1) {
-			if ((opinfo & OF_REQUIRED) && !op1)
-				syntax_error(EMSG_TOO_FEW_ARGS);
-			L.v = evaluate(op1, TMPVAR0);
-			if (opinfo & OF_STR1) {
-				L.s = getvar_s(L.v);
-				debug_printf_eval("L.s:'%s'\n", L.s);
-			}
-			if (opinfo & OF_NUM1) {
-				L_d = getvar_i(L.v);
-				debug_printf_eval("L_d:%f\n", L_d);
-			}
+	opn = (opinfo & OPNMASK);
+	g_lineno = op->lineno;
+	op1 = op->l.n;
+	debug_printf_eval("opinfo:%08x opn:%08x\n", opinfo, opn);
+
+	/* execute inevitable things */
+	if (opinfo & OF_RES1) {
+		if ((opinfo & OF_REQUIRED) && !op1)
+			syntax_error(EMSG_TOO_FEW_ARGS);
+		L.v = evaluate(op1, TMPVAR0);
+		if (opinfo & OF_STR1) {
+			L.s = getvar_s(L.v);
+			debug_printf_eval("L.s:'%s'\n", L.s);
 		}
-		/* NB: Must get string/numeric values of L (done above)
-		 * _before_ evaluate()'ing R.v: if both L and R are $NNNs,
-		 * and right one is large, then L.v points to Fields[NNN1],
-		 * second evaluate() reallocates and moves (!) Fields[],
-		 * R.v points to Fields[NNN2] but L.v now points to freed mem!
-		 * (Seen trying to evaluate "$444 $44444")
-		 */
-		if (opinfo & OF_RES2) {
-			R.v = evaluate(op->r.n, TMPVAR1);
-			//TODO: L.v may be invalid now, set L.v to NULL to catch bugs?
-			//L.v = NULL;
-			if (opinfo & OF_STR2) {
-				R.s = getvar_s(R.v);
-				debug_printf_eval("R.s:'%s'\n", R.s);
-			}
+		if (opinfo & OF_NUM1) {
+			L_d = getvar_i(L.v);
+			debug_printf_eval("L_d:%f\n", L_d);
 		}
+	}
+	/* NB: Must get string/numeric values of L (done above)
+	 * _before_ evaluate()'ing R.v: if both L and R are $NNNs,
+	 * and right one is large, then L.v points to Fields[NNN1],
+	 * second evaluate() reallocates and moves (!) Fields[],
+	 * R.v points to Fields[NNN2] but L.v now points to freed mem!
+	 * (Seen trying to evaluate "$444 $44444")
+	 */
+	if (opinfo & OF_RES2) {
+		R.v = evaluate(op->r.n, TMPVAR1);
+		//TODO: L.v may be invalid now, set L.v to NULL to catch bugs?
+		//L.v = NULL;
+		if (opinfo & OF_STR2) {
+			R.s = getvar_s(R.v);
+			debug_printf_eval("R.s:'%s'\n", R.s);
+		}
+	}
 
-		debug_printf_eval("switch(0x%x)\n", XC(opinfo & OPCLSMASK));
-		switch (XC(opinfo & OPCLSMASK)) {
-
-		/* -- iterative node type -- */
-
-		/* test pattern */
-		case XC( OC_TEST ):
-			debug_printf_eval("TEST\n");
-			if (op1->info == TI_COMMA) {
-				/* it's range pattern */
-				if ((opinfo & OF_CHECKED) || ptest(op1->l.n)) {
-					op->info |= OF_CHECKED;
-					if (ptest(op1->r.n))
-						op->info &= ~OF_CHECKED;
-					op = op->a.n;
-				} else {
-					op = op->r.n;
-				}
-			} else {
-				op = ptest(op1) ? op->a.n : op->r.n;
-			}
-			break;
-
-		/* just evaluate an expression, also used as unconditional jump */
-		case XC( OC_EXEC ):
-			debug_printf_eval("EXEC\n");
-			break;
-
-		/* branch, used in if-else and various loops */
-		case XC( OC_BR ):
-			debug_printf_eval("BR\n");
-			op = istrue(L.v) ? op->a.n : op->r.n;
-			break;
-
-		/* initialize for-in loop */
-		case XC( OC_WALKINIT ):
-			debug_printf_eval("WALKINIT\n");
-			hashwalk_init(L.v, iamarray(R.v));
-			break;
-
-		/* get next array item */
-		case XC( OC_WALKNEXT ):
-			debug_printf_eval("WALKNEXT\n");
-			op = hashwalk_next(L.v) ? op->a.n : op->r.n;
-			break;
-
-		case XC( OC_PRINT ):
-			debug_printf_eval("PRINT /\n");
-		case XC( OC_PRINTF ):
-			debug_printf_eval("PRINTF\n");
-		{
-			FILE *F = stdout;
-
-			if (op->r.n) {
-				rstream *rsm = newfile(R.s);
-				if (!rsm->F) {
-					if (opn == '|') {
-						rsm->F = popen(R.s, "w");
-						if (rsm->F == NULL)
-							bb_simple_perror_msg_and_die("popen");
-						rsm->is_pipe = 1;
-					} else {
-						rsm->F = xfopen(R.s, opn=='w' ? "w" : "a");
-					}
-				}
-				F = rsm->F;
-			}
+	debug_printf_eval("switch(0x%x)\n", XC(opinfo & OPCLSMASK));
+	switch (XC(opinfo & OPCLSMASK)) {
 
-			/* Can't just check 'opinfo == OC_PRINT' here, parser ORs
-			 * additional bits to opinfos of print/printf with redirects
-			 */
-			if ((opinfo & OPCLSMASK) == OC_PRINT) {
-				if (!op1) {
-					fputs(getvar_s(intvar[F0]), F);
+	case XC( OC_GETLINE ):
+		debug_printf_eval("GETLINE /\n");
+	case XC( OC_PGETLINE ):
+		debug_printf_eval("PGETLINE\n");
+	{
+		rstream *rsm;
+		int i;
+
+		if (op1) {
+			rsm = newfile(L.s);
+			if (!rsm->F) {
+				/* NB: can't use "opinfo == TI_PGETLINE", would break "cmd" | getline */
+				if ((opinfo & OPCLSMASK) == OC_PGETLINE) {
+					rsm->F = popen(L.s, "r");
+					rsm->is_pipe = TRUE;
 				} else {
-					for (;;) {
-						var *v = evaluate(nextarg(&op1), TMPVAR0);
-						if (v->type & VF_NUMBER) {
-							fmt_num(getvar_s(intvar[OFMT]),
-									getvar_i(v));
-							fputs(g_buf, F);
-						} else {
-							fputs(getvar_s(v), F);
-						}
-						if (!op1)
-							break;
-						fputs(getvar_s(intvar[OFS]), F);
-					}
+					rsm->F = fopen_for_read(L.s);  /* not xfopen! */
 				}
-				fputs(getvar_s(intvar[ORS]), F);
-			} else {	/* PRINTF */
-				IF_FEATURE_AWK_GNU_EXTENSIONS(size_t len;)
-				char *s = awk_printf(op1, &len);
-#if ENABLE_FEATURE_AWK_GNU_EXTENSIONS
-				fwrite(s, len, 1, F);
-#else
-				fputs(s, F);
-#endif
-				free(s);
 			}
-			fflush(F);
-			break;
+		} else {
+			if (!iF)
+				iF = next_input_file();
+			rsm = iF;
 		}
 
-		case XC( OC_DELETE ):
-			debug_printf_eval("DELETE\n");
-		{
-			/* "delete" is special:
-			 * "delete array[var--]" must evaluate index expr only once.
-			 */
-			uint32_t info = op1->info & OPCLSMASK;
-			var *v;
-
-			if (info == OC_VAR) {
-				v = op1->l.v;
-			} else if (info == OC_FNARG) {
-				v = &fnargs[op1->l.aidx];
-			} else {
-				syntax_error(EMSG_NOT_ARRAY);
-			}
-			if (op1->r.n) { /* array ref? */
-				const char *s;
-				s = getvar_s(evaluate(op1->r.n, TMPVAR0));
-				hash_remove(iamarray(v), s);
-			} else {
-				clear_array(iamarray(v));
-			}
+		if (!rsm || !rsm->F) {
+			setvar_i(intvar[ERRNO], errno);
+			setvar_i(res, -1);
 			break;
 		}
 
-		case XC( OC_NEWSOURCE ):
-			debug_printf_eval("NEWSOURCE\n");
-			g_progname = op->l.new_progname;
-			break;
-
-		case XC( OC_RETURN ):
-			debug_printf_eval("RETURN\n");
-			copyvar(res, L.v);
-			break;
-
-		case XC( OC_NEXTFILE ):
-			debug_printf_eval("NEXTFILE\n");
-			nextfile = TRUE;
-		case XC( OC_NEXT ):
-			debug_printf_eval("NEXT\n");
-			nextrec = TRUE;
-		case XC( OC_DONE ):
-			debug_printf_eval("DONE\n");
-			clrvar(res);
-			break;
-
-		case XC( OC_EXIT ):
-			debug_printf_eval("EXIT\n");
-			if (op1)
-				G.exitcode = (int)L_d;
-			awk_exit();
-
-		/* -- recursive node type -- */
-
-		case XC( OC_VAR ):
-			debug_printf_eval("VAR\n");
-			L.v = op->l.v;
-			if (L.v == intvar[NF])
-				split_f0();
-			goto v_cont;
-
-		case XC( OC_FNARG ):
-			debug_printf_eval("FNARG[%d]\n", op->l.aidx);
-			L.v = &fnargs[op->l.aidx];
- v_cont:
-			res = op->r.n ? findvar(iamarray(L.v), R.s) : L.v;
-			break;
-
-		case XC( OC_IN ):
-			debug_printf_eval("IN\n");
-			setvar_i(res, hash_search(iamarray(R.v), L.s) ? 1 : 0);
-			break;
-
-		case XC( OC_REGEXP ):
-			debug_printf_eval("REGEXP\n");
-			op1 = op;
-			L.s = getvar_s(intvar[F0]);
-			goto re_cont;
-
-		case XC( OC_MATCH ):
-			debug_printf_eval("MATCH\n");
-			op1 = op->r.n;
- re_cont:
-			{
-				regex_t *re = as_regex(op1, &sreg);
-				int i = regexec(re, L.s, 0, NULL, 0);
-				if (re == &sreg)
-					regfree(re);
-				setvar_i(res, (i == 0) ^ (opn == '!'));
-			}
-			break;
-
-		case XC( OC_MOVE ):
-			debug_printf_eval("MOVE\n");
-			/* if source is a temporary string, jusk relink it to dest */
-			if (R.v == TMPVAR1
-			 && !(R.v->type & VF_NUMBER)
-				/* Why check !NUMBER? if R.v is a number but has cached R.v->string,
-				 * L.v ends up a string, which is wrong */
-			 /*&& R.v->string - always not NULL (right?) */
-			) {
-				res = setvar_p(L.v, R.v->string); /* avoids strdup */
-				R.v->string = NULL;
-			} else {
-				res = copyvar(L.v, R.v);
-			}
-			break;
-
-		case XC( OC_TERNARY ):
-			debug_printf_eval("TERNARY\n");
-			if (op->r.n->info != TI_COLON)
-				syntax_error(EMSG_POSSIBLE_ERROR);
-			res = evaluate(istrue(L.v) ? op->r.n->l.n : op->r.n->r.n, res);
-			break;
-
-		case XC( OC_FUNC ): {
-			var *argvars, *sv_fnargs;
-			const char *sv_progname;
-			int nargs, i;
-
-			debug_printf_eval("FUNC\n");
-
-			if (!op->r.f->defined)
-				syntax_error(EMSG_UNDEF_FUNC);
-
-			/* The body might be empty, still has to eval the args */
-			nargs = op->r.f->nargs;
-			argvars = nvalloc(nargs);
-			i = 0;
-			while (op1) {
-				var *arg = evaluate(nextarg(&op1), TMPVAR0);
-				if (i == nargs) {
-					/* call with more arguments than function takes.
-					 * (gawk warns: "warning: function 'f' called with more arguments than declared").
-					 * They are still evaluated, but discarded: */
-					clrvar(arg);
-					continue;
-				}
-				copyvar(&argvars[i], arg);
-				argvars[i].type |= VF_CHILD;
-				argvars[i].x.parent = arg;
-				i++;
-			}
-
-			sv_fnargs = fnargs;
-			sv_progname = g_progname;
-
-			fnargs = argvars;
-			res = evaluate(op->r.f->body.first, res);
-			nvfree(argvars, nargs);
+		if (!op->r.n)
+			R.v = intvar[F0];
 
-			g_progname = sv_progname;
-			fnargs = sv_fnargs;
-
-			break;
+		i = awk_getline(rsm, R.v);
+		if (i > 0 && !op1) {
+			incvar(intvar[FNR]);
+			incvar(intvar[NR]);
 		}
+		setvar_i(res, i);
+		break;
+	}
 
-		case XC( OC_GETLINE ):
-			debug_printf_eval("GETLINE /\n");
-		case XC( OC_PGETLINE ):
-			debug_printf_eval("PGETLINE\n");
-		{
-			rstream *rsm;
-			int i;
+	/* simple builtins */
+	case XC( OC_FBLTIN ): {
+		double R_d = R_d; /* for compiler */
+		debug_printf_eval("FBLTIN\n");
 
-			if (op1) {
-				rsm = newfile(L.s);
-				if (!rsm->F) {
-					/* NB: can't use "opinfo == TI_PGETLINE", would break "cmd" | getline */
-					if ((opinfo & OPCLSMASK) == OC_PGETLINE) {
-						rsm->F = popen(L.s, "r");
-						rsm->is_pipe = TRUE;
-					} else {
-						rsm->F = fopen_for_read(L.s);  /* not xfopen! */
-					}
-				}
-			} else {
-				if (!iF)
-					iF = next_input_file();
-				rsm = iF;
-			}
+		if (op1 && op1->info == TI_COMMA)
+			/* Simple builtins take one arg maximum */
+			syntax_error("Too many arguments");
 
-			if (!rsm || !rsm->F) {
-				setvar_i(intvar[ERRNO], errno);
-				setvar_i(res, -1);
-				break;
-			}
-
-			if (!op->r.n)
-				R.v = intvar[F0];
-
-			i = awk_getline(rsm, R.v);
-			if (i > 0 && !op1) {
-				incvar(intvar[FNR]);
-				incvar(intvar[NR]);
-			}
-			setvar_i(res, i);
+		switch (opn) {
+		case F_in:
+			R_d = (long long)L_d;
 			break;
-		}
-
-		/* simple builtins */
-		case XC( OC_FBLTIN ): {
-			double R_d = R_d; /* for compiler */
-			debug_printf_eval("FBLTIN\n");
 
-			if (op1 && op1->info == TI_COMMA)
-				/* Simple builtins take one arg maximum */
+		case F_rn: /*rand*/
+			if (op1)
 				syntax_error("Too many arguments");
-
-			switch (opn) {
-			case F_in:
-				R_d = (long long)L_d;
-				break;
-
-			case F_rn: /*rand*/
-				if (op1)
-					syntax_error("Too many arguments");
-			{
+		{
 #if RAND_MAX >= 0x7fffffff
-				uint32_t u = ((uint32_t)rand() << 16) ^ rand();
-				uint64_t v = ((uint64_t)rand() << 32) | u;
-				/* the above shift+or is optimized out on 32-bit arches */
+			uint32_t u = ((uint32_t)rand() << 16) ^ rand();
+			uint64_t v = ((uint64_t)rand() << 32) | u;
+			/* the above shift+or is optimized out on 32-bit arches */
 # if RAND_MAX > 0x7fffffff
-				v &= 0x7fffffffffffffffULL;
+			v &= 0x7fffffffffffffffULL;
 # endif
-				R_d = (double)v / 0x8000000000000000ULL;
+			R_d = (double)v / 0x8000000000000000ULL;
 #else
 # error Not implemented for this value of RAND_MAX
 #endif
+			break;
+		}
+		case F_co:
+			if (ENABLE_FEATURE_AWK_LIBM) {
+				R_d = cos(L_d);
 				break;
 			}
-			case F_co:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = cos(L_d);
-					break;
-				}
 
-			case F_ex:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = exp(L_d);
-					break;
-				}
-
-			case F_lg:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = log(L_d);
-					break;
-				}
-
-			case F_si:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = sin(L_d);
-					break;
-				}
-
-			case F_sq:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = sqrt(L_d);
-					break;
-				}
-
-				syntax_error(EMSG_NO_MATH);
-				break;
-
-			case F_sr:
-				R_d = (double)seed;
-				seed = op1 ? (unsigned)L_d : (unsigned)time(NULL);
-				srand(seed);
-				break;
-
-			case F_ti: /*systime*/
-				if (op1)
-					syntax_error("Too many arguments");
-				R_d = time(NULL);
-				break;
-
-			case F_le:
-				debug_printf_eval("length: L.s:'%s'\n", L.s);
-				if (!op1) {
-					L.s = getvar_s(intvar[F0]);
-					debug_printf_eval("length: L.s='%s'\n", L.s);
-				}
-				else if (L.v->type & VF_ARRAY) {
-					R_d = L.v->x.array->nel;
-					debug_printf_eval("length: array_len:%d\n", L.v->x.array->nel);
-					break;
-				}
-				R_d = strlen(L.s);
-				break;
-
-			case F_sy:
-				fflush_all();
-				R_d = (ENABLE_FEATURE_ALLOW_EXEC && L.s && *L.s)
-						? (system(L.s) >> 8) : 0;
+		case F_ex:
+			if (ENABLE_FEATURE_AWK_LIBM) {
+				R_d = exp(L_d);
 				break;
+			}
 
-			case F_ff:
-				if (!op1) {
-					fflush(stdout);
-				} else if (L.s && *L.s) {
-					rstream *rsm = newfile(L.s);
-					fflush(rsm->F);
-				} else {
-					fflush_all();
-				}
-				break;
-
-			case F_cl: {
-				rstream *rsm;
-				int err = 0;
-				rsm = (rstream *)hash_search(fdhash, L.s);
-				debug_printf_eval("OC_FBLTIN close: op1:%p s:'%s' rsm:%p\n", op1, L.s, rsm);
-				if (rsm) {
-					debug_printf_eval("OC_FBLTIN F_cl "
-						"rsm->is_pipe:%d, ->F:%p\n",
-						rsm->is_pipe, rsm->F);
-					/* Can be NULL if open failed. Example:
-					 * getline line <"doesnt_exist";
-					 * close("doesnt_exist"); <--- here rsm->F is NULL
-					 */
-					if (rsm->F)
-						err = rsm->is_pipe ? pclose(rsm->F) : fclose(rsm->F);
-//TODO: fix this case:
-// $ awk 'BEGIN { print close(""); print ERRNO }'
-// -1
-// close of redirection that was never opened
-// (we print 0, 0)
-					free(rsm->buffer);
-					hash_remove(fdhash, L.s);
-				}
-				if (err)
-					setvar_i(intvar[ERRNO], errno);
-				R_d = (double)err;
+		case F_lg:
+			if (ENABLE_FEATURE_AWK_LIBM) {
+				R_d = log(L_d);
 				break;
 			}
-			} /* switch */
-			setvar_i(res, R_d);
-			break;
-		}
-
-		case XC( OC_BUILTIN ):
-			debug_printf_eval("BUILTIN\n");
-			res = exec_builtin(op, res);
-			break;
-
-		case XC( OC_SPRINTF ):
-			debug_printf_eval("SPRINTF\n");
-			setvar_p(res, awk_printf(op1, NULL));
-			break;
 
-		case XC( OC_UNARY ):
-			debug_printf_eval("UNARY\n");
-		{
-			double Ld, R_d;
-
-			Ld = R_d = getvar_i(R.v);
-			switch (opn) {
-			case 'P':
-				Ld = ++R_d;
-				goto r_op_change;
-			case 'p':
-				R_d++;
-				goto r_op_change;
-			case 'M':
-				Ld = --R_d;
-				goto r_op_change;
-			case 'm':
-				R_d--;
- r_op_change:
-				setvar_i(R.v, R_d);
-				break;
-			case '!':
-				Ld = !istrue(R.v);
-				break;
-			case '-':
-				Ld = -R_d;
+		case F_si:
+			if (ENABLE_FEATURE_AWK_LIBM) {
+				R_d = sin(L_d);
 				break;
 			}
-			setvar_i(res, Ld);
-			break;
-		}
 
-		case XC( OC_FIELD ):
-			debug_printf_eval("FIELD\n");
-		{
-			int i = (int)getvar_i(R.v);
-			if (i < 0)
-				syntax_error(EMSG_NEGATIVE_FIELD);
-			if (i == 0) {
-				res = intvar[F0];
-			} else {
-				split_f0();
-				if (i > nfields)
-					fsrealloc(i);
-				res = &Fields[i - 1];
+		case F_sq:
+			if (ENABLE_FEATURE_AWK_LIBM) {
+				R_d = sqrt(L_d);
+				break;
 			}
-			break;
-		}
 
-		/* concatenation (" ") and index joining (",") */
-		case XC( OC_CONCAT ):
-			debug_printf_eval("CONCAT /\n");
-		case XC( OC_COMMA ): {
-			const char *sep = "";
-			debug_printf_eval("COMMA\n");
-			if (opinfo == TI_COMMA)
-				sep = getvar_s(intvar[SUBSEP]);
-			setvar_p(res, xasprintf("%s%s%s", L.s, sep, R.s));
+			syntax_error(EMSG_NO_MATH);
 			break;
-		}
 
-		case XC( OC_LAND ):
-			debug_printf_eval("LAND\n");
-			setvar_i(res, istrue(L.v) ? ptest(op->r.n) : 0);
+		case F_sr:
+			R_d = (double)seed;
+			seed = op1 ? (unsigned)L_d : (unsigned)time(NULL);
+			srand(seed);
 			break;
 
-		case XC( OC_LOR ):
-			debug_printf_eval("LOR\n");
-			setvar_i(res, istrue(L.v) ? 1 : ptest(op->r.n));
+		case F_ti: /*systime*/
+			if (op1)
+				syntax_error("Too many arguments");
+			R_d = time(NULL);
 			break;
 
-		case XC( OC_BINARY ):
-			debug_printf_eval("BINARY /\n");
-		case XC( OC_REPLACE ):
-			debug_printf_eval("REPLACE\n");
-		{
-			double R_d = getvar_i(R.v);
-			debug_printf_eval("R_d:%f opn:%c\n", R_d, opn);
-			switch (opn) {
-			case '+':
-				L_d += R_d;
-				break;
-			case '-':
-				L_d -= R_d;
-				break;
-			case '*':
-				L_d *= R_d;
-				break;
-			case '/':
-				if (R_d == 0)
-					syntax_error(EMSG_DIV_BY_ZERO);
-				L_d /= R_d;
-				break;
-			case '&':
-				if (ENABLE_FEATURE_AWK_LIBM)
-					L_d = pow(L_d, R_d);
-				else
-					syntax_error(EMSG_NO_MATH);
-				break;
-			case '%':
-				if (R_d == 0)
-					syntax_error(EMSG_DIV_BY_ZERO);
-				L_d -= (long long)(L_d / R_d) * R_d;
+		case F_le:
+			debug_printf_eval("length: L.s:'%s'\n", L.s);
+			if (!op1) {
+				L.s = getvar_s(intvar[F0]);
+				debug_printf_eval("length: L.s='%s'\n", L.s);
+			}
+			else if (L.v->type & VF_ARRAY) {
+				R_d = L.v->x.array->nel;
+				debug_printf_eval("length: array_len:%d\n", L.v->x.array->nel);
 				break;
 			}
-			debug_printf_eval("BINARY/REPLACE result:%f\n", L_d);
-			res = setvar_i(((opinfo & OPCLSMASK) == OC_BINARY) ? res : L.v, L_d);
+			R_d = strlen(L.s);
 			break;
-		}
 
-		case XC( OC_COMPARE ): {
-			int i = i; /* for compiler */
-			double Ld;
-			debug_printf_eval("COMPARE\n");
+		case F_sy:
+			fflush_all();
+			R_d = (ENABLE_FEATURE_ALLOW_EXEC && L.s && *L.s)
+					? (system(L.s) >> 8) : 0;
+			break;
 
-			if (is_numeric(L.v) && is_numeric(R.v)) {
-				Ld = getvar_i(L.v) - getvar_i(R.v);
+		case F_ff:
+			if (!op1) {
+				fflush(stdout);
+			} else if (L.s && *L.s) {
+				rstream *rsm = newfile(L.s);
+				fflush(rsm->F);
 			} else {
-				const char *l = getvar_s(L.v);
-				const char *r = getvar_s(R.v);
-				Ld = icase ? strcasecmp(l, r) : strcmp(l, r);
+				fflush_all();
 			}
-			switch (opn & 0xfe) {
-			case 0:
-				i = (Ld > 0);
-				break;
-			case 2:
-				i = (Ld >= 0);
-				break;
-			case 4:
-				i = (Ld == 0);
-				break;
+			break;
+
+		case F_cl: {
+			rstream *rsm;
+			int err = 0;
+			rsm = (rstream *)hash_search(fdhash, L.s);
+			debug_printf_eval("OC_FBLTIN close: op1:%p s:'%s' rsm:%p\n", op1, L.s, rsm);
+			if (rsm) {
+				debug_printf_eval("OC_FBLTIN F_cl "
+					"rsm->is_pipe:%d, ->F:%p\n",
+					rsm->is_pipe, rsm->F);
+				/* Can be NULL if open failed. Example:
+				 * getline line <"doesnt_exist";
+				 * close("doesnt_exist"); <--- here rsm->F is NULL
+				 */
+				if (rsm->F)
+					err = rsm->is_pipe ? pclose(rsm->F) : fclose(rsm->F);
+//TODO: fix this case:
+// $ awk 'BEGIN { print close(""); print ERRNO }'
+// -1
+// close of redirection that was never opened
+// (we print 0, 0)
+				free(rsm->buffer);
+				hash_remove(fdhash, L.s);
 			}
-			debug_printf_eval("COMPARE result: %d\n", (i == 0) ^ (opn & 1));
-			setvar_i(res, (i == 0) ^ (opn & 1));
+			if (err)
+				setvar_i(intvar[ERRNO], errno);
+			R_d = (double)err;
 			break;
 		}
-
-		default:
-			syntax_error(EMSG_POSSIBLE_ERROR);
 		} /* switch */
+		setvar_i(res, R_d);
+		break;
+	}
 
-		if ((opinfo & OPCLSMASK) <= SHIFT_TIL_THIS)
-			op = op->a.n;
-		if ((opinfo & OPCLSMASK) >= RECUR_FROM_THIS)
-			break;
-		if (nextrec)
-			break;
-	} /* while (op) */
+	case XC( OC_BUILTIN ):
+		debug_printf_eval("BUILTIN\n");
+		res = exec_builtin(op, res);
+		break;
+
+	case XC( OC_SPRINTF ):
+		debug_printf_eval("SPRINTF\n");
+		setvar_p(res, awk_printf(op1, NULL));
+		break;
+	} /* switch */
 
 	nvfree(tmpvars, 2);
 #undef TMPVAR0
@@ -3542,7 +4293,6 @@ static var *evaluate(node *op, var *res)
 	return res;
 #undef fnargs
 #undef seed
-#undef sreg
 }
 
 /* -------- main & co. -------- */
@@ -3554,18 +4304,15 @@ static int awk_exit(void)
 	if (!exiting) {
 		exiting = TRUE;
 		nextrec = FALSE;
-		evaluate(endseq.first, &G.exit__tmpvar);
+		execute(endseq.code, &G.exit__tmpvar);
 	}
 
 	/* waiting for children */
-	for (i = 0; i < fdhash->csize; i++) {
+	for (i = 0; i < fdhash->nitems; i++) {
 		hash_item *hi;
 		hi = fdhash->items[i];
-		while (hi) {
-			if (hi->data.rs.F && hi->data.rs.is_pipe)
-				pclose(hi->data.rs.F);
-			hi = hi->next;
-		}
+		if (hi && hi->data.rs.F && hi->data.rs.is_pipe)
+			pclose(hi->data.rs.F);
 	}
 
 	exit(G.exitcode);
@@ -3670,14 +4417,25 @@ int awk_main(int argc UNUSED_PARAM, char **argv)
 			bb_show_usage();
 		parse_program(*argv++);
 	}
+	/* Compile the program, functions are only in fnhash now */
+	compile_chain(&beginseq);
+	compile_chain(&mainseq);
+	compile_chain(&endseq);
+	for (i = 0; i < (int)fnhash->nitems; i++)
+		compile_chain(&fnhash->items[i]->data.f.body);
+
 	/* Free unused parse structures */
 	//hash_free(fnhash); // ~250 bytes when empty, used only for function names
 	//^^^^^^^^^^^^^^^^^ does not work, hash_clear() inside SEGVs
 	// (IOW: hash_clear() assumes it's a hash of variables. fnhash is not).
+	// Its arena stays: the parsed program points to the funcs in it.
+	free(fnhash->slot);
 	free(fnhash->items);
 	free(fnhash);
 	fnhash = NULL; // debug
 	//hash_free(ahash); // empty after parsing, will reuse as fdhash instead of freeing
+	if (G.full_split)
+		split_upto = INT_MAX;
 
 	/* Parsing done, on to executing */
 
@@ -3693,7 +4451,7 @@ int awk_main(int argc UNUSED_PARAM, char **argv)
 	newfile("/dev/stdout")->F = stdout;
 	newfile("/dev/stderr")->F = stderr;
 
-	evaluate(beginseq.first, &G.main__tmpvar);
+	execute(beginseq.code, &G.main__tmpvar);
 	if (!mainseq.first && !endseq.first)
 		awk_exit();
 
@@ -3710,7 +4468,7 @@ int awk_main(int argc UNUSED_PARAM, char **argv)
 			nextrec = FALSE;
 			incvar(intvar[NR]);
 			incvar(intvar[FNR]);
-			evaluate(mainseq.first, &G.main__tmpvar);
+			execute(mainseq.code, &G.main__tmpvar);
 
 			if (nextfile)
 				break;
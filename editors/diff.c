@@ -13,66 +13,29 @@
  * Licensed under GPLv2 or later, see file LICENSE in this source tree.
  */
 /*
- * The following code uses an algorithm due to Harold Stone,
- * which finds a pair of longest identical subsequences in
- * the two files.
+ * Lines are hashed so as to work in core. Identical leading and
+ * trailing lines are stripped, and lines which have no equal line
+ * in the other file are set aside: they can only be insertions or
+ * deletions. The remaining lines are compared with the algorithm from
+ * E. Myers, "An O(ND) Difference Algorithm and Its Variations" (1986),
+ * in its linear space form: a forward and a backward search meet in
+ * the middle of the shortest edit script, and both halves are solved
+ * recursively. Time is O((N+M)D), D being the size of the edit script.
+ * Unless -d is given, a search which goes on for too long settles
+ * for a good split instead of the best one, as GNU diff does.
  *
- * The major goal is to generate the match vector J.
- * J[i] is the index of the line in file1 corresponding
- * to line i in file0. J[i] = 0 if there is no
- * such line in file1.
+ * With --histogram, the histogram heuristic from git is used instead:
+ * the longest run of matching lines around the line which is least
+ * frequent in the old file becomes an anchor, and both sides of it
+ * are done recursively. It tends to produce more readable diffs of
+ * source code. Parts which have no rare enough lines go to Myers.
  *
- * Lines are hashed so as to work in core. All potential
- * matches are located by sorting the lines of each file
- * on the hash (called "value"). In particular, this
- * collects the equivalence classes in file1 together.
- * Subroutine equiv replaces the value of each line in
- * file0 by the index of the first element of its
- * matching equivalence in (the reordered) file1.
- * To save space equiv squeezes file1 into a single
- * array member in which the equivalence classes
- * are simply concatenated, except that their first
- * members are flagged by changing sign.
- *
- * Next the indices that point into member are unsorted into
- * array class according to the original order of file0.
- *
- * The cleverness lies in routine stone. This marches
- * through the lines of file0, developing a vector klist
- * of "k-candidates". At step i a k-candidate is a matched
- * pair of lines x,y (x in file0, y in file1) such that
- * there is a common subsequence of length k
- * between the first i lines of file0 and the first y
- * lines of file1, but there is no such subsequence for
- * any smaller y. x is the earliest possible mate to y
- * that occurs in such a subsequence.
- *
- * Whenever any of the members of the equivalence class of
- * lines in file1 matable to a line in file0 has serial number
- * less than the y of some k-candidate, that k-candidate
- * with the smallest such y is replaced. The new
- * k-candidate is chained (via pred) to the current
- * k-1 candidate so that the actual subsequence can
- * be recovered. When a member has serial number greater
- * that the y of all k-candidates, the klist is extended.
- * At the end, the longest subsequence is pulled out
- * and placed in the array J by unravel
- *
- * With J in hand, the matches there recorded are
- * checked against reality to assure that no spurious
- * matches have crept in due to hashing. If they have,
- * they are broken, and "jackpot" is recorded--a harmless
- * matter except that a true match for a spuriously
- * mated line may now be unnecessarily reported as a change.
- *
- * Much of the complexity of the program comes simply
- * from trying to minimize core utilization and
- * maximize the range of doable problems by dynamically
- * allocating what is needed and reusing what is not.
- * The core requirements for problems larger than somewhat
- * are (in words) 2*length(file0) + length(file1) +
- * 3*(number of k-candidates installed), typically about
- * 6n words for files of length n.
+ * The result is the match vector J: J[i] is the index of the line
+ * in file1 corresponding to line i in file0, or 0 if there is no
+ * such line. The matches are then checked against reality to assure
+ * that no spurious matches have crept in due to hashing. If they have,
+ * they are broken - a harmless matter except that a true match for
+ * a spuriously mated line may now be unnecessarily reported as a change.
  */
 //config:config DIFF
 //config:	bool "diff (13 kb)"
@@ -119,6 +82,9 @@
 //usage:     "\n	-t	Expand tabs to spaces in output"
 //usage:     "\n	-U	Output LINES lines of context"
 //usage:     "\n	-w	Ignore all whitespace"
+//usage:	IF_FEATURE_DIFF_LONG_OPTIONS(
+//usage:     "\n	--histogram	Use the histogram diff algorithm"
+//usage:	)
 
 #include "libbb.h"
 #include "common_bufsiz.h"
@@ -154,6 +120,7 @@ enum {                  /* Commandline flags */
 	FLAG_p,         /* not implemented */
 	FLAG_B,
 	FLAG_E,         /* not implemented */
+	FLAG_histogram,
 };
 #define FLAG(x) (1 << FLAG_##x)
 
@@ -265,147 +232,358 @@ static int read_token(FILE_and_pos_t *ft, token_t tok)
 	return tok;
 }
 
-struct cand {
-	int x;
-	int y;
-	int pred;
+struct line {
+	off_t offset;
+	unsigned value;
+};
+
+/* State of the search. Lines are renumbered so that only the ones
+ * which have an equal line in the other file take part; xv[]/yv[]
+ * hold their equivalence classes, xi[]/yi[] their line numbers.
+ */
+typedef struct diffseq {
+	const int *xv, *yv;
+	const int *xi, *yi;
+	int *J;
+	int *fd, *bd;   /* furthest reaching x on each diagonal, fwd and back */
+	int too_expensive;
+	int *cnt, *head, *next; /* --histogram */
+} diffseq_t;
+
+struct partition {
+	int xmid, ymid;
+	bool lo_minimal, hi_minimal;
 };
 
-static int search(const int *c, int k, int y, const struct cand *list)
+/* Skip and match identical lines at both ends of the box.
+ * Returns false if one side is exhausted.
+ */
+static bool slide(diffseq_t *s, int *xoff, int *xlim, int *yoff, int *ylim)
 {
-	int i, j;
-
-	if (list[c[k]].y < y)  /* quick look for typical case */
-		return k + 1;
-
-	for (i = 0, j = k + 1;;) {
-		const int l = (i + j) >> 1;
-		if (l > i) {
-			const int t = list[c[l]].y;
-			if (t > y)
-				j = l;
-			else if (t < y)
-				i = l;
-			else
-				return l;
-		} else
-			return l + 1;
+	int x = *xoff, y = *yoff, xe = *xlim, ye = *ylim;
+
+	while (x < xe && y < ye && s->xv[x] == s->yv[y]) {
+		s->J[s->xi[x]] = s->yi[y];
+		x++;
+		y++;
+	}
+	while (xe > x && ye > y && s->xv[xe - 1] == s->yv[ye - 1]) {
+		xe--;
+		ye--;
+		s->J[s->xi[xe]] = s->yi[ye];
 	}
+	*xoff = x;
+	*yoff = y;
+	*xlim = xe;
+	*ylim = ye;
+	return x < xe && y < ye;
 }
 
-static void stone(const int *a, int n, const int *b, int *J, int pref)
+/* Find the midpoint of the shortest edit script for the box
+ * by running Myers' O(ND) search from both corners at once
+ * ("An O(ND) Difference Algorithm and Its Variations", 1986).
+ * The search uses O(N) space; unless find_minimal is set,
+ * it gives up after too_expensive steps and splits at the
+ * diagonal which got furthest.
+ */
+static void diag(diffseq_t *s, int xoff, int xlim, int yoff, int ylim,
+		bool find_minimal, struct partition *part)
 {
-	const unsigned isq = isqrt(n);
-	const unsigned bound =
-		(option_mask32 & FLAG(d)) ? UINT_MAX : MAX(256, isq);
-	int clen = 1;
-	int clistlen = 100;
-	int k = 0;
-	struct cand *clist = xzalloc(clistlen * sizeof(clist[0]));
-	struct cand cand;
-	struct cand *q;
-	int *klist = xzalloc((n + 2) * sizeof(klist[0]));
-	/*clist[0] = (struct cand){0}; - xzalloc did it */
-	/*klist[0] = 0; */
-
-	for (cand.x = 1; cand.x <= n; cand.x++) {
-		int j = a[cand.x], oldl = 0;
-		unsigned numtries = 0;
-		if (j == 0)
+	int *const fd = s->fd;
+	int *const bd = s->bd;
+	const int *const xv = s->xv;
+	const int *const yv = s->yv;
+	const int dmin = xoff - ylim;
+	const int dmax = xlim - yoff;
+	const int fmid = xoff - yoff;
+	const int bmid = xlim - ylim;
+	const bool odd = (fmid - bmid) & 1;
+	int fmin = fmid, fmax = fmid;
+	int bmin = bmid, bmax = bmid;
+	int c;
+
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+
+	for (c = 1;; c++) {
+		int d;
+
+		/* Extend the forward search by one edit */
+		if (fmin > dmin)
+			fd[--fmin - 1] = -1;
+		else
+			fmin++;
+		if (fmax < dmax)
+			fd[++fmax + 1] = -1;
+		else
+			fmax--;
+		for (d = fmax; d >= fmin; d -= 2) {
+			int x, y, tlo = fd[d - 1], thi = fd[d + 1];
+
+			x = tlo >= thi ? tlo + 1 : thi;
+			y = x - d;
+			while (x < xlim && y < ylim && xv[x] == yv[y]) {
+				x++;
+				y++;
+			}
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+				part->xmid = x;
+				part->ymid = y;
+				part->lo_minimal = part->hi_minimal = true;
+				return;
+			}
+		}
+
+		/* Same backwards */
+		if (bmin > dmin)
+			bd[--bmin - 1] = INT_MAX;
+		else
+			bmin++;
+		if (bmax < dmax)
+			bd[++bmax + 1] = INT_MAX;
+		else
+			bmax--;
+		for (d = bmax; d >= bmin; d -= 2) {
+			int x, y, tlo = bd[d - 1], thi = bd[d + 1];
+
+			x = tlo < thi ? tlo : thi - 1;
+			y = x - d;
+			while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1]) {
+				x--;
+				y--;
+			}
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+				part->xmid = x;
+				part->ymid = y;
+				part->lo_minimal = part->hi_minimal = true;
+				return;
+			}
+		}
+
+		if (find_minimal || c < s->too_expensive)
 			continue;
-		cand.y = -b[j];
-		cand.pred = klist[0];
-		do {
-			int l, tc;
-			if (cand.y <= clist[cand.pred].y)
-				continue;
-			l = search(klist, k, cand.y, clist);
-			if (l != oldl + 1)
-				cand.pred = klist[l - 1];
-			if (l <= k && clist[klist[l]].y <= cand.y)
-				continue;
-			if (clen == clistlen) {
-				clistlen = clistlen * 11 / 10;
-				clist = xrealloc(clist, clistlen * sizeof(clist[0]));
+
+		/* Too expensive: take the point furthest from either corner */
+		{
+			int fxybest = -1, fxbest = 0;
+			int bxybest = INT_MAX, bxbest = 0;
+
+			for (d = fmax; d >= fmin; d -= 2) {
+				int x = MIN(fd[d], xlim);
+				int y = x - d;
+				if (ylim < y) {
+					x = ylim + d;
+					y = ylim;
+				}
+				if (fxybest < x + y) {
+					fxybest = x + y;
+					fxbest = x;
+				}
+			}
+			for (d = bmax; d >= bmin; d -= 2) {
+				int x = MAX(xoff, bd[d]);
+				int y = x - d;
+				if (y < yoff) {
+					x = yoff + d;
+					y = yoff;
+				}
+				if (x + y < bxybest) {
+					bxybest = x + y;
+					bxbest = x;
+				}
 			}
-			clist[clen] = cand;
-			tc = klist[l];
-			klist[l] = clen++;
-			if (l <= k) {
-				cand.pred = tc;
-				oldl = l;
-				numtries++;
+			if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+				part->xmid = fxbest;
+				part->ymid = fxybest - fxbest;
+				part->lo_minimal = true;
+				part->hi_minimal = false;
 			} else {
-				k++;
-				break;
+				part->xmid = bxbest;
+				part->ymid = bxybest - bxbest;
+				part->lo_minimal = false;
+				part->hi_minimal = true;
 			}
-		} while ((cand.y = b[++j]) > 0 && numtries < bound);
+			return;
+		}
 	}
-	/* Unravel */
-	for (q = clist + klist[k]; q->y; q = clist + q->pred)
-		J[q->x + pref] = q->y + pref;
-	free(klist);
-	free(clist);
 }
 
-struct line {
-	/* 'serial' is not used in the beginning, so we reuse it
-	 * to store line offsets, thus reducing memory pressure
-	 */
-	union {
-		unsigned serial;
-		off_t offset;
-	};
-	unsigned value;
-};
-
-static void equiv(struct line *a, int n, struct line *b, int m, int *c)
+/* Divide and conquer: find the middle snake, then do both halves.
+ * Recursing into the smaller half only keeps the stack shallow.
+ */
+static void compareseq(diffseq_t *s, int xoff, int xlim, int yoff, int ylim,
+		bool find_minimal)
 {
-	int i = 1, j = 1;
-
-	while (i <= n && j <= m) {
-		if (a[i].value < b[j].value)
-			a[i++].value = 0;
-		else if (a[i].value == b[j].value)
-			a[i++].value = j;
-		else
-			j++;
-	}
-	while (i <= n)
-		a[i++].value = 0;
-	b[m + 1].value = 0;
-	j = 0;
-	while (++j <= m) {
-		c[j] = -b[j].serial;
-		while (b[j + 1].value == b[j].value) {
-			j++;
-			c[j] = b[j].serial;
+	while (slide(s, &xoff, &xlim, &yoff, &ylim)) {
+		struct partition part;
+
+		diag(s, xoff, xlim, yoff, ylim, find_minimal, &part);
+		if ((part.xmid - xoff) + (part.ymid - yoff) < (xlim - part.xmid) + (ylim - part.ymid)) {
+			compareseq(s, xoff, part.xmid, yoff, part.ymid, part.lo_minimal);
+			xoff = part.xmid;
+			yoff = part.ymid;
+			find_minimal = part.hi_minimal;
+		} else {
+			compareseq(s, part.xmid, xlim, part.ymid, ylim, part.hi_minimal);
+			xlim = part.xmid;
+			ylim = part.ymid;
+			find_minimal = part.lo_minimal;
 		}
 	}
-	c[j] = -1;
 }
 
-static void unsort(const struct line *f, int l, int *b)
+/* Histogram diff, as in git: anchor on the longest run of matching lines
+ * around the line which is rarest in the old file, then do both sides.
+ * Boxes without a rare enough common line are left to Myers.
+ */
+#define HISTOGRAM_MAX_CHAIN 64
+static void histogram(diffseq_t *s, int xoff, int xlim, int yoff, int ylim)
 {
-	int i;
-	int *a = xmalloc((l + 1) * sizeof(a[0]));
-	for (i = 1; i <= l; i++)
-		a[f[i].serial] = f[i].value;
-	for (i = 1; i <= l; i++)
-		b[i] = a[i];
-	free(a);
+	const int *const xv = s->xv;
+	const int *const yv = s->yv;
+	int *const cnt = s->cnt;
+	int *const head = s->head;
+	int *const next = s->next;
+
+	while (slide(s, &xoff, &xlim, &yoff, &ylim)) {
+		int x, y, best_cnt, best_len;
+		int as = as, ae = ae, bs = bs, be = be;
+
+		for (y = yoff; y < ylim; y++)
+			cnt[yv[y]] = 0;
+		for (x = xoff; x < xlim; x++)
+			cnt[xv[x]] = 0;
+		for (x = xlim - 1; x >= xoff; x--) {
+			int c = xv[x];
+			next[x] = cnt[c] ? head[c] : -1;
+			head[c] = x;
+			cnt[c]++;
+		}
+
+		best_cnt = HISTOGRAM_MAX_CHAIN;
+		best_len = 0;
+		for (y = yoff; y < ylim;) {
+			int c = yv[y], ynext = y + 1;
+
+			if (cnt[c] != 0 && cnt[c] <= best_cnt) {
+				for (x = head[c]; x >= 0; x = next[x]) {
+					int xs = x, ys = y, xe = x + 1, ye = y + 1;
+
+					while (xs > xoff && ys > yoff && xv[xs - 1] == yv[ys - 1]) {
+						xs--;
+						ys--;
+					}
+					while (xe < xlim && ye < ylim && xv[xe] == yv[ye]) {
+						xe++;
+						ye++;
+					}
+					if (ynext < ye)
+						ynext = ye;
+					if (cnt[c] < best_cnt || xe - xs > best_len) {
+						best_cnt = cnt[c];
+						best_len = xe - xs;
+						as = xs;
+						ae = xe;
+						bs = ys;
+						be = ye;
+					}
+				}
+			}
+			y = ynext;
+		}
+
+		if (best_len == 0) {
+			compareseq(s, xoff, xlim, yoff, ylim, option_mask32 & FLAG(d));
+			return;
+		}
+		for (x = as, y = bs; x < ae; x++, y++)
+			s->J[s->xi[x]] = s->yi[y];
+		if ((as - xoff) + (bs - yoff) < (xlim - ae) + (ylim - be)) {
+			histogram(s, xoff, as, yoff, bs);
+			xoff = ae;
+			yoff = be;
+		} else {
+			histogram(s, ae, xlim, be, ylim);
+			xlim = as;
+			ylim = bs;
+		}
+	}
 }
 
-static int line_compar(const void *a, const void *b)
+/* Match lines 1..n of a[] against lines 1..m of b[] and record
+ * the matches in J. Line numbers are offset by pref.
+ */
+static void find_matches(const struct line *a, int n, const struct line *b, int m,
+		int *J, int pref)
 {
-#define l0 ((const struct line*)a)
-#define l1 ((const struct line*)b)
-	int r = l0->value - l1->value;
-	if (r)
-		return r;
-	return l0->serial - l1->serial;
-#undef l0
-#undef l1
+	diffseq_t s;
+	unsigned *key;
+	unsigned char *seen;
+	int *xv, *yv, *xi, *yi, *fd;
+	unsigned size, shift;
+	int i, nx, ny;
+
+	/* Give equal lines equal small numbers, noting which file has them */
+	shift = 32 - 4;
+	while ((1U << (32 - shift)) < 2U * (n + m))
+		shift--;
+	size = 1U << (32 - shift);
+	key = xmalloc(size * sizeof(key[0]));
+	seen = xzalloc(size);
+	xv = xmalloc((n + m) * 2 * sizeof(xv[0]));
+	yv = xv + n;
+	xi = yv + m;
+	yi = xi + n;
+	for (i = 0; i < n + m; i++) {
+		unsigned v = (i < n) ? a[i + 1].value : b[i - n + 1].value;
+		unsigned h = (v * 0x9e3779b1) >> shift;
+		while (seen[h] && key[h] != v)
+			h = (h + 1) & (size - 1);
+		key[h] = v;
+		seen[h] |= (i < n) ? 1 : 2;
+		xv[i] = h;
+	}
+	/* Lines without a mate in the other file can't be matched,
+	 * drop them. This makes wholly different regions cheap */
+	for (i = nx = 0; i < n; i++) {
+		if (seen[xv[i]] == 3) {
+			xv[nx] = xv[i];
+			xi[nx++] = pref + i + 1;
+		}
+	}
+	for (i = ny = 0; i < m; i++) {
+		if (seen[yv[i]] == 3) {
+			yv[ny] = yv[i];
+			yi[ny++] = pref + i + 1;
+		}
+	}
+	free(key);
+	free(seen);
+
+	s.xv = xv;
+	s.yv = yv;
+	s.xi = xi;
+	s.yi = yi;
+	s.J = J;
+	/* Diagonals run from -ny-1 to nx+1 */
+	fd = xmalloc((nx + ny + 3) * 2 * sizeof(fd[0]));
+	s.fd = fd + ny + 1;
+	s.bd = s.fd + nx + ny + 3;
+	s.too_expensive = (option_mask32 & FLAG(d)) ? INT_MAX : MAX(256, isqrt(nx + ny));
+
+	if (ENABLE_FEATURE_DIFF_LONG_OPTIONS && (option_mask32 & FLAG(histogram))) {
+		s.cnt = xmalloc((size * 2 + nx) * sizeof(s.cnt[0]));
+		s.head = s.cnt + size;
+		s.next = s.head + size;
+		histogram(&s, 0, nx, 0, ny);
+		free(s.cnt);
+	} else {
+		compareseq(&s, 0, nx, 0, ny, option_mask32 & FLAG(d));
+	}
+	free(fd);
+	free(xv);
 }
 
 static void fetch(FILE_and_pos_t *ft, const off_t *ix, int a, int b, int ch)
@@ -449,8 +627,8 @@ static void fetch(FILE_and_pos_t *ft, const off_t *ix, int a, int b, int ch)
  */
 static NOINLINE int *create_J(FILE_and_pos_t ft[2], int nlen[2], off_t *ix[2])
 {
-	int *J, slen[2], *class, *member;
-	struct line *nfile[2], *sfile[2];
+	int *J;
+	struct line *nfile[2];
 	int pref = 0, suff = 0, i, j, delta;
 
 	/* Lines of both files are hashed, and in the process
@@ -485,8 +663,7 @@ static NOINLINE int *create_J(FILE_and_pos_t ft[2], int nlen[2], off_t *ix[2])
 				sz = sz * 3 / 2;
 				nfile[i] = xrealloc(nfile[i], (sz + 3) * sizeof(nfile[i][0]));
 			}
-			/* line_compar needs hashes fit into positive int */
-			nfile[i][nlen[i]].value = hash & INT_MAX;
+			nfile[i][nlen[i]].value = hash;
 			/* like ftello(ft[i].ft_fp) but faster (avoids lseek syscall) */
 			nfile[i][nlen[i]].offset = ft[i].ft_pos;
 			if (tok & TOK_EOF) {
@@ -513,56 +690,22 @@ start:
 	for (; suff < nlen[0] - pref && suff < nlen[1] - pref &&
 	       nfile[0][nlen[0] - suff].value == nfile[1][nlen[1] - suff].value;
 	       suff++);
-	/* Arrays are pruned by the suffix and prefix length,
-	 * the result being sorted and stored in sfile[fileno],
-	 * and their sizes are stored in slen[fileno]
-	 */
-	for (j = 0; j < 2; j++) {
-		sfile[j] = nfile[j] + pref;
-		slen[j] = nlen[j] - pref - suff;
-		for (i = 0; i <= slen[j]; i++)
-			sfile[j][i].serial = i;
-		qsort(sfile[j] + 1, slen[j], sizeof(*sfile[j]), line_compar);
-	}
-	/* nfile arrays are reused to reduce memory pressure
-	 * The #if zeroed out section performs the same task as the
-	 * one in the #else section.
-	 * Peak memory usage is higher, but one array copy is avoided
-	 * by not using unsort()
-	 */
-#if 0
-	member = xmalloc((slen[1] + 2) * sizeof(member[0]));
-	equiv(sfile[0], slen[0], sfile[1], slen[1], member);
-	free(nfile[1]);
-
-	class = xmalloc((slen[0] + 1) * sizeof(class[0]));
-	for (i = 1; i <= slen[0]; i++) /* Unsorting */
-		class[sfile[0][i].serial] = sfile[0][i].value;
-	free(nfile[0]);
-#else
-	member = (int *)nfile[1];
-	equiv(sfile[0], slen[0], sfile[1], slen[1], member);
-	member = xrealloc(member, (slen[1] + 2) * sizeof(member[0]));
-
-	class = (int *)nfile[0];
-	unsort(sfile[0], slen[0], (int *)nfile[0]);
-	class = xrealloc(class, (slen[0] + 2) * sizeof(class[0]));
-#endif
 	J = xmalloc((nlen[0] + 2) * sizeof(J[0]));
 	/* The elements of J which fall inside the prefix and suffix regions
 	 * are marked as unchanged, while the ones which fall outside
-	 * are initialized with 0 (no matches), so that function stone can
+	 * are initialized with 0 (no matches), so that find_matches can
 	 * then assign them their right values
 	 */
 	for (i = 0, delta = nlen[1] - nlen[0]; i <= nlen[0]; i++)
 		J[i] = i <= pref            ?  i :
 		       i > (nlen[0] - suff) ? (i + delta) : 0;
 	/* Here the magic is performed */
-	stone(class, slen[0], member, J, pref);
+	find_matches(nfile[0] + pref, nlen[0] - pref - suff,
+			nfile[1] + pref, nlen[1] - pref - suff, J, pref);
 	J[nlen[0] + 1] = nlen[1] + 1;
 
-	free(class);
-	free(member);
+	free(nfile[0]);
+	free(nfile[1]);
 
 	/* Both files are rescanned, in an effort to find any lines
 	 * which, due to limitations intrinsic to any hashing algorithm,
@@ -964,6 +1107,7 @@ static const char diff_longopts[] ALIGN1 =
 	"report-identical-files\0"   No_argument       "s"
 	"starting-file\0"            Required_argument "S"
 	"minimal\0"                  No_argument       "d"
+	"histogram\0"                No_argument       "\xff"
 	;
 # define GETOPT32 getopt32long
 # define LONGOPTS ,diff_longopts
@@ -982,7 +1126,7 @@ int diff_main(int argc UNUSED_PARAM, char **argv)
 	INIT_G();
 
 	/* exactly 2 params; collect multiple -L <label>; -U N */
-	GETOPT32(argv, "^" "abdiL:*NqrsS:tTU:+wupBE" "\0" "=2"
+	GETOPT32(argv, "^" "abdiL:*NqrsS:tTU:+wupBE\xff" "\0" "=2"
 			LONGOPTS,
 			&L_arg, &s_start, &opt_U_context);
 	argv += optind;
@@ -135,6 +135,17 @@
 //config:	cursor position using "ESC [ 6 n" escape sequence, then read stdin.
 //config:	This is not clean but helps a lot on serial lines and such.
 //config:
+//config:config FEATURE_VI_MMAP
+//config:	bool "Map large files instead of reading them"
+//config:	default y
+//config:	depends on VI
+//config:	help
+//config:	Files of 1 MB and more are mmap()ed privately instead of being
+//config:	read into memory: they are read from disk as they are looked at,
+//config:	and only the parts you change take up memory of their own.
+//config:	If another program changes the file meanwhile, ":w" refuses
+//config:	to save it (":w!" overrides).
+//config:
 //config:config FEATURE_VI_UNDO
 //config:	bool "Support undo command \"u\""
 //config:	default y
@@ -295,6 +306,18 @@ struct globals {
 	char *text, *end;       // pointers to the user data in memory
 	char *dot;              // where all the action takes place
 	int text_size;		// size of the allocated buffer
+	int text_head;		// free bytes in front of text[]
+	int text_tail;		// bytes of text parked past the gap, see text_gap_open()
+	int text_tail_lines;	// and how many lines they have
+#if ENABLE_FEATURE_VI_MMAP
+	smallint text_mapped;	// text[] is a private mapping of a file
+	char *text_map_start;	// where the file data was mapped
+	int text_map_fd;	// and which file it is
+	dev_t text_map_dev;
+	ino_t text_map_ino;
+	off_t text_map_fsize;	// its size and mtime then, see text_map_changed()
+	struct timespec text_map_mtime;
+#endif
 
 	// the rest
 #if ENABLE_FEATURE_VI_SETOPTS
@@ -392,6 +415,10 @@ struct globals {
 #endif
 	int refresh__old_offset;
 	int format_edit_status__tot;
+	// for line_number(): where some lines start (text[] offset)
+	// and their line numbers, a line every 64k or so
+	struct line_index { int ofs, lineno; } *line_index;
+	int line_index_cnt;
 
 	// a few references only
 #if ENABLE_FEATURE_VI_YANKMARK
@@ -467,6 +494,16 @@ struct globals {
 #define G (*ptr_to_globals)
 #define text           (G.text          )
 #define text_size      (G.text_size     )
+#define text_head      (G.text_head     )
+#define text_tail      (G.text_tail     )
+#define text_tail_lines (G.text_tail_lines)
+#define text_mapped    (G.text_mapped   )
+#define text_map_start (G.text_map_start)
+#define text_map_fd    (G.text_map_fd   )
+#define text_map_dev   (G.text_map_dev  )
+#define text_map_ino   (G.text_map_ino  )
+#define text_map_fsize (G.text_map_fsize)
+#define text_map_mtime (G.text_map_mtime)
 #define end            (G.end           )
 #define dot            (G.dot           )
 #define reg            (G.reg           )
@@ -516,6 +553,8 @@ struct globals {
 #define edit_file__cur_line     (G.edit_file__cur_line)
 #define refresh__old_offset     (G.refresh__old_offset)
 #define format_edit_status__tot (G.format_edit_status__tot)
+#define line_index              (G.line_index         )
+#define line_index_cnt          (G.line_index_cnt     )
 
 #define YDreg          (G.YDreg         )
 //#define Ureg           (G.Ureg          )
@@ -771,11 +810,65 @@ static int count_lines(char *start, char *stop)
 	return cnt;
 }
 
+// count_lines(text, p), but remembers where lines start on the way,
+// so that next time it does not have to count from the top
+static int line_number(char *p)
+{
+	enum { STEP = 64 * 1024 };
+	char *q, *r;
+	int lo, hi, n;
+
+	if (line_index_cnt == 0) {
+		line_index = xrealloc_vector(line_index, 6, 0);
+		line_index[0].ofs = line_index[0].lineno = 0;
+		line_index_cnt = 1;
+	}
+	lo = 0;
+	hi = line_index_cnt;
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if (text + line_index[mid].ofs <= p)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	q = text + line_index[lo].ofs;
+	n = line_index[lo].lineno;
+	while (lo == line_index_cnt - 1 && p - q > STEP) {
+		r = memchr(q + STEP, '\n', p - (q + STEP));
+		if (!r)
+			break;
+		n += count_lines(q, r);
+		q = r + 1;
+		line_index = xrealloc_vector(line_index, 6, line_index_cnt);
+		line_index[line_index_cnt].ofs = q - text;
+		line_index[line_index_cnt].lineno = n;
+		lo = line_index_cnt++;
+	}
+	return n + count_lines(q, p);
+}
+
+// text[] is changed at p: lines after it may start elsewhere now
+static void line_index_trim(char *p)
+{
+	while (line_index_cnt > 1 && text + line_index[line_index_cnt - 1].ofs > p)
+		line_index_cnt--;
+}
+
 static char *find_line(int li)	// find beginning of line #li
 {
-	char *q;
+	char *q = text;
+	int i;
 
-	for (q = text; li > 1; li--) {
+	// start from the last line_number() knows of before it
+	for (i = line_index_cnt; --i > 0;) {
+		if (line_index[i].lineno < li) {
+			q = text + line_index[i].ofs;
+			li -= line_index[i].lineno;
+			break;
+		}
+	}
+	for (; li > 1; li--) {
 		q = next_line(q);
 	}
 	return q;
@@ -1265,16 +1358,22 @@ static int format_edit_status(void)
 	// (this will cause a mis-reporting of modified status
 	// once every MAXINT editing operations.)
 
-	// it would be nice to do a similar optimization here -- if
-	// we haven't done a motion that could have changed which line
-	// we're on, then we shouldn't have to do this count_lines()
-	cur = count_lines(text, dot);
+	cur = line_number(dot);
 
-	// count_lines() is expensive.
+	// line_number() is expensive after a change far above the end.
 	// Call it only if something was changed since last time
 	// we were here:
-	if (modified_count != last_modified_count) {
-		tot = cur + count_lines(dot, end - 1) - 1;
+	if (modified_count != last_modified_count || tot < 0) {
+#if ENABLE_FEATURE_VI_MMAP
+		// counting the lines of a mapped file would read all of it:
+		// not until the user went near its end
+		if (text_mapped && end - (text + line_index[line_index_cnt - 1].ofs) > 1024 * 1024)
+			tot = -1;
+		else
+#endif
+		tot = line_number(end - 1);
+		if (text_tail && tot >= 0)
+			tot += text_tail_lines;
 		last_modified_count = modified_count;
 	}
 
@@ -1283,6 +1382,9 @@ static int format_edit_status(void)
 	//    total lines            100
 	if (tot > 0) {
 		percent = (100 * cur) / tot;
+	} else if (tot < 0) {
+		// unknown, go by bytes
+		percent = (100 * (long long)(dot - text)) / (end - text);
 	} else {
 		cur = tot = 0;
 		percent = 100;
@@ -1293,9 +1395,9 @@ static int format_edit_status(void)
 
 	ret = snprintf(status_buffer, trunc_at+1,
 #if ENABLE_FEATURE_VI_READONLY
-		"%c %s%s%s %d/%d %d%%",
+		"%c %s%s%s %d/%s %d%%",
 #else
-		"%c %s%s %d/%d %d%%",
+		"%c %s%s %d/%s %d%%",
 #endif
 		cmd_mode_indicator[cmd_mode & 3],
 		(current_filename != NULL ? current_filename : "No file"),
@@ -1303,7 +1405,7 @@ static int format_edit_status(void)
 		(readonly_mode ? " [Readonly]" : ""),
 #endif
 		(modified_count ? " [Modified]" : ""),
-		cur, tot, percent);
+		cur, (tot < 0 ? "?" : utoa(tot)), percent);
 
 	if (ret >= 0 && ret < trunc_at)
 		return ret;  // it all fit
@@ -1490,42 +1592,253 @@ static void yank_status(const char *op, const char *p, int cnt)
 static void undo_push(char *, unsigned, int);
 #endif
 
+// text[] moved from "old" to "new": make all global pointers into it
+// follow. Call it while "old" is still allocated
+static void text_move(char *old, char *new)
+{
+	text        = new + (text - old);
+	screenbegin = new + (screenbegin - old);
+	dot         = new + (dot - old);
+	end         = new + (end - old);
+	if (rstart)
+		rstart = new + (rstart - old);
+#if ENABLE_FEATURE_VI_UNDO_QUEUE
+	if (undo_queue_spos)
+		undo_queue_spos = new + (undo_queue_spos - old);
+#endif
+#if ENABLE_FEATURE_VI_YANKMARK
+	{
+		int i;
+		for (i = 0; i < ARRAY_SIZE(mark); i++)
+			if (mark[i])
+				mark[i] = new + (mark[i] - old);
+	}
+	if (edit_file__cur_line)
+		edit_file__cur_line = new + (edit_file__cur_line - old);
+#endif
+}
+
+// free the memory text[] was in: "base" is what text - text_head was,
+// "size" what text_size was
+static void text_free(char *base, int size)
+{
+#if ENABLE_FEATURE_VI_MMAP
+	if (text_mapped) {
+		munmap(base, size);
+		close(text_map_fd);
+		text_mapped = 0;
+		return;
+	}
+#else
+	(void)size;
+#endif
+	free(base);
+}
+
+#if ENABLE_FEATURE_VI_MMAP
+// map "size" bytes of file "fd" privately, with free space around them
+static char *text_map(int fd, int size, int *slack)
+{
+	int pagesize = getpagesize();
+	char *base, *p;
+
+	*slack = ((size / 16 + 10240) | (pagesize - 1)) + 1;
+	if (size > (INT_MAX - 2 * *slack))
+		return NULL;
+	base = mmap(NULL, size + 2 * *slack, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	p = mmap(base + *slack, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED) {
+		munmap(base, size + 2 * *slack);
+		return NULL;
+	}
+	return p;
+}
+
+// Touching a page of the mapping past the end of the file raises
+// SIGBUS. If the file was truncated under us, read zeroes there
+// instead of dying: text_map_changed() will stop ":w" anyway
+static void bus_handler(int sig, siginfo_t *si, void *ucontext UNUSED_PARAM)
+{
+	int pagesize = getpagesize();
+	char *page = (char *)((uintptr_t)si->si_addr & ~(uintptr_t)(pagesize - 1));
+
+	if (text_mapped
+	 && page >= text_map_start
+	 && page < text_map_start + text_map_fsize
+	 && mmap(page, pagesize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED
+	) {
+		return;
+	}
+	signal(sig, SIG_DFL);
+}
+
+// replace text[] with a mapping from text_map() of file "fd"
+// (which text[] keeps open from now on)
+static void text_use_map(char *p, int size, int slack, int fd, const struct stat *st)
+{
+	char *old_base = text - text_head;
+	int old_size = text_size;
+	struct sigaction sa;
+
+	text_move(text, p);
+	text_free(old_base, old_size);
+	text_mapped = 1;
+	text_head = slack;
+	text_size = size + 2 * slack;
+	text_map_start = p;
+	text_map_fd = fd;
+	close_on_exec_on(fd);
+	text_map_dev = st->st_dev;
+	text_map_ino = st->st_ino;
+	text_map_fsize = st->st_size;
+	text_map_mtime = st->st_mtim;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = bus_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigaction_set(SIGBUS, &sa);
+}
+
+// Has another program changed the file text[] is mapped from?
+// The text we did not edit would have changed with it
+static int text_map_changed(void)
+{
+	struct stat st;
+
+	if (!text_mapped)
+		return 0;
+	if (fstat(text_map_fd, &st) == 0
+	 && st.st_size == text_map_fsize
+	 && st.st_mtim.tv_sec == text_map_mtime.tv_sec
+	 && st.st_mtim.tv_nsec == text_map_mtime.tv_nsec
+	) {
+		return 0;
+	}
+	return 1;
+}
+
+// copy text[] to the heap, so that its file can be changed under it
+static void text_unmap(void)
+{
+	char *old_base = text - text_head;
+	char *new_text;
+
+	new_text = xmalloc(text_size);
+	new_text += text_head;
+	memcpy(new_text, text, end - text);
+	text_move(text, new_text);
+	text_free(old_base, text_size);
+}
+#else
+# define text_map_changed() 0
+#endif
+
+// Typing in the middle of a big file would move everything after
+// the cursor for every character. Instead, while in insert mode,
+// the text more than a screenful below the cursor is parked at the
+// top of text[]'s memory: the free space between "end" and there
+// is a gap, and typing moves only the text between the cursor and
+// the gap. To the rest of vi, text[] just ends a bit below the
+// screen, so do_cmd() closes the gap before any other command.
+static void text_gap_close(void)
+{
+	if (text_tail) {
+		memmove(end, text - text_head + text_size - text_tail, text_tail);
+		end += text_tail;
+		text_tail = 0;
+	}
+}
+
+// called for every character typed in insert/replace mode
+static void text_gap_open(void)
+{
+	enum { GAP_MIN = 64 * 1024 };
+	char *p, *q;
+	int i;
+
+	if (text_tail) {
+		// is there still a screenful of lines before the gap?
+		p = dot;
+		for (i = 0; i < rows && p < end - 1; i++)
+			p = next_line(p);
+		if (p < end - 1)
+			return;
+		text_gap_close();
+	}
+	p = dot;
+	for (i = 0; i < 2 * rows; i++)
+		p = next_line(p);
+	// Near the top of the file, text_hole_make() sliding the text
+	// before the cursor down costs less than moving the rest
+	// of the file there and back
+	if (end - p < GAP_MIN || dot - text < (end - p) / 8)
+		return;
+	text_tail = end - p;
+	q = text - text_head + text_size - text_tail;
+	memmove(q, p, text_tail);
+	text_tail_lines = 0;
+	while ((q = memchr(q, '\n', text - text_head + text_size - q)) != NULL) {
+		text_tail_lines++;
+		q++;
+	}
+	end = p;
+}
+
 // open a hole in text[]
-// might reallocate text[]! use p += text_hole_make(p, ...),
+// might move text[]! use p = text_hole_make(p, ...),
 // and be careful to not use pointers into potentially freed text[]!
-static uintptr_t text_hole_make(char *p, int size)	// at "p", make a 'size' byte hole
+static char *text_hole_make(char *p, int size)	// at "p", make a 'size' byte hole
 {
-	uintptr_t bias = 0;
+	char *old_text = text;
 
 	if (size <= 0)
-		return bias;
-	end += size;		// adjust the new END
-	if (end >= (text + text_size)) {
+		return p;
+	line_index_trim(p);
+	if (size <= text_head && p - text < end - p) {
+		// cheaper to slide the text before "p" down into the free
+		// space in front of text[]. Looks like text[] moved by -size
+		text_head -= size;
+		text_move(old_text, old_text - size);
+		memmove(text, old_text, p - old_text);
+		p -= size;
+		end += size;
+	} else if (end + size >= text + text_size - text_head - text_tail) {
+		// grow geometrically, leaving free space on both sides
+		char *old_base = text - text_head;
+		int old_size = text_size;
+		int len, slack;
 		char *new_text;
-		text_size += end - (text + text_size) + 10240;
-		new_text = xrealloc(text, text_size);
-		bias = (new_text - text);
-		screenbegin += bias;
-		dot         += bias;
-		end         += bias;
-		p           += bias;
-#if ENABLE_FEATURE_VI_YANKMARK
-		{
-			int i;
-			for (i = 0; i < ARRAY_SIZE(mark); i++)
-				if (mark[i])
-					mark[i] += bias;
-		}
-#endif
-		text = new_text;
+
+		text_gap_close();
+		len = end - text;
+		slack = (len + size) / 16 + 10240;
+		text_size = len + size + 2 * slack;
+		new_text = xmalloc(text_size);
+		new_text += slack;
+		memcpy(new_text, text, p - text);
+		memcpy(new_text + (p - text) + size, p, end - p);
+		p = new_text + (p - text);
+		text_head = slack;
+		text_move(text, new_text);
+		text_free(old_base, old_size);
+		end += size;
+	} else {
+		end += size;	// adjust the new END
+		memmove(p + size, p, end - size - p);
 	}
-	memmove(p + size, p, end - size - p);
 	memset(p, ' ', size);	// clear new hole
-	return bias;
+	return p;
 }
 
 // close a hole in text[] - delete "p" through "q", inclusive
 // "undo" value indicates if this operation should be undo-able
+// might move text[]! use the returned pointer,
+// and be careful to not use other pointers into text[]!
 #if !ENABLE_FEATURE_VI_UNDO
 #define text_hole_delete(a,b,c) text_hole_delete(a,b)
 #endif
@@ -1544,6 +1857,7 @@ static char *text_hole_delete(char *p, char *q, int undo)
 	}
 	hole_size = q - p + 1;
 	cnt = end - src;
+	line_index_trim(dest);
 #if ENABLE_FEATURE_VI_UNDO
 	switch (undo) {
 		case NO_UNDO:
@@ -1567,6 +1881,16 @@ static char *text_hole_delete(char *p, char *q, int undo)
 	if (dest < text || dest >= end)
 		goto thd0;
 	modified_count++;
+	if (dest - text < cnt) {
+		// cheaper to slide the text before the hole up,
+		// growing the free space in front of text[]
+		char *old_text = text;
+		text_head += src - dest;
+		text_move(old_text, old_text + (src - dest));
+		memmove(text, old_text, dest - old_text);
+		end -= src - dest;
+		return src;	// same offset as "dest" had
+	}
 	if (src >= end)
 		goto thd_atend;	// just delete the end of the buffer
 	memmove(dest, src, cnt);
@@ -1754,7 +2078,7 @@ static void undo_pop(void)
 	case UNDO_DEL_CHAIN:
 		// make hole and put in text that was deleted; deallocate text
 		u_start = text + undo_entry->start;
-		text_hole_make(u_start, undo_entry->length);
+		u_start = text_hole_make(u_start, undo_entry->length);
 		memcpy(u_start, undo_entry->undo_text, undo_entry->length);
 # if ENABLE_FEATURE_VI_VERBOSE_STATUS
 		status_line("Undo [%d] %s %d chars at position %d",
@@ -2007,7 +2331,20 @@ static int file_insert(const char *fn, char *p, int initial)
 		goto fi;
 	}
 	size = (statbuf.st_size < INT_MAX ? (int)statbuf.st_size : INT_MAX);
-	p += text_hole_make(p, size);
+#if ENABLE_FEATURE_VI_MMAP
+	if (initial && end == text && size >= 1024 * 1024) {
+		int slack;
+		char *new_text = text_map(fd, size, &slack);
+		if (new_text) {
+			text_use_map(new_text, size, slack, fd, &statbuf);
+			fd = -1;
+			end += size;
+			cnt = size;
+			goto fi;
+		}
+	}
+#endif
+	p = text_hole_make(p, size);
 	cnt = full_read(fd, p, size);
 	if (cnt < 0) {
 		status_line_bold_errno(fn);
@@ -2023,7 +2360,8 @@ static int file_insert(const char *fn, char *p, int initial)
 	}
 # endif
  fi:
-	close(fd);
+	if (fd >= 0)
+		close(fd);
 
 #if ENABLE_FEATURE_VI_READONLY
 	if (initial
@@ -2090,15 +2428,13 @@ static void showmatching(char *p)
 }
 #endif /* FEATURE_VI_SETOPTS */
 
-// might reallocate text[]! use p += stupid_insert(p, ...),
+// might reallocate text[]! use p = stupid_insert(p, ...),
 // and be careful to not use pointers into potentially freed text[]!
-static uintptr_t stupid_insert(char *p, char c) // stupidly insert the char c at 'p'
+static char *stupid_insert(char *p, char c) // stupidly insert the char c at 'p'
 {
-	uintptr_t bias;
-	bias = text_hole_make(p, 1);
-	p += bias;
+	p = text_hole_make(p, 1);
 	*p = c;
-	return bias;
+	return p;
 }
 
 // find number of characters in indent, p must be at beginning of line
@@ -2124,7 +2460,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 	char *bol = begin_line(p);
 
 	if (c == 22) {		// Is this an ctrl-V?
-		p += stupid_insert(p, '^');	// use ^ to indicate literal next
+		p = stupid_insert(p, '^');	// use ^ to indicate literal next
 		refresh(FALSE);	// show the ^
 		c = get_one_char();
 		*p = c;
@@ -2149,8 +2485,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 			col = get_column(bol + len);
 			if (len && col == indentcol && bol[len] == '\n') {
 				// remove autoindent from otherwise empty line
-				text_hole_delete(bol, bol + len - 1, undo);
-				p = bol;
+				p = text_hole_delete(bol, bol + len - 1, undo);
 			}
 		}
 #endif
@@ -2158,10 +2493,13 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 		char *r = bol + indent_len(bol);
 		int prev = prev_tabstop(get_column(r));
 		while (r > bol && get_column(r) > prev) {
+			int ofs = p - text, bol_ofs = bol - text;
 			if (p > bol)
-				p--;
+				ofs--;
 			r--;
 			r = text_hole_delete(r, r, ALLOW_UNDO_QUEUED);
+			p = text + ofs;
+			bol = text + bol_ofs;
 		}
 
 #if ENABLE_FEATURE_VI_SETOPTS
@@ -2181,7 +2519,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 # else
 			modified_count++;
 # endif
-			p += 1 + stupid_insert(p, ' ');
+			p = stupid_insert(p, ' ') + 1;
 		}
 #endif
 	} else if (isbackspace(c)) {
@@ -2190,7 +2528,11 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 			if (p > rstart) {
 				p--;
 #if ENABLE_FEATURE_VI_UNDO
-				undo_pop();
+				{
+					int ofs = p - text;
+					undo_pop();
+					p = text + ofs;
+				}
 #endif
 			}
 		} else if (p > text) {
@@ -2210,7 +2552,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 #else
 		modified_count++;
 #endif
-		p += 1 + stupid_insert(p, c);	// insert the char
+		p = stupid_insert(p, c) + 1;	// insert the char
 #if ENABLE_FEATURE_VI_SETOPTS
 		if (showmatch && strchr(")]}", c) != NULL) {
 			showmatching(p - 1);
@@ -2225,6 +2567,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 				if (len && col == indentcol) {
 					// previous line was empty except for autoindent
 					// move the indent to the current line
+					line_index_trim(bol);
 					memmove(bol + 1, bol, len);
 					*bol = '\n';
 					return p;
@@ -2248,7 +2591,7 @@ static char *char_insert(char *p, char c, int undo) // insert the char c at 'p'
 					ntab = col / tabstop;
 					nspc = col % tabstop;
 				}
-				p += text_hole_make(p, ntab + nspc);
+				p = text_hole_make(p, ntab + nspc);
 # if ENABLE_FEATURE_VI_UNDO
 				undo_push_insert(p, ntab + nspc, undo);
 # endif
@@ -2309,7 +2652,9 @@ static int init_text_buffer(char *fn)
 	int rc;
 
 	// allocate/reallocate text buffer
-	free(text);
+	text_free(text - text_head, text_size);
+	text_head = 0;
+	line_index_cnt = 0;
 	text_size = 10240;
 	screenbegin = dot = end = text = xzalloc(text_size);
 
@@ -2333,27 +2678,79 @@ static int init_text_buffer(char *fn)
 #if ENABLE_FEATURE_VI_YANKMARK \
  || (ENABLE_FEATURE_VI_COLON && ENABLE_FEATURE_VI_SEARCH) \
  || ENABLE_FEATURE_VI_CRASHME
-// might reallocate text[]! use p += string_insert(p, ...),
+// might reallocate text[]! use p = string_insert(p, ...),
 // and be careful to not use pointers into potentially freed text[]!
 # if !ENABLE_FEATURE_VI_UNDO
 #  define string_insert(a,b,c) string_insert(a,b)
 # endif
-static uintptr_t string_insert(char *p, const char *s, int undo) // insert the string at 'p'
+static char *string_insert(char *p, const char *s, int undo) // insert the string at 'p'
 {
-	uintptr_t bias;
 	int i;
 
 	i = strlen(s);
 #if ENABLE_FEATURE_VI_UNDO
 	undo_push_insert(p, i, undo);
 #endif
-	bias = text_hole_make(p, i);
-	p += bias;
+	p = text_hole_make(p, i);
 	memcpy(p, s, i);
-	return bias;
+	return p;
 }
 #endif
 
+#if ENABLE_FEATURE_VI_MMAP
+// Write all of text[] back to the file it is mapped from.
+// Pages we did not modify still read from that file, at offset
+// (page - text_map_start), so copy every chunk out before writing it
+// and go in the direction which never overwrites what is yet to be
+// copied. A fresh mapping made beforehand ends up with the new
+// contents and replaces text[].
+// Returns -1 if the file could not be mapped again (nothing written).
+static int file_write_mapped(const char *fn, int fd)
+{
+	enum { CHUNK = 64 * 1024 };
+	struct stat statbuf;
+	int len = end - text;
+	int backwards = (text < text_map_start);
+	int done, ofs, n, slack, mfd;
+	char *new_text, *buf;
+
+	mfd = open(fn, O_RDONLY);
+	if (mfd < 0)
+		return -1;
+	new_text = text_map(mfd, len, &slack);
+	if (!new_text) {
+		close(mfd);
+		return -1;
+	}
+
+	buf = xmalloc(CHUNK);
+	for (done = 0; done < len; done += n) {
+		n = len - done < CHUNK ? len - done : CHUNK;
+		ofs = backwards ? len - done - n : done;
+		memcpy(buf, text + ofs, n);
+		if (pwrite(fd, buf, n, ofs) != n)
+			break;
+	}
+	free(buf);
+
+	if (done != len) {
+		// what we did write may now be wrong in text[],
+		// the new mapping has it right
+		ofs = backwards ? len - done : 0;
+		text_unmap();
+		memcpy(text + ofs, new_text + ofs, done);
+		munmap(new_text - slack, len + 2 * slack);
+		close(mfd);
+		return 0;
+	}
+	ftruncate(fd, len);
+	fstat(mfd, &statbuf);
+	text_use_map(new_text, len, slack, mfd, &statbuf);
+	return len;
+}
+#endif
+
+// might move text[]!
 static int file_write(char *fn, char *first, char *last)
 {
 	int fd, cnt, charcnt;
@@ -2369,6 +2766,26 @@ static int file_write(char *fn, char *first, char *last)
 	if (fd < 0)
 		return -1;
 	cnt = last - first + 1;
+#if ENABLE_FEATURE_VI_MMAP
+	if (text_mapped) {
+		struct stat statbuf;
+
+		if (fstat(fd, &statbuf) == 0
+		 && statbuf.st_dev == text_map_dev
+		 && statbuf.st_ino == text_map_ino
+		) {
+			// we are overwriting the file text[] is mapped from
+			if (first == text && cnt == end - text) {
+				charcnt = file_write_mapped(fn, fd);
+				if (charcnt >= 0)
+					goto ret;
+			}
+			charcnt = first - text;
+			text_unmap();
+			first = text + charcnt;
+		}
+	}
+#endif
 	charcnt = full_write(fd, first, cnt);
 	ftruncate(fd, charcnt);
 	if (charcnt == cnt) {
@@ -2377,6 +2794,7 @@ static int file_write(char *fn, char *first, char *last)
 	} else {
 		charcnt = 0;
 	}
+ IF_FEATURE_VI_MMAP(ret:)
 	close(fd);
 	return charcnt;
 }
@@ -2496,7 +2914,7 @@ static char *get_one_address(char *p, int *result, int *valid)
 	IF_FEATURE_VI_SEARCH(int dir;)
 
 	got_addr = FALSE;
-	addr = count_lines(text, dot);	// default to current line
+	addr = line_number(dot);	// default to current line
 	sign = 0;
 	for (;;) {
 		if (isblank(*p)) {
@@ -2511,7 +2929,7 @@ static char *get_one_address(char *p, int *result, int *valid)
 			got_addr = TRUE;
 		} else if (!got_addr && *p == '$') {	// the last line in file
 			p++;
-			addr = count_lines(text, end - 1);
+			addr = line_number(end - 1);
 			got_addr = TRUE;
 		}
 # if ENABLE_FEATURE_VI_YANKMARK
@@ -2529,7 +2947,7 @@ static char *get_one_address(char *p, int *result, int *valid)
 				status_line_bold("Mark not set");
 				return NULL;
 			}
-			addr = count_lines(text, q);
+			addr = line_number(q);
 			got_addr = TRUE;
 		}
 # endif
@@ -2562,7 +2980,7 @@ static char *get_one_address(char *p, int *result, int *valid)
 					return NULL;
 				}
 			}
-			addr = count_lines(text, q);
+			addr = line_number(q);
 			got_addr = TRUE;
 		}
 # endif
@@ -2614,7 +3032,7 @@ static char *get_address(char *p, int *b, int *e, unsigned int *got)
 		} else if (state == GET_ADDRESS && *p == '%') {	// alias for 1,$
 			p++;
 			*b = 1;
-			*e = count_lines(text, end-1);
+			*e = line_number(end - 1);
 			*got = 3;
 			state = GET_SEPARATOR;
 		} else if (state == GET_ADDRESS) {
@@ -2815,6 +3233,10 @@ static void colon(char *buf)
 	 || (p[0] == 'x' && !p[1])
 	) {
 		if (modified_count != 0 || p[0] != 'x') {
+			if (text_map_changed()) {
+				status_line_bold("File changed since it was read");
+				return;
+			}
 			cnt = file_write(current_filename, text, end - 1);
 		}
 		if (cnt < 0) {
@@ -2825,7 +3247,7 @@ static void colon(char *buf)
 			last_modified_count = -1;
 			status_line("'%s' %uL, %uC",
 				current_filename,
-				count_lines(text, end - 1), cnt
+				line_number(end - 1), cnt
 			);
 			if (p[0] == 'x'
 			 || p[1] == 'q' || p[1] == 'n'
@@ -2882,7 +3304,6 @@ static void colon(char *buf)
 	li = i = 0;
 	b = e = -1;
 	got = 0;
-	li = count_lines(text, end - 1);
 	fn = current_filename;
 
 	// look for optional address(es)  :.  :1  :1,9   :'q,'a   :%
@@ -2915,6 +3336,7 @@ static void colon(char *buf)
 		r = end - 1;
 	} else {
 		// at least one addr was given, get its details
+		li = line_number(end - 1);
 		if (e < 0 || e > li) {
 			status_line_bold("Invalid range");
 			goto ret;
@@ -2964,7 +3386,7 @@ static void colon(char *buf)
 # endif
 	else if (cmd[0] == '=' && !cmd[1]) {	// where is the address
 		if (!GOT_ADDRESS) {	// no addr given- use defaults
-			e = count_lines(text, dot);
+			e = line_number(dot);
 		}
 		status_line("%d", e);
 	} else if (strncmp(cmd, "delete", i) == 0) {	// delete lines
@@ -3005,8 +3427,12 @@ static void colon(char *buf)
 			reg[YDreg] = NULL;
 		}
 # endif
-		// how many lines in text[]?
-		li = count_lines(text, end - 1);
+# if ENABLE_FEATURE_VI_MMAP
+		// counting its lines would read all of a mapped file
+		if (text_mapped)
+			status_line("'%s' %uC", fn, (int)(end - text));
+		else
+# endif
 		status_line("'%s'%s"
 			IF_FEATURE_VI_READONLY("%s")
 			" %uL, %uC",
@@ -3015,7 +3441,7 @@ static void colon(char *buf)
 			IF_FEATURE_VI_READONLY(
 				((readonly_mode) ? " [Readonly]" : ""),
 			)
-			li, (int)(end - text)
+			line_number(end - 1), (int)(end - text)
 		);
 	} else if (strncmp(cmd, "file", i) == 0) {	// what File is this
 		if (e >= 0) {
@@ -3128,7 +3554,7 @@ static void colon(char *buf)
 			if (q == end-1)
 				++q;
 		}
-		num = count_lines(text, q);
+		num = line_number(q);
 		if (q == end)
 			num++;
 		{ // dance around potentially-reallocated text[]
@@ -3247,7 +3673,7 @@ static void colon(char *buf)
 		if (!GOT_ADDRESS) {	// no addr given
 			q = begin_line(dot);      // start with cur line
 			r = end_line(dot);
-			b = e = count_lines(text, q); // cur line number
+			b = e = line_number(q); // cur line number
 		} else if (!GOT_RANGE) {	// one addr given
 			b = e;
 		}
@@ -3276,7 +3702,7 @@ static void colon(char *buf)
 			found = char_search(q, F, (FORWARD << 1) | LIMITED);	// search cur line only for "find"
 #  endif
 			if (found) {
-				uintptr_t bias;
+				int ls_ofs = ls - text, found_ofs = found - text;
 				// we found the "find" pattern - delete it
 				// For undo support, the first item should not be chained
 				// This needs to be handled differently depending on
@@ -3290,16 +3716,17 @@ static void colon(char *buf)
 #   define TEST_UNDO1 subs
 #   define TEST_UNDO2 1
 #  endif
-				if (TEST_LEN_F)	// match can be empty, no delete needed
+				if (TEST_LEN_F) {	// match can be empty, no delete needed
 					text_hole_delete(found, found + len_F - 1,
 								TEST_UNDO1 ? ALLOW_UNDO_CHAIN : ALLOW_UNDO);
+					found = text + found_ofs;
+				}
 				if (len_R != 0) {	// insert the "replace" pattern, if required
-					bias = string_insert(found, R,
+					found = string_insert(found, R,
 								TEST_UNDO2 ? ALLOW_UNDO_CHAIN : ALLOW_UNDO);
-					found += bias;
-					ls += bias;
-					//q += bias; - recalculated anyway
+					//q - recalculated anyway
 				}
+				ls = text + ls_ofs;
 #  if ENABLE_FEATURE_VI_REGEX_SEARCH
 				free(R);
 #  endif
@@ -3375,8 +3802,15 @@ static void colon(char *buf)
 			// forced = TRUE;
 		//}
 		if (modified_count != 0 || cmd[0] != 'x') {
+			uintptr_t ofs = q - text;
+			if (!useforce && text_map_changed()) {
+				status_line_bold("File changed since it was read (:w! overrides)");
+				goto ret;
+			}
 			size = r - q + 1;
+			// file_write() might move text[]
 			l = file_write(fn, q, r);
+			q = text + ofs;
 		} else {
 			size = 0;
 			l = 0;
@@ -3729,6 +4163,8 @@ static void do_cmd(int c)
 			undo_queue_commit();
 		} else {
 			if (1 <= c || Isprint(c)) {
+				if (c != 27)
+					text_gap_open();
 				if (c != 27 && !isbackspace(c))
 					dot = yank_delete(dot, dot, PARTIAL, YANKDEL, ALLOW_UNDO);
 				dot = char_insert(dot, c, ALLOW_UNDO_CHAIN);
@@ -3741,12 +4177,15 @@ static void do_cmd(int c)
 		if (c == KEYCODE_INSERT) goto dc5;
 		// insert the char c at "dot"
 		if (1 <= c || Isprint(c)) {
+			if (c != 27)
+				text_gap_open();
 			dot = char_insert(dot, c, ALLOW_UNDO_QUEUED);
 		}
 		goto dc1;
 	}
 
  key_cmd_mode:
+	text_gap_close();
 	switch (c) {
 		//case 0x01:	// soh
 		//case 0x09:	// ht
@@ -3960,7 +4399,7 @@ static void do_cmd(int c)
 			p = begin_line(dot);
 			q = end_line(dot);
 			p = text_hole_delete(p, q, ALLOW_UNDO);	// delete cur line
-			p += string_insert(p, reg[Ureg], ALLOW_UNDO_CHAIN);	// insert orig line
+			p = string_insert(p, reg[Ureg], ALLOW_UNDO_CHAIN);	// insert orig line
 			dot = p;
 			dot_skip_over_ws();
 # if ENABLE_FEATURE_VI_YANKMARK && ENABLE_FEATURE_VI_VERBOSE_STATUS
@@ -4123,7 +4562,7 @@ static void do_cmd(int c)
 		break;
 	case '<':			// <- Left  shift something
 	case '>':			// >- Right shift something
-		cnt = count_lines(text, dot);	// remember what line we are on
+		cnt = line_number(dot);	// remember what line we are on
 		if (find_range(&p, &q, c) == -1)
 			goto dc6;
 		i = count_lines(p, q);	// # of lines we are shifting
@@ -4132,11 +4571,11 @@ static void do_cmd(int c)
 				// shift left- remove tab or tabstop spaces
 				if (*p == '\t') {
 					// shrink buffer 1 char
-					text_hole_delete(p, p, allow_undo);
+					p = text_hole_delete(p, p, allow_undo);
 				} else if (*p == ' ') {
 					// we should be calculating columns, not just SPACE
 					for (j = 0; *p == ' ' && j < tabstop; j++) {
-						text_hole_delete(p, p, allow_undo);
+						p = text_hole_delete(p, p, allow_undo);
 #if ENABLE_FEATURE_VI_UNDO
 						allow_undo = ALLOW_UNDO_CHAIN;
 #endif
@@ -4144,7 +4583,7 @@ static void do_cmd(int c)
 				}
 			} else if (/* c == '>' && */ p != end_line(p)) {
 				// shift right -- add tab or tabstop spaces on non-empty lines
-				char_insert(p, '\t', allow_undo);
+				p = char_insert(p, '\t', allow_undo);
 			}
 #if ENABLE_FEATURE_VI_UNDO
 			allow_undo = ALLOW_UNDO_CHAIN;
@@ -4241,6 +4680,7 @@ static void do_cmd(int c)
 		do {
 			dot_end();		// move to NL
 			if (dot < end - 1) {	// make sure not last char in text[]
+				line_index_trim(dot);
 #if ENABLE_FEATURE_VI_UNDO
 				undo_push(dot, 1, UNDO_DEL);
 				*dot++ = ' ';	// replace NL with space
@@ -4310,7 +4750,7 @@ static void do_cmd(int c)
 		if (c == 'X')
 			dir = -1;
 		do {
-			if (dot[dir] != '\n') {
+			if (dot + dir >= text && dot[dir] != '\n') {
 				if (c == 'X')
 					dot--;	// delete prev char
 				dot = yank_delete(dot, dot, PARTIAL, YANKDEL, allow_undo);	// delete char
@@ -4335,6 +4775,10 @@ static void do_cmd(int c)
 				status_line_bold("'%s' is read only", current_filename);
 				break;
 			}
+			if (text_map_changed()) {
+				status_line_bold("File changed since it was read");
+				break;
+			}
 			cnt = file_write(current_filename, text, end - 1);
 			if (cnt < 0) {
 				if (cnt == -1)
@@ -4844,6 +5288,7 @@ static void edit_file(char *fn)
 	signal(SIGTSTP, tstp_handler);
 	sig = sigsetjmp(restart, 1);
 	if (sig != 0) {
+		text_gap_close();
 		screenbegin = dot = text;
 	}
 	// int_handler() can jump to "restart",
@@ -27,4 +27,29 @@ typedef enum bb_suid_t {
 	BB_SUID_REQUIRE
 } bb_suid_t;
 
+#if ENABLE_FEATURE_APPLET_HASH
+/* Applet names are looked up by minimal perfect hash (CHD-like).
+ * The name hash selects a bucket; the bucket's seed, mixed into
+ * the same hash, selects the slot. The generator finds seeds which
+ * give every applet a separate slot.
+ */
+static inline uint32_t applet_name_hash(const char *name)
+{
+	uint32_t h = 0x811c9dc5;
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 0x01000193;
+	return h;
+}
+static inline uint32_t applet_hash_mix(uint32_t h, unsigned seed)
+{
+	h ^= seed * 0x9e3779b9;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+#endif
+
 #endif
@@ -1957,6 +1957,10 @@ typedef struct line_input_t {
 	const char *hist_file;
 #  endif
 	char *history[MAX_HISTORY + 1];
+#  if ENABLE_FEATURE_REVERSE_SEARCH_INDEX
+	/* trigram signatures of history[] lines, for Ctrl-R */
+	uint64_t history_sig[MAX_HISTORY + 1];
+#  endif
 # endif
 } line_input_t;
 enum {
@@ -2032,6 +2036,7 @@ int FAST_FUNC procps_read_smaps(pid_t pid, struct smaprec *total,
 typedef struct procps_status_t {
 	DIR *dir;
 	IF_FEATURE_SHOW_THREADS(DIR *task_dir;)
+	IF_FEATURE_TOP_CACHE(struct procps_cache *cache;)
 	uint8_t shift_pages_to_bytes;
 	uint8_t shift_pages_to_kb;
 /* Fields are set to 0/NULL if failed to determine (or not requested) */
@@ -2105,6 +2110,12 @@ enum {
 //procps_status_t* alloc_procps_scan(void) FAST_FUNC;
 void free_procps_scan(procps_status_t* sp) FAST_FUNC;
 procps_status_t* procps_scan(procps_status_t* sp, int flags) FAST_FUNC;
+#if ENABLE_FEATURE_TOP_CACHE
+/* Keeps /proc/PID/stat fds and cmdlines between scans */
+struct procps_cache *procps_cache_new(void) FAST_FUNC;
+void procps_cache_free(struct procps_cache *pc) FAST_FUNC;
+procps_status_t* procps_scan_cached(procps_status_t* sp, struct procps_cache *pc, int flags) FAST_FUNC;
+#endif
 /* Format cmdline (up to col chars) into char buf[size] */
 /* Puts [comm] if cmdline is empty (-> process is a kernel thread) */
 void read_cmdline(char *buf, int size, unsigned pid, const char *comm) FAST_FUNC;
@@ -33,6 +33,34 @@
 //config:	help
 //config:	Allow init to read an inittab file when the system boot.
 //config:
+//config:config FEATURE_INIT_PARALLEL
+//config:	bool "Support parallel sysinit and wait actions"
+//config:	default y
+//config:	depends on FEATURE_USE_INITTAB
+//config:	help
+//config:	Allow inittab to name sysinit and wait actions, e.g.
+//config:	"::sysinit@net<storage:/etc/init.d/net". Consecutive named
+//config:	actions are started concurrently, each as soon as the actions
+//config:	it lists after '<' have completed. A plain sysinit or wait
+//config:	action after them waits for all of them to complete.
+//config:	Time taken by each sysinit and wait action is logged.
+//config:
+//config:config FEATURE_INIT_PROFILE
+//config:	bool "Record boot timeline"
+//config:	default y
+//config:	depends on INIT
+//config:	help
+//config:	Record the time (in microseconds) when each action is spawned,
+//config:	exec'ed and exits. On SIGPROF, init writes the recorded timeline
+//config:	in Chrome trace format (JSON) to INIT_PROFILE_FILE.
+//config:	Load it into chrome://tracing or ui.perfetto.dev to see
+//config:	the critical path of the boot process.
+//config:
+//config:config INIT_PROFILE_FILE
+//config:	string "File to write timeline to"
+//config:	default "/run/init.trace.json"
+//config:	depends on FEATURE_INIT_PROFILE
+//config:
 //config:config FEATURE_KILL_REMOVED
 //config:	bool "Support killing processes that have been removed from inittab"
 //config:	default n
@@ -201,12 +229,34 @@ struct init_action {
 	struct init_action *next;
 	pid_t pid;
 	uint8_t action_type;
+#if ENABLE_FEATURE_INIT_PARALLEL
+	uint8_t pstate; /* P_xxx */
+	/* "NAME" or "NAME<DEP,DEP": NULL for plain (sequential) action */
+	char *name;
+	unsigned long long started_ms;
+#endif
 	char terminal[CONSOLE_NAME_SIZE];
 	char command[1];
 };
 
+#if ENABLE_FEATURE_INIT_PROFILE
+/* Events are recorded only for children that are our init_actions */
+struct init_event {
+	unsigned long long us;
+	pid_t pid;
+	char type; /* 'B'egin (spawn), 'i' (exec), 'E'nd (exit) */
+	char *command; /* for 'B' only */
+};
+/* Do not grow unbounded if something respawns in a loop */
+# define MAX_INIT_EVENTS 4096
+#endif
+
 struct globals {
 	struct init_action *init_action_list;
+#if ENABLE_FEATURE_INIT_PROFILE
+	struct init_event *events;
+	unsigned event_cnt;
+#endif
 #if !ENABLE_FEATURE_INIT_SYSLOG
 	const char *log_console;
 #endif
@@ -475,19 +525,106 @@ static void init_exec(const char *command)
 	/* returns if execvp fails */
 }
 
+#if ENABLE_FEATURE_INIT_PROFILE
+static void record_event(unsigned long long us, pid_t pid, char type, const char *command)
+{
+	struct init_event *e;
+
+	if (G.event_cnt >= MAX_INIT_EVENTS)
+		return;
+	G.events = xrealloc_vector(G.events, 6, G.event_cnt);
+	e = &G.events[G.event_cnt++];
+	e->us = us;
+	e->pid = pid;
+	e->type = type;
+	e->command = command ? xstrdup(command) : NULL;
+}
+
+static void fput_json_str(const char *s, FILE *fp)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fputc('\\', fp);
+		if (c < ' ')
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+static void dump_events(void)
+{
+	const char *sep = "";
+	unsigned i;
+	FILE *fp;
+
+	fp = fopen_for_write(CONFIG_INIT_PROFILE_FILE);
+	if (!fp) {
+		message(L_LOG | L_CONSOLE, "can't open '%s'", CONFIG_INIT_PROFILE_FILE);
+		return;
+	}
+	fputs("{\"traceEvents\":[\n", fp);
+	for (i = 0; i < G.event_cnt; i++) {
+		struct init_event *e = &G.events[i];
+		fprintf(fp, "%s{\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%llu",
+				sep, e->type, (unsigned)e->pid, e->us);
+		if (e->command) {
+			fputs(",\"name\":", fp);
+			fput_json_str(e->command, fp);
+		}
+		if (e->type == 'i')
+			fputs(",\"name\":\"exec\",\"s\":\"t\"", fp);
+		fputc('}', fp);
+		sep = ",\n";
+	}
+	fputs("\n]}\n", fp);
+	if (fclose(fp) != 0)
+		message(L_LOG | L_CONSOLE, "can't write '%s'", CONFIG_INIT_PROFILE_FILE);
+}
+
+/* sysinit/wait/once actions don't store their pid:
+ * close the 'B' event of "pid" if it is still open */
+static void record_exit(pid_t pid)
+{
+	unsigned i = G.event_cnt;
+
+	while (i != 0) {
+		struct init_event *e = &G.events[--i];
+		if (e->pid == pid && e->type != 'i') {
+			if (e->type == 'B')
+				record_event(monotonic_us(), pid, 'E', NULL);
+			break;
+		}
+	}
+}
+#else
+# define record_event(us, pid, type, command) ((void)0)
+# define record_exit(pid) ((void)0)
+#endif
+
 /* Used only by run_actions */
 static pid_t run(const struct init_action *a)
 {
 	pid_t pid;
+	IF_FEATURE_INIT_PROFILE(unsigned long long us = monotonic_us();)
 
 	if (BB_MMU && (a->action_type & ASKFIRST))
 		pid = fork();
 	else
 		pid = vfork();
 	if (pid) {
-		if (pid < 0)
+		if (pid < 0) {
 			message(L_LOG | L_CONSOLE, "can't fork");
-		return pid; /* Parent or error */
+			return pid;
+		}
+		record_event(us, pid, 'B', a->command);
+		/* Parent of vfork resumes when child has exec'ed (or died) */
+		if (!BB_MMU || !(a->action_type & ASKFIRST))
+			record_event(monotonic_us(), pid, 'i', NULL);
+		return pid; /* Parent */
 	}
 
 	/* Child */
@@ -561,10 +698,12 @@ static struct init_action *mark_terminated(pid_t pid)
 		update_utmp_DEAD_PROCESS(pid);
 		for (a = G.init_action_list; a; a = a->next) {
 			if (a->pid == pid) {
+				record_event(monotonic_us(), pid, 'E', NULL);
 				a->pid = 0;
 				return a;
 			}
 		}
+		record_exit(pid);
 	}
 	return NULL;
 }
@@ -590,6 +729,155 @@ static void waitfor(pid_t pid)
 	}
 }
 
+#if ENABLE_FEATURE_INIT_PARALLEL
+enum {
+	P_PENDING = 0,
+	P_RUNNING,
+	P_DONE,
+};
+
+static void report_time(const char *what, unsigned long long started_ms)
+{
+	unsigned ms = monotonic_ms() - started_ms;
+	message(L_LOG, "'%s' took %u.%03u s", what, ms / 1000, ms % 1000);
+}
+
+/* Is "a" named "name" (terminated by ',' or NUL)? */
+static int action_named(struct init_action *a, const char *name)
+{
+	unsigned len = strchrnul(name, ',') - name;
+
+	return a->name
+		&& strncmp(a->name, name, len) == 0
+		&& (a->name[len] == '\0' || a->name[len] == '<');
+}
+
+/* Is "name" done, or not in the batch at all? */
+static int dep_done(struct init_action *first, struct init_action *end,
+		int action_type, const char *name)
+{
+	struct init_action *a;
+
+	for (a = first; a != end; a = a->next) {
+		if ((a->action_type & action_type) && action_named(a, name))
+			return a->pstate == P_DONE;
+	}
+	/* Unknown, or belongs to an earlier (hence finished) batch */
+	return 1;
+}
+
+/* A typo in a dependency would silently drop the ordering: warn */
+static void check_deps(struct init_action *a)
+{
+	const char *dep = strchr(a->name, '<');
+
+	while (dep) {
+		struct init_action *b;
+
+		dep++;
+		for (b = G.init_action_list; b; b = b->next) {
+			if (action_named(b, dep))
+				break;
+		}
+		if (!b) {
+			message(L_LOG | L_CONSOLE, "'%s': no action named '%.*s'",
+				a->command, (int)(strchrnul(dep, ',') - dep), dep);
+		}
+		dep = strchr(dep, ',');
+	}
+}
+
+static int deps_done(struct init_action *first, struct init_action *end,
+		int action_type, struct init_action *a)
+{
+	const char *dep = strchr(a->name, '<');
+
+	while (dep) {
+		if (!dep_done(first, end, action_type, dep + 1))
+			return 0;
+		dep = strchr(dep + 1, ',');
+	}
+	return 1;
+}
+
+/* Run named actions starting from "first", up to next plain one,
+ * in parallel as far as their dependencies allow.
+ * Returns the last action of the batch.
+ */
+static struct init_action *run_parallel(struct init_action *first, int action_type)
+{
+	struct init_action *a, *end, *last;
+	unsigned long long started_ms = monotonic_ms();
+
+	last = first;
+	for (end = first; end; end = end->next) {
+		if (!(end->action_type & action_type))
+			continue;
+		if (!end->name)
+			break;
+		end->pstate = P_PENDING;
+		check_deps(end);
+		last = end;
+	}
+
+	while (1) {
+		unsigned running = 0;
+		unsigned pending = 0;
+		unsigned started = 0;
+		pid_t wpid;
+
+		for (a = first; a != end; a = a->next) {
+			if (!(a->action_type & action_type))
+				continue;
+			if (a->pstate == P_RUNNING && a->pid == 0) {
+				/* reaped by us or by stop_handler() */
+				a->pstate = P_DONE;
+				report_time(a->command, a->started_ms);
+			}
+		}
+		for (a = first; a != end; a = a->next) {
+			if (!(a->action_type & action_type))
+				continue;
+			if (a->pstate == P_PENDING
+			 && deps_done(first, end, action_type, a)
+			) {
+				a->started_ms = monotonic_ms();
+				a->pid = run(a);
+				a->pstate = P_RUNNING;
+				if (a->pid <= 0) {
+					/* failed to start */
+					a->pid = 0;
+					a->pstate = P_DONE;
+				}
+				started++;
+			}
+			running += (a->pstate == P_RUNNING);
+			pending += (a->pstate == P_PENDING);
+		}
+		if (running == 0) {
+			if (pending == 0)
+				break;
+			if (started)
+				continue;
+			/* Dependency loop: start the first one anyway */
+			for (a = first; a->pstate != P_PENDING || !(a->action_type & action_type); a = a->next)
+				continue;
+			message(L_LOG | L_CONSOLE, "dependency loop at '%s'", a->name);
+			a->name[strchrnul(a->name, '<') - a->name] = '\0';
+			continue;
+		}
+		wpid = wait(NULL);
+		mark_terminated(wpid);
+	}
+
+	if (first != last)
+		report_time("parallel actions", started_ms);
+	return last;
+}
+#else
+# define report_time(what, started_ms) ((void)0)
+#endif
+
 /* Run all commands of a particular type */
 static void run_actions(int action_type)
 {
@@ -600,9 +888,22 @@ static void run_actions(int action_type)
 			continue;
 
 		if (a->action_type & (SYSINIT | WAIT | ONCE | CTRLALTDEL | SHUTDOWN)) {
-			pid_t pid = run(a);
+			pid_t pid;
+#if ENABLE_FEATURE_INIT_PARALLEL
+			unsigned long long started_ms;
+
+			if (a->name) {
+				/* only sysinit and wait actions may have one */
+				a = run_parallel(a, action_type);
+				continue;
+			}
+			started_ms = monotonic_ms();
+#endif
+			pid = run(a);
 			if (a->action_type & (SYSINIT | WAIT | CTRLALTDEL | SHUTDOWN))
 				waitfor(pid);
+			if (a->action_type & (SYSINIT | WAIT))
+				report_time(a->command, started_ms);
 		}
 		if (a->action_type & (RESPAWN | ASKFIRST)) {
 			/* Only run stuff with pid == 0. If pid != 0,
@@ -614,7 +915,7 @@ static void run_actions(int action_type)
 	}
 }
 
-static void new_init_action(uint8_t action_type, const char *command, const char *cons)
+static struct init_action *new_init_action(uint8_t action_type, const char *command, const char *cons)
 {
 	struct init_action *a, **nextp;
 
@@ -658,6 +959,7 @@ static void new_init_action(uint8_t action_type, const char *command, const char
 	safe_strncpy(a->terminal, cons, sizeof(a->terminal));
 	dbg_message(L_LOG | L_CONSOLE, "command='%s' action=%x tty='%s'\n",
 		a->command, a->action_type, a->terminal);
+	return a;
 }
 
 /* NOTE that if CONFIG_FEATURE_USE_INITTAB is NOT defined,
@@ -708,17 +1010,33 @@ static void parse_inittab(void)
 			"ctrlaltdel\0""shutdown\0""restart\0";
 		int action;
 		char *tty = token[0];
+		IF_FEATURE_INIT_PARALLEL(struct init_action *a;)
+		IF_FEATURE_INIT_PARALLEL(char *name;)
 
 		if (!token[3]) /* less than 4 tokens */
 			goto bad_entry;
+#if ENABLE_FEATURE_INIT_PARALLEL
+		/* "sysinit@NAME<DEP,DEP" */
+		name = strchr(token[2], '@');
+		if (name)
+			*name++ = '\0';
+#endif
 		action = index_in_strings(actions, token[2]);
 		if (action < 0 || !token[3][0]) /* token[3]: command */
 			goto bad_entry;
+#if ENABLE_FEATURE_INIT_PARALLEL
+		if (name && ((1 << action) & ~(SYSINIT | WAIT) || !name[0] || name[0] == '<'))
+			goto bad_entry;
+#endif
 		/* turn .*TTY -> /dev/TTY */
 		if (tty[0]) {
 			tty = concat_path_file("/dev/", skip_dev_pfx(tty));
 		}
-		new_init_action(1 << action, token[3], tty);
+		IF_FEATURE_INIT_PARALLEL(a =) new_init_action(1 << action, token[3], tty);
+#if ENABLE_FEATURE_INIT_PARALLEL
+		free(a->name);
+		a->name = xstrdup(name);
+#endif
 		if (tty[0])
 			free(tty);
 		continue;
@@ -961,6 +1279,7 @@ static void reload_inittab(void)
 		 */
 		if ((a->action_type & ~SYSINIT) == 0 && a->pid == 0) {
 			*nextp = a->next;
+			IF_FEATURE_INIT_PARALLEL(free(a->name);)
 			free(a);
 		} else {
 			nextp = &a->next;
@@ -984,6 +1303,10 @@ static void check_delayed_sigs(struct timespec *ts)
 #if ENABLE_FEATURE_USE_INITTAB
 	if (sig == SIGHUP)
 		reload_inittab();
+#endif
+#if ENABLE_FEATURE_INIT_PROFILE
+	if (sig == SIGPROF)
+		dump_events();
 #endif
 	if (sig == SIGINT)
 		run_actions(CTRLALTDEL);
@@ -1056,6 +1379,9 @@ int init_main(int argc UNUSED_PARAM, char **argv)
 	sigaddset(&G.delayed_sigset, SIGUSR2); /* poweroff */
 #if ENABLE_FEATURE_USE_INITTAB
 	sigaddset(&G.delayed_sigset, SIGHUP);  /* reread /etc/inittab */
+#endif
+#if ENABLE_FEATURE_INIT_PROFILE
+	sigaddset(&G.delayed_sigset, SIGPROF); /* write boot timeline */
 #endif
 	sigaddset(&G.delayed_sigset, SIGCHLD); /* make sigtimedwait() exit on SIGCHLD */
 	sigprocmask(SIG_BLOCK, &G.delayed_sigset, NULL);
@@ -1237,6 +1563,9 @@ int init_main(int argc UNUSED_PARAM, char **argv)
 //usage:   "\n""TSTP: stop respawning until CONT"
 //usage:   "\n""QUIT: re-exec another init"
 //usage:   "\n""USR1/TERM/USR2/INT: run halt/reboot/poweroff/Ctrl-Alt-Del script"
+//usage:	IF_FEATURE_INIT_PROFILE(
+//usage:   "\n""PROF: write boot timeline to "CONFIG_INIT_PROFILE_FILE
+//usage:	)
 //usage:
 //usage:#define init_notes_usage
 //usage:	"This version of init is designed to be run only by the kernel.\n"
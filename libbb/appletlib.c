@@ -174,6 +174,20 @@ void FAST_FUNC bb_show_usage(void)
 	xfunc_die();
 }
 
+#if ENABLE_FEATURE_APPLET_HASH
+int FAST_FUNC find_applet_by_name(const char *name)
+{
+	uint32_t h = applet_name_hash(name);
+	unsigned i;
+
+	/* The hash maps any string to some applet, check that it's this one */
+	i = applet_hash_mix(h, applet_hash_seed[h % APPLET_HASH_BUCKETS]) % NUM_APPLETS;
+	i = applet_hash_slot[i];
+	if (strcmp(name, applet_names + applet_name_ofs[i]) == 0)
+		return i;
+	return -1;
+}
+#else
 int FAST_FUNC find_applet_by_name(const char *name)
 {
 	unsigned i;
@@ -238,6 +252,7 @@ int FAST_FUNC find_applet_by_name(const char *name)
 	}
 	return -1;
 }
+#endif
 
 
 void lbb_prepare(const char *applet
@@ -1408,6 +1408,32 @@ unsigned FAST_FUNC size_from_HISTFILESIZE(const char *hp)
 	return size;
 }
 
+# if ENABLE_FEATURE_REVERSE_SEARCH_INDEX
+/* Every trigram of the line sets one of 64 bits. A line can contain
+ * a search string only if it has all bits of the string's signature.
+ * Strings shorter than three bytes have zero signature, matching all.
+ */
+static uint64_t history_sig(const char *s)
+{
+	uint64_t sig = 0;
+	uint32_t tri;
+
+	if (!s[0] || !s[1])
+		return 0;
+	tri = ((uint8_t)s[0] << 8) | (uint8_t)s[1];
+	s += 2;
+	while (*s) {
+		tri = ((tri << 8) | (uint8_t)*s++) & 0xffffff;
+		sig |= (uint64_t)1 << ((tri * 0x9e3779b1) >> 26);
+	}
+	return sig;
+}
+#  define update_history_sig(st, i) \
+	((st)->history_sig[i] = history_sig((st)->history[i]))
+# else
+#  define update_history_sig(st, i) ((void)0)
+# endif
+
 static void save_command_ps_at_cur_history(void)
 {
 	if (command_ps[0] != BB_NUL) {
@@ -1423,6 +1449,7 @@ static void save_command_ps_at_cur_history(void)
 # else
 		state->history[cur] = xstrdup(command_ps);
 # endif
+		update_history_sig(state, cur);
 	}
 }
 
@@ -1484,90 +1511,143 @@ void FAST_FUNC free_line_input_t(line_input_t *n)
  * than configured MAX_HISTORY lines.
  */
 
+/* Counts non-empty lines in [p, end) */
+static unsigned count_history_lines(const char *p, const char *end)
+{
+	unsigned cnt = 0;
+
+	while (p < end) {
+		const char *nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+		if (nl != p)
+			cnt++;
+		p = nl + 1;
+	}
+	return cnt;
+}
+
 /* state->flags is already checked to be nonzero */
 static void load_history(line_input_t *st_parm)
 {
-	char *temp_h[MAX_HISTORY];
-	char *line;
-	FILE *fp;
-	unsigned idx, i, line_len;
+	struct stat statbuf;
+	char *buf, *p, *end;
+	size_t size;
+	unsigned idx, i;
+	int fd;
 
 	/* NB: do not trash old history if file can't be opened */
 
-	fp = fopen_for_read(st_parm->hist_file);
-	if (fp) {
-		/* clean up old history */
-		for (idx = st_parm->cnt_history; idx > 0;) {
-			idx--;
-			free(st_parm->history[idx]);
-			st_parm->history[idx] = NULL;
-		}
+	fd = open(st_parm->hist_file, O_RDONLY);
+	if (fd < 0)
+		return;
 
-		/* fill temp_h[], retaining only last MAX_HISTORY lines */
-		memset(temp_h, 0, sizeof(temp_h));
-		idx = 0;
-		st_parm->cnt_history_in_file = 0;
-		while ((line = xmalloc_fgetline(fp)) != NULL) {
-			if (line[0] == '\0') {
-				free(line);
-				continue;
-			}
-			free(temp_h[idx]);
-			temp_h[idx] = line;
-			st_parm->cnt_history_in_file++;
-			idx++;
-			if (idx == st_parm->max_history)
-				idx = 0;
-		}
-		fclose(fp);
-
-		/* find first non-NULL temp_h[], if any */
-		if (st_parm->cnt_history_in_file) {
-			while (temp_h[idx] == NULL) {
-				idx++;
-				if (idx == st_parm->max_history)
-					idx = 0;
-			}
-		}
+	/* Map the file and parse it from the end: only the last
+	 * max_history lines are needed, the rest is merely counted.
+	 * This keeps shell startup fast even when many shells
+	 * have been appending to a long history file.
+	 */
+	buf = MAP_FAILED;
+	size = 0;
+	if (fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode)) {
+		size = statbuf.st_size;
+		if (size != 0)
+			buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if (buf == MAP_FAILED) {
+		size = INT_MAX;
+		p = xmalloc_read(fd, &size);
+	} else {
+		p = buf;
+	}
+	close(fd);
+	if (!p)
+		return;
 
-		/* copy temp_h[] to st_parm->history[] */
-		for (i = 0; i < st_parm->max_history;) {
-			line = temp_h[idx];
-			if (!line)
-				break;
-			idx++;
-			if (idx == st_parm->max_history)
-				idx = 0;
-			line_len = strlen(line);
+	/* clean up old history */
+	for (idx = st_parm->cnt_history; idx > 0;) {
+		idx--;
+		free(st_parm->history[idx]);
+		st_parm->history[idx] = NULL;
+	}
+
+	/* fill history[] from the top, retaining only last max_history lines */
+	idx = st_parm->max_history;
+	st_parm->cnt_history_in_file = 0;
+	end = p + size;
+	if (end != p && end[-1] == '\n')
+		end--;
+	for (;;) {
+		char *line = end;
+
+		while (line != p && line[-1] != '\n')
+			line--;
+		if (line != end) {
+			size_t line_len = end - line;
 			if (line_len >= MAX_LINELEN)
-				line[MAX_LINELEN-1] = '\0';
-			st_parm->history[i++] = line;
+				line_len = MAX_LINELEN - 1;
+			st_parm->history[--idx] = xstrndup(line, line_len);
+			st_parm->cnt_history_in_file++;
+		}
+		if (line == p)
+			break;
+		end = line - 1;
+		if (idx == 0) {
+			if (!ENABLE_FEATURE_EDITING_SAVE_ON_EXIT)
+				st_parm->cnt_history_in_file += count_history_lines(p, end);
+			break;
 		}
-		st_parm->cnt_history = i;
-		if (ENABLE_FEATURE_EDITING_SAVE_ON_EXIT)
-			st_parm->cnt_history_in_file = i;
 	}
+	if (buf != MAP_FAILED)
+		munmap(buf, size);
+	else
+		free(p);
+
+	/* move history[] down to start at [0] */
+	i = st_parm->max_history - idx;
+	memmove(st_parm->history, st_parm->history + idx, i * sizeof(st_parm->history[0]));
+	memset(st_parm->history + i, 0, idx * sizeof(st_parm->history[0]));
+	st_parm->cnt_history = i;
+	while (i != 0) {
+		i--;
+		update_history_sig(st_parm, i);
+	}
+	if (ENABLE_FEATURE_EDITING_SAVE_ON_EXIT)
+		st_parm->cnt_history_in_file = st_parm->cnt_history;
 }
 
 #  if ENABLE_FEATURE_EDITING_SAVE_ON_EXIT
 void save_history(line_input_t *st)
 {
 	FILE *fp;
+	int fd;
 
 	if (!st || !st->hist_file)
 		return;
 	if (st->cnt_history <= st->cnt_history_in_file)
 		return;
 
-	fp = fopen(st->hist_file, "a");
-	if (fp) {
-		int i, fd;
-		char *new_name;
+	fd = open(st->hist_file, O_WRONLY | O_CREAT | O_APPEND, 0600);
+	if (fd >= 0) {
+		int i;
+		size_t len;
+		char *buf, *new_name;
 		line_input_t *st_temp;
 
+		/* append all new lines as one record with a single write(),
+		 * so that concurrently exiting shells do not interleave them */
+		len = 0;
 		for (i = st->cnt_history_in_file; i < st->cnt_history; i++)
-			fprintf(fp, "%s\n", st->history[i]);
-		fclose(fp);
+			len += strlen(st->history[i]) + 1;
+		buf = xmalloc(len);
+		len = 0;
+		for (i = st->cnt_history_in_file; i < st->cnt_history; i++) {
+			len = stpcpy(buf + len, st->history[i]) - buf;
+			buf[len++] = '\n';
+		}
+		full_write(fd, buf, len);
+		free(buf);
+		close(fd);
 
 		/* we may have concurrently written entries from others.
 		 * load them */
@@ -1669,8 +1749,10 @@ static void remember_in_history(char *str)
 	/* we need to keep history[state->max_history] empty, hence >=, not > */
 	if (i >= state->max_history) {
 		free(state->history[0]);
-		for (i = 0; i < state->max_history-1; i++)
+		for (i = 0; i < state->max_history-1; i++) {
 			state->history[i] = state->history[i+1];
+			IF_FEATURE_REVERSE_SEARCH_INDEX(state->history_sig[i] = state->history_sig[i+1];)
+		}
 		/* i == state->max_history-1 */
 # if ENABLE_FEATURE_EDITING_SAVE_ON_EXIT
 		if (state->cnt_history_in_file)
@@ -1678,7 +1760,9 @@ static void remember_in_history(char *str)
 # endif
 	}
 	/* i <= state->max_history-1 */
-	state->history[i++] = xstrdup(str);
+	state->history[i] = xstrdup(str);
+	update_history_sig(state, i);
+	i++;
 	/* i <= state->max_history */
 	state->cur_history = i;
 	state->cnt_history = i;
@@ -2322,6 +2406,7 @@ static int32_t reverse_i_search(int timeout)
 	const char *saved_prompt;
 	unsigned saved_prmt_len;
 	int32_t ic;
+	IF_FEATURE_REVERSE_SEARCH_INDEX(uint64_t match_sig;)
 
 	matched_history_line = NULL;
 	read_key_buffer[0] = 0;
@@ -2388,11 +2473,16 @@ static int32_t reverse_i_search(int timeout)
 		} /* switch (ic) */
 
 		/* Search in history for match_buf */
+		IF_FEATURE_REVERSE_SEARCH_INDEX(match_sig = history_sig(match_buf);)
 		h = state->cur_history;
 		if (ic == CTRL('R'))
 			h--;
 		while (h >= 0) {
-			if (state->history[h]) {
+			if (state->history[h]
+# if ENABLE_FEATURE_REVERSE_SEARCH_INDEX
+			 && (state->history_sig[h] & match_sig) == match_sig
+# endif
+			) {
 				char *match = strstr(state->history[h], match_buf);
 				if (match) {
 					state->cur_history = h;
@@ -81,6 +81,151 @@ static int read_to_buf(const char *filename, void *buf)
 	return ret;
 }
 
+#if ENABLE_FEATURE_TOP_CACHE
+/* Per-pid state kept between scans. We keep /proc/PID/stat open
+ * and pread() it, and remember cmdline until start_time changes
+ * (that is, until pid is reused).
+ */
+struct procps_rec {
+	struct procps_rec *next;
+	unsigned pid;
+	unsigned gen;
+	int stat_fd;
+	unsigned long start_time;
+	char *cmdline; /* NULL if not read yet */
+	unsigned cmdline_len;
+};
+
+struct procps_cache {
+	struct procps_rec **bucket;
+	unsigned nbuckets; /* power of 2 */
+	unsigned count;
+	unsigned gen;
+	unsigned nfds, max_fds;
+};
+
+struct procps_cache* FAST_FUNC procps_cache_new(void)
+{
+	struct procps_cache *pc = xzalloc(sizeof(*pc));
+	struct rlimit rl;
+
+	pc->nbuckets = 256;
+	pc->bucket = xzalloc(pc->nbuckets * sizeof(pc->bucket[0]));
+
+	/* Thousands of processes need thousands of fds */
+	getrlimit(RLIMIT_NOFILE, &rl);
+	if (rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+	}
+	/* Leave some for opendir, smaps and the like */
+	if (rl.rlim_cur > 64)
+		pc->max_fds = MIN(rl.rlim_cur, INT_MAX) - 64;
+	return pc;
+}
+
+static void free_rec(struct procps_cache *pc, struct procps_rec *r)
+{
+	if (r->stat_fd >= 0) {
+		close(r->stat_fd);
+		pc->nfds--;
+	}
+	free(r->cmdline);
+	free(r);
+	pc->count--;
+}
+
+/* Free records for pids not seen in the last scan */
+static void sweep_cache(struct procps_cache *pc, int all)
+{
+	unsigned i;
+
+	for (i = 0; i < pc->nbuckets; i++) {
+		struct procps_rec *r, **pp = &pc->bucket[i];
+		while ((r = *pp) != NULL) {
+			if (all || r->gen != pc->gen) {
+				*pp = r->next;
+				free_rec(pc, r);
+				continue;
+			}
+			pp = &r->next;
+		}
+	}
+}
+
+void FAST_FUNC procps_cache_free(struct procps_cache *pc)
+{
+	sweep_cache(pc, 1);
+	free(pc->bucket);
+	free(pc);
+}
+
+static struct procps_rec *get_rec(struct procps_cache *pc, unsigned pid)
+{
+	struct procps_rec *r, **pp;
+
+	if (pc->count > pc->nbuckets * 2) {
+		/* Grow the table */
+		unsigned i, n = pc->nbuckets * 4;
+		struct procps_rec **b = xzalloc(n * sizeof(b[0]));
+		for (i = 0; i < pc->nbuckets; i++) {
+			while ((r = pc->bucket[i]) != NULL) {
+				pc->bucket[i] = r->next;
+				pp = &b[r->pid & (n - 1)];
+				r->next = *pp;
+				*pp = r;
+			}
+		}
+		free(pc->bucket);
+		pc->bucket = b;
+		pc->nbuckets = n;
+	}
+
+	pp = &pc->bucket[pid & (pc->nbuckets - 1)];
+	for (r = *pp; r; r = r->next) {
+		if (r->pid == pid)
+			goto found;
+	}
+	r = xzalloc(sizeof(*r));
+	r->pid = pid;
+	r->stat_fd = -1;
+	r->next = *pp;
+	*pp = r;
+	pc->count++;
+ found:
+	r->gen = pc->gen;
+	return r;
+}
+
+static int read_stat_cached(struct procps_cache *pc, struct procps_rec *r,
+		const char *filename, char *buf)
+{
+	ssize_t ret;
+
+	if (r->stat_fd >= 0) {
+		ret = pread(r->stat_fd, buf, PROCPS_BUFSIZE-1, 0);
+		if (ret > 0)
+			goto ret;
+		/* Process exited. Maybe there is a new one with this pid */
+		close(r->stat_fd);
+		r->stat_fd = -1;
+		pc->nfds--;
+	}
+	if (pc->nfds >= pc->max_fds)
+		return read_to_buf(filename, buf);
+	ret = -1;
+	r->stat_fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (r->stat_fd >= 0) {
+		pc->nfds++;
+		ret = pread(r->stat_fd, buf, PROCPS_BUFSIZE-1, 0);
+	}
+ ret:
+	buf[ret > 0 ? ret : 0] = '\0';
+	return ret;
+}
+#endif
+
 static procps_status_t* FAST_FUNC alloc_procps_scan(void)
 {
 	procps_status_t* sp = xzalloc(sizeof(procps_status_t));
@@ -285,6 +430,7 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 		sp = alloc_procps_scan();
 
 	for (;;) {
+		IF_FEATURE_TOP_CACHE(struct procps_rec *rec = NULL;)
 		struct dirent *entry;
 		char buf[PROCPS_BUFSIZE];
 		long tasknice;
@@ -304,6 +450,10 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 #endif
 		entry = readdir(sp->dir);
 		if (entry == NULL) {
+#if ENABLE_FEATURE_TOP_CACHE
+			if (sp->cache)
+				sweep_cache(sp->cache, 0);
+#endif
 			free_procps_scan(sp);
 			return NULL;
 		}
@@ -334,6 +484,10 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 		sp->pid = pid;
 		if (!(flags & ~PSSCAN_PID))
 			break; /* we needed only pid, we got it */
+#if ENABLE_FEATURE_TOP_CACHE
+		if (sp->cache)
+			rec = get_rec(sp->cache, pid);
+#endif
 
 #if ENABLE_SELINUX
 		if (flags & PSSCAN_CONTEXT) {
@@ -374,7 +528,12 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 #endif
 			/* see proc(5) for some details on this */
 			strcpy(filename_tail, "stat");
-			n = read_to_buf(filename, buf);
+#if ENABLE_FEATURE_TOP_CACHE
+			if (rec)
+				n = read_stat_cached(sp->cache, rec, filename, buf);
+			else
+#endif
+				n = read_to_buf(filename, buf);
 			if (n < 0)
 				continue; /* process probably exited */
 			cp = strrchr(buf, ')'); /* split into "PID (cmd" and "<rest>" */
@@ -479,6 +638,14 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 				else /* > 0 */
 					sp->state[s_idx] = 'N';
 			}
+#if ENABLE_FEATURE_TOP_CACHE
+			if (rec && rec->start_time != sp->start_time) {
+				/* New process, forget the old one's cmdline */
+				rec->start_time = sp->start_time;
+				free(rec->cmdline);
+				rec->cmdline = NULL;
+			}
+#endif
 		}
 
 #if ENABLE_FEATURE_TOPMEM
@@ -547,7 +714,21 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 			free(sp->argv0);
 			sp->argv0 = NULL;
 			strcpy(filename_tail, "cmdline");
-			n = read_to_buf(filename, buf);
+#if ENABLE_FEATURE_TOP_CACHE
+			if (rec && rec->cmdline) {
+				n = rec->cmdline_len;
+				memcpy(buf, rec->cmdline, n + 1);
+			} else
+#endif
+			{
+				n = read_to_buf(filename, buf);
+#if ENABLE_FEATURE_TOP_CACHE
+				if (rec && n >= 0) {
+					rec->cmdline = xmemdup(buf, n + 1);
+					rec->cmdline_len = n;
+				}
+#endif
+			}
 			if (n <= 0)
 				break;
 			if (flags & PSSCAN_ARGVN) {
@@ -566,6 +747,21 @@ procps_status_t* FAST_FUNC procps_scan(procps_status_t* sp, int flags)
 	return sp;
 }
 
+#if ENABLE_FEATURE_TOP_CACHE
+procps_status_t* FAST_FUNC procps_scan_cached(procps_status_t* sp, struct procps_cache *pc, int flags)
+{
+	if (!sp) {
+		sp = alloc_procps_scan();
+		sp->cache = pc;
+		pc->gen++;
+	}
+	/* Need start_time to know when cached cmdline is stale */
+	if (flags & (PSSCAN_ARGV0|PSSCAN_ARGVN))
+		flags |= PSSCAN_START_TIME;
+	return procps_scan(sp, flags);
+}
+#endif
+
 void FAST_FUNC read_cmdline(char *buf, int col, unsigned pid, const char *comm)
 {
 	int sz;
@@ -276,6 +276,11 @@ typedef struct BcNum {
 #define BC_NUM_DEF_SIZE         16
 #define BC_NUM_PRINT_WIDTH      70
 
+// Multiplication and division pack digits into base 10^9 limbs
+typedef uint32_t BcLimb;
+#define BC_LIMB_DIGS            9
+#define BC_LIMB_BASE            1000000000
+// in limbs:
 #define BC_NUM_KARATSUBA_LEN    32
 
 typedef enum BcInst {
@@ -1591,25 +1596,6 @@ static void bc_num_retireMul(BcNum *n, size_t scale, bool neg1, bool neg2)
 	if (n->len != 0) n->neg = !neg1 != !neg2;
 }
 
-static void bc_num_split(BcNum *restrict n, size_t idx, BcNum *restrict a,
-                         BcNum *restrict b)
-{
-	if (idx < n->len) {
-		b->len = n->len - idx;
-		a->len = idx;
-		a->rdx = b->rdx = 0;
-
-		memcpy(b->num, n->num + idx, b->len * sizeof(BcDig));
-		memcpy(a->num, n->num, idx * sizeof(BcDig));
-	} else {
-		bc_num_zero(b);
-		bc_num_copy(a, n);
-	}
-
-	bc_num_clean(a);
-	bc_num_clean(b);
-}
-
 static BC_STATUS zbc_num_shift(BcNum *n, size_t places)
 {
 	if (places == 0 || n->len == 0) RETURN_STATUS(BC_STATUS_SUCCESS);
@@ -1871,113 +1857,269 @@ static FAST_FUNC BC_STATUS zbc_num_s(BcNum *a, BcNum *b, BcNum *restrict c, size
 	RETURN_STATUS(BC_STATUS_SUCCESS); // can't make void, see zbc_num_binary()
 }
 
-static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
-                         BcNum *restrict c)
-#define zbc_num_k(...) (zbc_num_k(__VA_ARGS__) COMMA_SUCCESS)
+static size_t bc_limb_pack(BcLimb *l, const BcDig *d, size_t len)
 {
-	BcStatus s;
-	size_t max, max2;
-	BcNum l1, h1, l2, h2, m2, m1, z0, z1, z2, temp;
-	bool aone;
+	size_t i, n = 0;
 
-	if (a->len == 0 || b->len == 0) {
-		bc_num_zero(c);
-		RETURN_STATUS(BC_STATUS_SUCCESS);
+	for (i = 0; i < len; i += BC_LIMB_DIGS) {
+		size_t k = BC_MIN(len - i, BC_LIMB_DIGS);
+		BcLimb v = 0;
+		while (k != 0)
+			v = v * 10 + d[i + --k];
+		l[n++] = v;
 	}
-	aone = BC_NUM_ONE(a);
-	if (aone || BC_NUM_ONE(b)) {
-		bc_num_copy(c, aone ? b : a);
-		RETURN_STATUS(BC_STATUS_SUCCESS);
+	return n;
+}
+
+static void bc_limb_unpack(BcDig *d, const BcLimb *l, size_t n)
+{
+	while (n-- != 0) {
+		BcLimb v = *l++;
+		unsigned k;
+		for (k = 0; k < BC_LIMB_DIGS; ++k) {
+			*d++ = (BcDig)(v % 10);
+			v /= 10;
+		}
 	}
+}
 
-	if (a->len < BC_NUM_KARATSUBA_LEN
-	 || b->len < BC_NUM_KARATSUBA_LEN
-	/* || a->len + b->len < BC_NUM_KARATSUBA_LEN - redundant check */
-	) {
-		size_t i, j, len;
+// r += x. The caller guarantees that r has room for the carry.
+static void bc_limb_addto(BcLimb *r, const BcLimb *x, size_t n)
+{
+	unsigned carry = 0;
+	size_t i;
 
-		bc_num_expand(c, a->len + b->len + 1);
+	for (i = 0; i < n || carry; ++i) {
+		BcLimb t = r[i] + carry;
+		if (i < n)
+			t += x[i];
+		carry = (t >= BC_LIMB_BASE);
+		if (carry)
+			t -= BC_LIMB_BASE;
+		r[i] = t;
+	}
+}
 
-		memset(c->num, 0, sizeof(BcDig) * c->cap);
-		c->len = len = 0;
+// r -= x. The caller guarantees that r >= x.
+static void bc_limb_subfrom(BcLimb *r, const BcLimb *x, size_t n)
+{
+	unsigned borrow = 0;
+	size_t i;
 
-		for (i = 0; i < b->len; ++i) {
-			unsigned carry = 0;
-			for (j = 0; j < a->len; ++j) {
-				unsigned in = c->num[i + j];
-				in += (unsigned)a->num[j] * (unsigned)b->num[i] + carry;
-				// note: compilers prefer _unsigned_ div/const
-				carry = in / 10;
-				c->num[i + j] = (BcDig)(in % 10);
-			}
+	for (i = 0; i < n || borrow; ++i) {
+		BcLimb t = borrow;
+		if (i < n)
+			t += x[i];
+		borrow = (r[i] < t);
+		r[i] = r[i] - t + (borrow ? BC_LIMB_BASE : 0);
+	}
+}
 
-			c->num[i + j] += (BcDig) carry;
-			len = BC_MAX(len, i + j + !!carry);
+static BcLimb bc_limb_mul1(BcLimb *x, size_t n, BcLimb m)
+{
+	BcLimb carry = 0;
+	size_t i;
 
+	for (i = 0; i < n; ++i) {
+		uint64_t t = (uint64_t)x[i] * m + carry;
+		carry = t / BC_LIMB_BASE;
+		x[i] = t - (uint64_t)carry * BC_LIMB_BASE;
+	}
+	return carry;
+}
+
+// c[0..an+bn) = a * b
+static void bc_limb_mul(BcLimb *restrict c, const BcLimb *a, size_t an,
+                        const BcLimb *b, size_t bn)
+{
+	BcLimb *sa, *sb, *z1;
+	size_t i, h, sn, tn, zn;
+
+	if (an < bn) {
+		const BcLimb *t = a;
+		a = b;
+		b = t;
+		i = an;
+		an = bn;
+		bn = i;
+	}
+
+	if (bn < BC_NUM_KARATSUBA_LEN) {
+		memset(c, 0, (an + bn) * sizeof(BcLimb));
+		for (i = 0; i < bn; ++i) {
+			BcLimb carry = 0, bi = b[i];
+			size_t j;
+			for (j = 0; j < an; ++j) {
+				uint64_t t = (uint64_t)a[j] * bi + c[i + j] + carry;
+				carry = t / BC_LIMB_BASE;
+				c[i + j] = t - (uint64_t)carry * BC_LIMB_BASE;
+			}
+			c[i + an] = carry;
 #if ENABLE_FEATURE_BC_INTERACTIVE
 			// a=2^1000000
 			// a*a <- without check below, this will not be interruptible
-			if (G_interrupt) return BC_STATUS_FAILURE;
+			if (G_interrupt) return;
 #endif
 		}
+		return;
+	}
 
-		c->len = len;
+	if (an >= 2 * bn) {
+		// Lopsided: multiply b by bn-sized slices of a
+		z1 = xmalloc(2 * bn * sizeof(BcLimb));
+		memset(c, 0, (an + bn) * sizeof(BcLimb));
+		for (i = 0; i < an; i += bn) {
+			size_t k = BC_MIN(bn, an - i);
+			bc_limb_mul(z1, a + i, k, b, bn);
+			bc_limb_addto(c + i, z1, k + bn);
+		}
+		free(z1);
+		return;
+	}
 
-		RETURN_STATUS(BC_STATUS_SUCCESS);
+	// Karatsuba: a = a1*B^h + a0, b = b1*B^h + b0, both b1 and b0 nonempty.
+	// z0 = a0*b0 and z2 = a1*b1 go straight into c,
+	// z1 = (a0+a1)*(b0+b1) - z0 - z2 is then added at B^h.
+	h = an / 2;
+	sn = an - h + 1;
+	tn = BC_MAX(h, bn - h) + 1;
+	sa = xzalloc((sn + tn) * 2 * sizeof(BcLimb));
+	sb = sa + sn;
+	z1 = sb + tn;
+
+	memcpy(sa, a + h, (an - h) * sizeof(BcLimb));
+	bc_limb_addto(sa, a, h);
+	if (bn - h >= h) {
+		memcpy(sb, b + h, (bn - h) * sizeof(BcLimb));
+		bc_limb_addto(sb, b, h);
+	} else {
+		memcpy(sb, b, h * sizeof(BcLimb));
+		bc_limb_addto(sb, b + h, bn - h);
 	}
 
-	max = BC_MAX(a->len, b->len);
-	bc_num_init(&l1, max);
-	bc_num_init(&h1, max);
-	bc_num_init(&l2, max);
-	bc_num_init(&h2, max);
-	bc_num_init(&m1, max);
-	bc_num_init(&m2, max);
-	bc_num_init(&z0, max);
-	bc_num_init(&z1, max);
-	bc_num_init(&z2, max);
-	bc_num_init(&temp, max + max);
+	bc_limb_mul(c, a, h, b, h);
+	bc_limb_mul(c + 2 * h, a + h, an - h, b + h, bn - h);
+	bc_limb_mul(z1, sa, sn, sb, tn);
+	if (!G_interrupt) { // partial products can't be subtracted
+		bc_limb_subfrom(z1, c, 2 * h);
+		bc_limb_subfrom(z1, c + 2 * h, an + bn - 2 * h);
+		zn = sn + tn;
+		while (zn != 0 && z1[zn - 1] == 0)
+			zn--;
+		bc_limb_addto(c + h, z1, zn);
+	}
+	free(sa);
+}
 
-	max2 = (max + 1) / 2;
-	bc_num_split(a, max2, &l1, &h1);
-	bc_num_split(b, max2, &l2, &h2);
+// q[0..nu-nv] = u / v, nu >= nv, v[nv-1] != 0.
+// Clobbers u (which needs room for nu+1 limbs) and v.
+// Knuth's Algorithm D, TAOCP vol.2 4.3.1
+static void bc_limb_div(BcLimb *restrict q, BcLimb *restrict u, size_t nu,
+                        BcLimb *restrict v, size_t nv)
+{
+	BcLimb d, vh, vl;
+	size_t i, j;
 
-	s = zbc_num_add(&h1, &l1, &m1, 0);
-	if (s) goto err;
-	s = zbc_num_add(&h2, &l2, &m2, 0);
-	if (s) goto err;
+	if (nv == 1) {
+		uint64_t r = 0;
+		for (j = nu; j-- != 0;) {
+			r = r * BC_LIMB_BASE + u[j];
+			q[j] = r / v[0];
+			r %= v[0];
+		}
+		return;
+	}
 
-	s = zbc_num_k(&h1, &h2, &z0);
-	if (s) goto err;
-	s = zbc_num_k(&m1, &m2, &z1);
-	if (s) goto err;
-	s = zbc_num_k(&l1, &l2, &z2);
-	if (s) goto err;
+	// Normalize so that the top limb of v is >= BASE/2
+	d = BC_LIMB_BASE / (v[nv - 1] + 1);
+	u[nu] = bc_limb_mul1(u, nu, d);
+	bc_limb_mul1(v, nv, d);
+	vh = v[nv - 1];
+	vl = v[nv - 2];
 
-	s = zbc_num_sub(&z1, &z0, &temp, 0);
-	if (s) goto err;
-	s = zbc_num_sub(&temp, &z2, &z1, 0);
-	if (s) goto err;
+	for (j = nu - nv + 1; j-- != 0;) {
+		BcLimb *uj = u + j;
+		uint64_t qh, rh;
+		BcLimb carry, borrow, t;
 
-	s = zbc_num_shift(&z0, max2 * 2);
-	if (s) goto err;
-	s = zbc_num_shift(&z1, max2);
-	if (s) goto err;
-	s = zbc_num_add(&z0, &z1, &temp, 0);
-	if (s) goto err;
-	s = zbc_num_add(&temp, &z2, c, 0);
- err:
-	bc_num_free(&temp);
-	bc_num_free(&z2);
-	bc_num_free(&z1);
-	bc_num_free(&z0);
-	bc_num_free(&m2);
-	bc_num_free(&m1);
-	bc_num_free(&h2);
-	bc_num_free(&l2);
-	bc_num_free(&h1);
-	bc_num_free(&l1);
-	RETURN_STATUS(s);
+		qh = (uint64_t)uj[nv] * BC_LIMB_BASE + uj[nv - 1];
+		rh = qh % vh;
+		qh /= vh;
+		while (qh >= BC_LIMB_BASE
+		 || qh * vl > rh * BC_LIMB_BASE + uj[nv - 2]
+		) {
+			qh--;
+			rh += vh;
+			if (rh >= BC_LIMB_BASE)
+				break;
+		}
+
+		carry = borrow = 0;
+		for (i = 0; i < nv; ++i) {
+			uint64_t p = qh * v[i] + carry;
+			carry = p / BC_LIMB_BASE;
+			t = p - (uint64_t)carry * BC_LIMB_BASE + borrow;
+			borrow = (uj[i] < t);
+			uj[i] = uj[i] - t + (borrow ? BC_LIMB_BASE : 0);
+		}
+		if (uj[nv] < carry + borrow) {
+			// qh was one too large (rare): add v back
+			qh--;
+			uj[nv] = 0; // receives the carry that cancels the borrow
+			bc_limb_addto(uj, v, nv);
+		}
+		uj[nv] = 0;
+		q[j] = qh;
+#if ENABLE_FEATURE_BC_INTERACTIVE
+		// a=2^100000
+		// scale=40000
+		// 1/a <- without check below, this will not be interruptible
+		if (G_interrupt) return;
+#endif
+	}
+}
+
+static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
+                         BcNum *restrict c)
+#define zbc_num_k(...) (zbc_num_k(__VA_ARGS__) COMMA_SUCCESS)
+{
+	BcLimb *la, *lb, *lc;
+	size_t na, nb, len;
+	bool aone;
+
+	if (a->len == 0 || b->len == 0) {
+		bc_num_zero(c);
+		RETURN_STATUS(BC_STATUS_SUCCESS);
+	}
+	aone = BC_NUM_ONE(a);
+	if (aone || BC_NUM_ONE(b)) {
+		bc_num_copy(c, aone ? b : a);
+		RETURN_STATUS(BC_STATUS_SUCCESS);
+	}
+
+	na = (a->len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+	nb = (b->len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+	la = xmalloc((na + nb) * 2 * sizeof(BcLimb));
+	lb = la + na;
+	lc = lb + nb;
+	bc_limb_pack(la, a->num, a->len);
+	bc_limb_pack(lb, b->num, b->len);
+	bc_limb_mul(lc, la, na, lb, nb);
+
+	len = (na + nb) * BC_LIMB_DIGS;
+	bc_num_expand(c, len);
+	bc_limb_unpack(c->num, lc, na + nb);
+	free(la);
+	while (len != 0 && c->num[len - 1] == 0)
+		len--;
+	c->len = len;
+	c->rdx = 0;
+	c->neg = false;
+
+#if ENABLE_FEATURE_BC_INTERACTIVE
+	if (G_interrupt) return BC_STATUS_FAILURE;
+#endif
+	RETURN_STATUS(BC_STATUS_SUCCESS);
 }
 
 static FAST_FUNC BC_STATUS zbc_num_m(BcNum *a, BcNum *b, BcNum *restrict c, size_t scale)
@@ -2022,7 +2164,8 @@ static FAST_FUNC BC_STATUS zbc_num_m(BcNum *a, BcNum *b, BcNum *restrict c, size
 static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size_t scale)
 {
 	BcStatus s;
-	size_t len, end, i;
+	BcLimb *u, *v, *q;
+	size_t len, nu, nv, nq;
 	BcNum cp;
 
 	if (b->len == 0)
@@ -2060,36 +2203,29 @@ static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size
 		len++;
 	}
 
-	if (cp.cap == cp.len) bc_num_expand(&cp, cp.len + 1);
-
-	// We want an extra zero in front to make things simpler.
-	cp.num[cp.len++] = 0;
-	end = cp.len - len;
-
-	bc_num_expand(c, cp.len);
+	nu = (cp.len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+	nv = (len + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS;
+	u = xmalloc((nu + 1 + nv + nu) * sizeof(BcLimb));
+	v = u + nu + 1;
+	q = v + nv;
+	bc_limb_pack(u, cp.num, cp.len);
+	bc_limb_pack(v, b->num, len);
+	nq = 0;
+	if (nu >= nv) {
+		nq = nu - nv + 1;
+		bc_limb_div(q, u, nu, v, nv);
+	}
 
-	bc_num_zero(c);
-	memset(c->num + end, 0, (c->cap - end) * sizeof(BcDig));
+	bc_num_expand(c, BC_MAX(cp.len, nq * BC_LIMB_DIGS));
+	memset(c->num, 0, c->cap * sizeof(BcDig));
+	bc_limb_unpack(c->num, q, nq);
 	c->rdx = cp.rdx;
 	c->len = cp.len;
+	free(u);
 
 	s = BC_STATUS_SUCCESS;
-	for (i = end - 1; i < end; --i) {
-		BcDig *n, q;
-		n = cp.num + i;
-		for (q = 0; n[len] != 0 || bc_num_compare(n, b->num, len) >= 0; ++q)
-			bc_num_subArrays(n, b->num, len);
-		c->num[i] = q;
-#if ENABLE_FEATURE_BC_INTERACTIVE
-		// a=2^100000
-		// scale=40000
-		// 1/a <- without check below, this will not be interruptible
-		if (G_interrupt) {
-			s = BC_STATUS_FAILURE;
-			break;
-		}
-#endif
-	}
+	if (G_interrupt)
+		s = BC_STATUS_FAILURE;
 
 	bc_num_retireMul(c, scale, a->neg, b->neg);
 	bc_num_free(&cp);
@@ -31,6 +31,18 @@
 //config:	default 9999999
 //config:	depends on LESS
 //config:
+//config:config FEATURE_LESS_INDEX
+//config:	bool "Page through large files without reading them whole"
+//config:	default y
+//config:	depends on LESS
+//config:	help
+//config:	Regular files of 8 MB and more are not read into memory
+//config:	as a whole. Only a window of lines around the screen is kept,
+//config:	plus the offset of every 256th line. Jumps to the end
+//config:	or to N percent seek there directly. Line numbers are
+//config:	then unknown until you go back to the top of the file
+//config:	or to a line by its number.
+//config:
 //config:config FEATURE_LESS_BRACKETS
 //config:	bool "Enable bracket searching"
 //config:	default y
@@ -166,6 +178,24 @@ enum {
 	MAXLINES = CONFIG_FEATURE_LESS_MAXLINES,
 /* This many "after the end" lines we will show (at max) */
 	TILDES = 1,
+#if ENABLE_FEATURE_LESS_INDEX
+/* Regular files this big are paged through a window of flines[] */
+	INDEX_MIN_SIZE = 8 * 1024 * 1024,
+/* line_index[] has the start of every INDEX_STEP'th line */
+	INDEX_STEP = 256,
+/* Window is trimmed when it grows this big (in flines)... */
+	WINDOW_LINES = 4096,
+/* ...keeping this many lines above the screen */
+	BACK_LINES = 1024,
+/* Line numbers after a jump by file offset start here */
+	UNKNOWN_LINENO = 0x40000000,
+#endif
+#if ENABLE_FEATURE_LESS_REGEXP
+/* Search runs between keypresses, this many lines at a time... */
+	SEARCH_LINES = 1024,
+/* ...or this many bytes of an indexed file */
+	SEARCH_BYTES = 64 * 1024,
+#endif
 };
 
 /* Command line options */
@@ -220,12 +250,26 @@ struct globals {
 #if ENABLE_FEATURE_LESS_MARKS
 	unsigned num_marks;
 	unsigned mark_lines[15][2];
+# if ENABLE_FEATURE_LESS_INDEX
+	/* In an indexed file, marks are line offsets: flines[] indexes
+	 * do not survive the window moving */
+	off_t mark_ofs[15];
+# endif
 #endif
 #if ENABLE_FEATURE_LESS_REGEXP
-	unsigned *match_lines;
+	/* Matches are numbered from where the search started:
+	 * match_lines[0][] are after it, match_lines[1][] before it,
+	 * nearest first. They are flines[] indexes, or line offsets
+	 * in an indexed file */
+	off_t *match_lines[2];
+	int num_matches[2];
 	int match_pos; /* signed! */
 	int wanted_match; /* signed! */
-	int num_matches;
+	off_t scan_fwd; /* next position to search forward */
+	off_t scan_back; /* position backward search has reached */
+	unsigned search_ms; /* when progress was shown */
+	unsigned read_more; /* lines read_lines() reads for search_step() */
+	smallint searching; /* going to wanted_match once it is found */
 	regex_t pattern;
 	smallint pattern_valid;
 #endif
@@ -234,6 +278,17 @@ struct globals {
 #endif
 #if ENABLE_FEATURE_LESS_ASK_TERMINAL
 	smallint winsize_err;
+#endif
+#if ENABLE_FEATURE_LESS_INDEX
+	smallint indexed;
+	smallint lineno_unknown;
+	smallint index_eof; /* line_index[] covers the whole file */
+	unsigned win_lineno; /* LINENO of flines[0] */
+	unsigned index_count;
+	off_t read_ofs; /* file offset of readbuf[0] */
+	off_t file_size;
+	off_t *win_ofs; /* offsets of the lines in flines[], by LINENO */
+	off_t *line_index; /* offsets of every INDEX_STEP'th line */
 #endif
 	smallint terminated;
 	struct termios term_orig, term_less;
@@ -283,7 +338,6 @@ struct globals {
 	current_file = 1; \
 	eof_error = 1; \
 	terminated = 1; \
-	IF_FEATURE_LESS_REGEXP(wanted_match = -1;) \
 } while (0)
 
 /* flines[] are lines read from stdin, each in malloc'ed buffer.
@@ -427,12 +481,6 @@ static void re_wrap(void)
 }
 #endif
 
-#if ENABLE_FEATURE_LESS_REGEXP
-static void fill_match_lines(unsigned pos);
-#else
-#define fill_match_lines(pos) ((void)0)
-#endif
-
 static int at_end(void)
 {
 	return (option_mask32 & FLAG_S)
@@ -441,6 +489,51 @@ static int at_end(void)
 		: !(max_fline > cur_fline + max_displayed_line);
 }
 
+#if ENABLE_FEATURE_LESS_INDEX
+/* Large regular files are paged through a window: flines[] holds
+ * only the lines near the screen, win_ofs[] says where each of them
+ * starts in the file. Lines which scroll far above the screen
+ * are dropped, and read again from the file when we go back.
+ */
+static void index_line_start(void)
+{
+	unsigned n = max_lineno - G.win_lineno;
+	off_t ofs = G.read_ofs + readpos;
+
+	G.win_ofs = xrealloc_vector(G.win_ofs, 8, n);
+	G.win_ofs[n] = ofs;
+	if (!G.lineno_unknown && max_lineno == G.index_count * INDEX_STEP) {
+		G.line_index = xrealloc_vector(G.line_index, 8, G.index_count);
+		G.line_index[G.index_count++] = ofs;
+	}
+}
+
+/* Drop lines far above cur_fline. Called after a line is terminated */
+static void index_trim(void)
+{
+	unsigned i, k, n;
+
+	k = MIN((unsigned)cur_fline, max_fline);
+	if (max_fline < WINDOW_LINES || k <= BACK_LINES)
+		return;
+	k -= BACK_LINES;
+	/* don't split a wrapped line */
+	while (k && LINENO(flines[k]) == LINENO(flines[k - 1]))
+		k--;
+	if (!k)
+		return;
+
+	for (i = 0; i < k; i++)
+		free(MEMPTR(flines[i]));
+	max_fline -= k;
+	cur_fline -= k;
+	memmove(flines, flines + k, (max_fline + 1) * sizeof(flines[0]));
+	n = LINENO(flines[0]) - G.win_lineno;
+	G.win_lineno += n;
+	memmove(G.win_ofs, G.win_ofs + n, (max_lineno - G.win_lineno) * sizeof(G.win_ofs[0]));
+}
+#endif
+
 /* Devilishly complex routine.
  *
  * Has to deal with EOF and EPIPE on input,
@@ -474,9 +567,6 @@ static void read_lines(void)
 	char last_terminated = terminated;
 	time_t last_time = 0;
 	int retry_EAGAIN = 2;
-#if ENABLE_FEATURE_LESS_REGEXP
-	unsigned old_max_fline = max_fline;
-#endif
 
 #define readbuf bb_common_bufsiz1
 	setup_common_bufsiz();
@@ -497,9 +587,10 @@ static void read_lines(void)
 	} else {
 		max_fline++;
 		last_line_pos = 0;
+		IF_FEATURE_LESS_INDEX(if (G.indexed) index_line_start();)
 	}
 
-	while (1) { /* read lines until we reach cur_fline or wanted_match */
+	while (1) { /* read lines until we reach cur_fline */
 		*p = '\0';
 		terminated = 0;
 		while (1) { /* read chars until we have a line */
@@ -508,6 +599,10 @@ static void read_lines(void)
 			if (readpos >= readeof) {
 				int flags = ndelay_on(0);
 
+#if ENABLE_FEATURE_LESS_INDEX
+				if (readeof > 0)
+					G.read_ofs += readeof;
+#endif
 				while (1) {
 					time_t t;
 
@@ -604,6 +699,10 @@ static void read_lines(void)
 		LINENO(flines[max_fline]) = max_lineno;
 		if (terminated)
 			max_lineno++;
+#if ENABLE_FEATURE_LESS_INDEX
+		if (G.indexed && terminated)
+			index_trim();
+#endif
 
 		if (max_fline >= MAXLINES) {
 			eof_error = 0; /* Pretend we saw EOF */
@@ -613,12 +712,10 @@ static void read_lines(void)
 #if !ENABLE_FEATURE_LESS_REGEXP
 			break;
 #else
-			if (wanted_match >= num_matches) { /* goto_match called us */
-				fill_match_lines(old_max_fline);
-				old_max_fline = max_fline;
-			}
-			if (wanted_match < num_matches)
+			/* search_step() wants more lines? */
+			if (G.read_more == 0)
 				break;
+			G.read_more--;
 #endif
 		}
 		if (eof_error <= 0) {
@@ -628,6 +725,7 @@ static void read_lines(void)
 		current_line = ((char*)xmalloc(w + 5)) + 4;
 		p = current_line;
 		last_line_pos = 0;
+		IF_FEATURE_LESS_INDEX(if (G.indexed && last_terminated) index_line_start();)
 	} /* end of "read lines until we reach cur_fline" loop */
 
 	if (eof_error < 0) {
@@ -637,19 +735,146 @@ static void read_lines(void)
 			print_statusline(bb_msg_read_error);
 		}
 	}
-#if ENABLE_FEATURE_LESS_FLAGS
-	else if (eof_error == 0)
-		num_lines = max_lineno;
-#endif
-
-	fill_match_lines(old_max_fline);
-#if ENABLE_FEATURE_LESS_REGEXP
-	/* prevent us from being stuck in search for a match */
-	wanted_match = -1;
-#endif
+	else if (eof_error == 0
+		IF_FEATURE_LESS_INDEX(&& !G.lineno_unknown)
+	) {
+		IF_FEATURE_LESS_INDEX(G.index_eof = G.indexed;)
+		IF_FEATURE_LESS_FLAGS(num_lines = max_lineno;)
+	}
 #undef readbuf
 }
 
+#if ENABLE_FEATURE_LESS_INDEX
+/* Start the window afresh at file offset ofs, and read a screenful */
+static void index_reset(off_t ofs, unsigned lineno, int known)
+{
+	unsigned i;
+
+	if (flines) {
+		for (i = 0; i <= max_fline; i++)
+			free(MEMPTR(flines[i]));
+		free(flines);
+		flines = NULL;
+	}
+	max_fline = -1;
+	cur_fline = 0;
+	max_lineno = G.win_lineno = lineno;
+	G.lineno_unknown = !known;
+	xlseek(STDIN_FILENO, ofs, SEEK_SET);
+	G.read_ofs = ofs;
+	readpos = 0;
+	readeof = 0;
+	last_line_pos = 0;
+	terminated = 1;
+	eof_error = 1;
+	IF_FEATURE_LESS_RAW(G.in_escape = 0;)
+	read_lines();
+}
+
+/* Count '\n's in [pos,end), or if cnt is NULL, find the first one.
+ * Returns the offset past the last '\n' seen (end if none) */
+static off_t index_scan(off_t pos, off_t end, unsigned *cnt)
+{
+	char buf[4096];
+
+	while (pos < end) {
+		ssize_t len = pread(STDIN_FILENO, buf, MIN(end - pos, (off_t)sizeof(buf)), pos);
+		char *p = buf;
+
+		if (len <= 0)
+			break;
+		while ((p = memchr(p, '\n', buf + len - p)) != NULL) {
+			p++;
+			if (!cnt)
+				return pos + (p - buf);
+			(*cnt)++;
+		}
+		pos += len;
+	}
+	return pos;
+}
+
+/* Find the start of the *n'th line before the line starting at front.
+ * If there are fewer lines, returns 0 and sets *n to their count */
+static off_t index_find_back(off_t front, unsigned *n)
+{
+	char buf[4096];
+	off_t pos = front;
+	unsigned seen = 0;
+
+	while (pos > 0) {
+		ssize_t len = MIN(pos, (off_t)sizeof(buf));
+
+		pos -= len;
+		if (pread(STDIN_FILENO, buf, len, pos) != len)
+			break;
+		while (--len >= 0) {
+			/* '\n' at front-1 ends the line before front */
+			if (buf[len] == '\n' && pos + len != front - 1) {
+				if (++seen == *n)
+					return pos + len + 1;
+			}
+		}
+	}
+	if (front)
+		seen++; /* the first line of the file */
+	*n = seen;
+	return 0;
+}
+
+# if ENABLE_FEATURE_LESS_FLAGS || ENABLE_FEATURE_LESS_MARKS
+static off_t index_line_ofs(int fline)
+{
+	if (fline > (int)max_fline)
+		fline = max_fline;
+	return G.win_ofs[LINENO(flines[fline]) - G.win_lineno];
+}
+# endif
+
+static void index_stat(void)
+{
+	struct stat st;
+
+	if (fstat(STDIN_FILENO, &st) == 0)
+		G.file_size = st.st_size;
+}
+
+/* Before going to a line by number: if the window is not on the way
+ * there, restart it from the nearest indexed line */
+static void index_goto_lineno(unsigned target)
+{
+	unsigned i = target / INDEX_STEP;
+
+	if (!G.indexed || !G.index_count)
+		return;
+	if (i >= G.index_count)
+		i = G.index_count - 1;
+	if (!G.lineno_unknown
+	 && target >= G.win_lineno
+	 && i * INDEX_STEP <= max_lineno
+	) {
+		return; /* reading on from the window is as good */
+	}
+	index_reset(G.line_index[i], i * INDEX_STEP, 1);
+}
+
+/* Put the window at the end of file */
+static void index_end(void)
+{
+	unsigned n = BACK_LINES;
+	off_t start;
+
+	if (G.index_eof) {
+		n = G.index_count - 1;
+		index_reset(G.line_index[n], n * INDEX_STEP, 1);
+		return;
+	}
+	index_stat();
+	start = index_find_back(G.file_size, &n);
+	index_reset(start, start ? UNKNOWN_LINENO : 0, !start);
+}
+#endif
+
 #if ENABLE_FEATURE_LESS_FLAGS
 static int safe_lineno(int fline)
 {
@@ -719,6 +944,11 @@ static void m_status_print(void)
 	last = (option_mask32 & FLAG_S)
 			? MIN(first + max_displayed_line, max_lineno)
 			: safe_lineno(cur_fline + max_displayed_line);
+#if ENABLE_FEATURE_LESS_INDEX
+	if (G.lineno_unknown)
+		printf(" byte %"OFF_FMT"u", index_line_ofs(cur_fline));
+	else
+#endif
 	printf(" lines %i-%i", first, last);
 
 	update_num_lines();
@@ -733,6 +963,12 @@ static void m_status_print(void)
 		percent = (100 * last + num_lines/2) / num_lines;
 		printf(" %i%%", percent <= 100 ? percent : 100);
 	}
+#if ENABLE_FEATURE_LESS_INDEX
+	else if (G.indexed && G.file_size) {
+		percent = index_line_ofs(cur_fline + max_displayed_line) * 100 / G.file_size;
+		printf(" %i%%", percent <= 100 ? percent : 100);
+	}
+#endif
 	printf(NORMAL);
 }
 #endif
@@ -741,6 +977,7 @@ static void m_status_print(void)
 static void status_print(void)
 {
 	const char *p;
+	int top = !cur_fline IF_FEATURE_LESS_INDEX(&& !G.win_lineno);
 
 	if (less_gets_pos >= 0) /* don't touch statusline while input is done! */
 		return;
@@ -755,12 +992,12 @@ static void status_print(void)
 #endif
 
 	clear_line();
-	if (cur_fline && !at_end()) {
+	if (!top && !at_end()) {
 		bb_putchar(':');
 		return;
 	}
 	p = "(END)";
-	if (!cur_fline)
+	if (top)
 		p = filename;
 	if (num_files > 1) {
 		printf(HIGHLIGHT"%s (file %i of %i)"NORMAL,
@@ -786,7 +1023,9 @@ static void print_lineno(const char *line)
 	const char *fmt = "        ";
 	unsigned n = n; /* for compiler */
 
-	if (line != empty_line_marker) {
+	if (line != empty_line_marker
+	 IF_FEATURE_LESS_INDEX(&& !G.lineno_unknown)
+	) {
 		/* Width of 7 preserves tab spacing in the text */
 		fmt = "%7u ";
 		n = LINENO(line) + 1;
@@ -976,9 +1215,108 @@ static void goto_lineno(int target)
 		/* search backwards through already-read lines */
 		while (LINENO(flines[cur_fline]) != target && cur_fline > 0)
 			--cur_fline;
+		/* to the first part of a wrapped line */
+		while (cur_fline > 0 && LINENO(flines[cur_fline - 1]) == target)
+			--cur_fline;
+	}
+}
+
+#if ENABLE_FEATURE_LESS_INDEX
+/* Make sure that nlines lines above cur_fline are in the window */
+static void index_back(unsigned nlines)
+{
+	unsigned lineno, have, n;
+	int sub;
+	off_t start;
+
+	if (!G.indexed)
+		return;
+	if (cur_fline > (int)max_fline)
+		cur_fline = max_fline;
+	lineno = LINENO(flines[cur_fline]);
+	have = lineno - G.win_lineno;
+	if (have >= nlines || G.win_ofs[0] == 0)
+		return;
+	/* cur_fline may be a continuation of a wrapped line */
+	sub = cur_fline;
+	while (sub && LINENO(flines[sub - 1]) == lineno)
+		sub--;
+	sub = cur_fline - sub;
+
+	n = nlines - have + BACK_LINES / 4;
+	start = index_find_back(G.win_ofs[0], &n);
+	if (start == 0) {
+		/* Back at the top, line numbers are known again */
+		lineno = n + have;
+		index_reset(0, 0, 1);
+	} else {
+		index_reset(start, G.win_lineno - n, !G.lineno_unknown);
+	}
+	goto_lineno(lineno);
+	cur_fline += sub;
+}
+
+/* Put the window at the first line starting at or after ofs */
+static void index_jump(off_t ofs)
+{
+	unsigned lo, hi, n;
+
+	index_stat();
+	if (ofs > 0)
+		ofs = index_scan(ofs - 1, G.file_size, NULL);
+	if (ofs >= G.file_size) {
+		n = 1;
+		ofs = index_find_back(G.file_size, &n);
+	}
+	/* Inside the indexed part, we can count its line number */
+	lo = 0;
+	hi = G.index_count;
+	while (hi - lo > 1) {
+		unsigned mid = (lo + hi) / 2;
+		if (G.line_index[mid] <= ofs)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	if (lo + 1 < G.index_count || (G.index_eof && G.index_count)) {
+		n = lo * INDEX_STEP;
+		index_scan(G.line_index[lo], ofs, &n);
+		index_reset(G.line_index[lo], lo * INDEX_STEP, 1);
+		goto_lineno(n);
+	} else {
+		index_reset(ofs, UNKNOWN_LINENO, 0);
 	}
+	/* so that cap_cur_fline() can fill the screen near EOF */
+	index_back(max_displayed_line);
 }
 
+# if ENABLE_FEATURE_LESS_REGEXP || ENABLE_FEATURE_LESS_MARKS
+/* Make the line starting at ofs cur_fline, moving the window
+ * only if that line is not in it */
+static void index_goto_ofs(off_t ofs)
+{
+	unsigned lo, hi;
+
+	lo = 0;
+	hi = max_lineno + !terminated - G.win_lineno;
+	if (hi && ofs >= G.win_ofs[0] && ofs <= G.win_ofs[hi - 1]) {
+		while (hi - lo > 1) {
+			unsigned mid = (lo + hi) / 2;
+			if (G.win_ofs[mid] <= ofs)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		if (G.win_ofs[lo] == ofs) {
+			goto_lineno(G.win_lineno + lo);
+			return;
+		}
+	}
+	index_jump(ofs);
+}
+# endif
+#endif
+
 static void cap_cur_fline(void)
 {
 	if ((option_mask32 & FLAG_S)) {
@@ -1011,6 +1349,7 @@ static void buffer_down(int nlines)
 
 static void buffer_up(int nlines)
 {
+	IF_FEATURE_LESS_INDEX(index_back(nlines);)
 	if ((option_mask32 & FLAG_S)) {
 		goto_lineno(LINENO(flines[cur_fline]) - nlines);
 	}
@@ -1027,6 +1366,10 @@ static void buffer_up(int nlines)
  * the flines array or a line number */
 static void buffer_to_line(int linenum, int is_lineno)
 {
+#if ENABLE_FEATURE_LESS_INDEX
+	if (is_lineno)
+		index_goto_lineno(linenum > 0 ? linenum : 0);
+#endif
 	if (linenum <= 0)
 		cur_fline = 0;
 	else if (is_lineno)
@@ -1067,9 +1410,279 @@ static void open_file_and_read_lines(void)
 	readeof = 0;
 	last_line_pos = 0;
 	terminated = 1;
+#if ENABLE_FEATURE_LESS_INDEX
+	{
+		struct stat st;
+
+		G.index_count = 0;
+		G.index_eof = 0;
+		G.lineno_unknown = 0;
+		G.win_lineno = 0;
+		G.indexed = (fstat(STDIN_FILENO, &st) == 0
+			&& S_ISREG(st.st_mode)
+			&& st.st_size >= INDEX_MIN_SIZE
+			&& lseek(STDIN_FILENO, 0, SEEK_CUR) == 0
+		);
+		if (G.indexed) {
+			G.file_size = st.st_size;
+# if ENABLE_FEATURE_LESS_FLAGS
+			/* don't count lines, read_lines() sets it on EOF */
+			num_lines = NOT_REGULAR_FILE;
+# endif
+			index_reset(0, 0, 1);
+			return;
+		}
+	}
+#endif
 	read_lines();
 }
 
+#if ENABLE_FEATURE_LESS_REGEXP
+/* Search runs in steps: getch_nowait() calls search_step()
+ * while no key is pressed. Each step runs the regex on a chunk
+ * of lines after the line the search started at, and on a chunk
+ * before it. Found matches are kept, so n/N need no searching
+ * once the scan is past them. goto_match() waits for its match
+ * to be found, or for a keypress to cancel it.
+ */
+static off_t match_at(int match)
+{
+	return match >= 0 ? match_lines[0][match] : match_lines[1][-match - 1];
+}
+
+static void add_match(int back, off_t pos)
+{
+	match_lines[back] = xrealloc_vector(match_lines[back], 4, num_matches[back]);
+	match_lines[back][num_matches[back]++] = pos;
+}
+
+/* The last fline which will not change anymore */
+static int search_limit(void)
+{
+	return (int)max_fline - (!terminated && eof_error > 0);
+}
+
+static int search_done(int back)
+{
+	if (back)
+		return G.scan_back == 0;
+#if ENABLE_FEATURE_LESS_INDEX
+	if (G.indexed)
+		return G.scan_fwd >= G.file_size;
+#endif
+	return G.scan_fwd > search_limit() && eof_error <= 0;
+}
+
+static void search_lines(int back)
+{
+	int n = SEARCH_LINES;
+
+	while (--n >= 0) {
+		off_t pos;
+
+		if (back) {
+			if (G.scan_back == 0)
+				break;
+			pos = --G.scan_back;
+		} else {
+			if (G.scan_fwd > search_limit())
+				break;
+			pos = G.scan_fwd++;
+		}
+		if (regexec(&pattern, flines[pos], 0, NULL, 0) == 0)
+			add_match(back, pos);
+	}
+}
+
+#if ENABLE_FEATURE_LESS_INDEX
+/* Indexed file is searched by reading it, not the window */
+static void index_search(int back)
+{
+	off_t pos = G.scan_fwd;
+	ssize_t len = SEARCH_BYTES;
+	unsigned first = num_matches[back];
+	char *buf, *p, *end;
+
+	if (back) {
+		pos = G.scan_back > SEARCH_BYTES ? G.scan_back - SEARCH_BYTES : 0;
+		len = G.scan_back - pos;
+	}
+	buf = xmalloc(SEARCH_BYTES + 1);
+	len = pread(STDIN_FILENO, buf, len, pos);
+	if (len <= 0) {
+		/* the file shrank? */
+		if (back)
+			G.scan_back = 0;
+		else
+			G.scan_fwd = G.file_size;
+		goto ret;
+	}
+	p = buf;
+	end = buf + len;
+	/* Only whole lines, unless a line doesn't fit in buf */
+	if (back) {
+		if (pos && (p = memchr(buf, '\n', len)) != NULL)
+			p++;
+		else
+			p = buf;
+		G.scan_back = pos + (p - buf);
+	} else {
+		if (pos + len < G.file_size && (end = memrchr(buf, '\n', len)) != NULL)
+			end++;
+		else
+			end = buf + len;
+		G.scan_fwd = pos + (end - buf);
+	}
+	while (p < end) {
+		char *nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+		*nl = '\0';
+		if (regexec(&pattern, p, 0, NULL, 0) == 0)
+			add_match(back, pos + (p - buf));
+		p = nl + 1;
+	}
+	/* Matches before the start are kept nearest first */
+	if (back && num_matches[1] - first > 1) {
+		off_t *a = match_lines[1] + first;
+		off_t *b = match_lines[1] + num_matches[1] - 1;
+		while (a < b) {
+			off_t t = *a;
+			*a++ = *b;
+			*b-- = t;
+		}
+	}
+ ret:
+	free(buf);
+}
+#endif
+
+/* Go to wanted_match if it is known (or known not to exist).
+ * Returns 0 if we need to search more */
+static int search_resolve(void)
+{
+	int match = wanted_match;
+
+	/* Past the first or the last match: go to that one */
+	if (match < -num_matches[1]) {
+		if (!search_done(1))
+			return 0;
+		match = -num_matches[1];
+	}
+	if (match >= num_matches[0]) {
+		if (!search_done(0))
+			return 0;
+		match = num_matches[0] - 1;
+		if (match < -num_matches[1] && !search_done(1))
+			return 0;
+	}
+	G.searching = 0;
+	if (match < -num_matches[1]) {
+		print_statusline("No matches found");
+		return 1;
+	}
+	match_pos = match;
+#if ENABLE_FEATURE_LESS_INDEX
+	if (G.indexed) {
+		index_goto_ofs(match_at(match));
+		buffer_line(cur_fline);
+		return 1;
+	}
+#endif
+	buffer_line(match_at(match));
+	return 1;
+}
+
+static void search_progress(void)
+{
+	unsigned now = monotonic_ms();
+	unsigned n = G.scan_fwd - G.scan_back;
+	const char *fmt = "Searching... %u lines (any key stops)";
+
+	if (less_gets_pos >= 0 || now - G.search_ms < 200)
+		return;
+	G.search_ms = now;
+#if ENABLE_FEATURE_LESS_INDEX
+	if (G.indexed) {
+		n = (G.scan_fwd - G.scan_back) * 100 / G.file_size;
+		fmt = "Searching... %u%% (any key stops)";
+	}
+#endif
+	clear_line();
+	printf(HIGHLIGHT);
+	printf(fmt, n);
+	printf(NORMAL);
+}
+
+static void search_step(void)
+{
+	int back;
+
+	for (back = 0; back < 2; back++) {
+		if (search_done(back))
+			continue;
+#if ENABLE_FEATURE_LESS_INDEX
+		if (G.indexed) {
+			index_search(back);
+			continue;
+		}
+#endif
+		if (!back && G.scan_fwd > search_limit()) {
+			/* Read more input only if we wait for a match */
+			if (!G.searching)
+				continue;
+			G.read_more = SEARCH_LINES;
+			read_lines();
+			G.read_more = 0;
+		}
+		search_lines(back);
+	}
+	if (G.searching && !search_resolve())
+		search_progress();
+}
+
+static int search_pending(void)
+{
+	if (!pattern_valid)
+		return 0;
+	if (G.searching || !search_done(1))
+		return 1;
+#if ENABLE_FEATURE_LESS_INDEX
+	if (G.indexed)
+		return !search_done(0);
+#endif
+	/* don't read input just to search it */
+	return G.scan_fwd <= search_limit();
+}
+
+/* Forget the matches, next search starts after the top line */
+static void search_start(void)
+{
+	int top = MIN(cur_fline, (int)max_fline);
+	off_t start = top + 1;
+
+#if ENABLE_FEATURE_LESS_INDEX
+	if (G.indexed) {
+		unsigned n = LINENO(flines[top]) + 1 - G.win_lineno;
+		index_stat();
+		start = G.file_size;
+		if (n < max_lineno + !terminated - G.win_lineno)
+			start = G.win_ofs[n];
+	}
+#endif
+	free(match_lines[0]);
+	free(match_lines[1]);
+	match_lines[0] = match_lines[1] = NULL;
+	num_matches[0] = num_matches[1] = 0;
+	match_pos = 0;
+	G.searching = 0;
+	G.scan_fwd = G.scan_back = start;
+}
+#else
+# define search_step() ((void)0)
+# define search_pending() 0
+#endif
+
 /* Reinitialize everything for a new file - free the memory and start over */
 static void reinitialize(void)
 {
@@ -1086,6 +1699,7 @@ static void reinitialize(void)
 	cur_fline = 0;
 	max_lineno = 0;
 	open_file_and_read_lines();
+	IF_FEATURE_LESS_REGEXP(search_start();)
 #if ENABLE_FEATURE_LESS_ASK_TERMINAL
 	if (G.winsize_err)
 		printf(ESC"[999;999H" ESC"[6n");
@@ -1127,13 +1741,19 @@ static int64_t getch_nowait(void)
 		while (1) {
 			int r;
 			/* NB: SIGWINCH interrupts poll() */
-			r = poll(pfd + rd, 2 - rd, -1);
+			r = poll(pfd + rd, 2 - rd, search_pending() ? 0 : -1);
 			if (/*r < 0 && errno == EINTR &&*/ winch_counter)
 				return '\\'; /* anything which has no defined function */
 			if (r) break;
+			/* no input yet, search meanwhile */
+			search_step();
+			goto again;
 		}
 #else
-		safe_poll(pfd + rd, 2 - rd, -1);
+		if (safe_poll(pfd + rd, 2 - rd, search_pending() ? 0 : -1) == 0) {
+			search_step();
+			goto again;
+		}
 #endif
 	}
 
@@ -1151,6 +1771,8 @@ static int64_t getch_nowait(void)
 		/* EOF/error (ssh session got killed etc) */
 		less_exit();
 	}
+	/* Any key cancels goto_match() still waiting for its match */
+	IF_FEATURE_LESS_REGEXP(G.searching = 0;)
 	set_tty_cooked();
 	return key64;
 }
@@ -1309,50 +1931,15 @@ static void colon_process(void)
 }
 
 #if ENABLE_FEATURE_LESS_REGEXP
-static void normalize_match_pos(int match)
-{
-	if (match >= num_matches)
-		match = num_matches - 1;
-	if (match < 0)
-		match = 0;
-	match_pos = match;
-}
-
 static void goto_match(int match)
 {
 	if (!pattern_valid)
 		return;
-	if (match < 0)
-		match = 0;
-	/* Try to find next match if eof isn't reached yet */
-	if (match >= num_matches && eof_error > 0) {
-		wanted_match = match; /* "I want to read until I see N'th match" */
-		read_lines();
-	}
-	if (num_matches) {
-		normalize_match_pos(match);
-		buffer_line(match_lines[match_pos]);
-	} else {
-		print_statusline("No matches found");
-	}
-}
-
-static void fill_match_lines(unsigned pos)
-{
-	if (!pattern_valid)
-		return;
-	/* Run the regex on each line of the current file */
-	while (pos <= max_fline) {
-		/* If this line matches */
-		if (regexec(&pattern, flines[pos], 0, NULL, 0) == 0
-		/* and we didn't match it last time */
-		 && !(num_matches && match_lines[num_matches-1] == pos)
-		) {
-			match_lines = xrealloc_vector(match_lines, 4, num_matches);
-			match_lines[num_matches++] = pos;
-		}
-		pos++;
-	}
+	wanted_match = match;
+	G.searching = 1;
+	G.search_ms = monotonic_ms();
+	/* If not found yet, search_step() will go there */
+	search_resolve();
 }
 
 static void regex_process(void)
@@ -1360,10 +1947,6 @@ static void regex_process(void)
 	char *uncomp_regex, *err;
 
 	/* Reset variables */
-	free(match_lines);
-	match_lines = NULL;
-	match_pos = 0;
-	num_matches = 0;
 	if (pattern_valid) {
 		regfree(&pattern);
 		pattern_valid = 0;
@@ -1390,20 +1973,9 @@ static void regex_process(void)
 	}
 
 	pattern_valid = 1;
-	match_pos = 0;
-	fill_match_lines(0);
-	while (match_pos < num_matches) {
-		if ((int)match_lines[match_pos] > cur_fline)
-			break;
-		match_pos++;
-	}
-	if (option_mask32 & LESS_STATE_MATCH_BACKWARDS)
-		match_pos--;
-
-	/* It's possible that no matches are found yet.
-	 * goto_match() will read input looking for match,
-	 * if needed */
-	goto_match(match_pos);
+	search_start();
+	/* Match 0 is the first after the top line, -1 the last before it */
+	goto_match((option_mask32 & LESS_STATE_MATCH_BACKWARDS) ? -1 : 0);
 }
 #endif
 
@@ -1451,6 +2023,13 @@ static void number_process(int first_digit)
 		buffer_lineno(num - 1);
 		break;
 	case 'p': case '%':
+#if ENABLE_FEATURE_LESS_INDEX
+		if (G.indexed) {
+			index_jump(G.file_size / 100 * num + G.file_size % 100 * num / 100);
+			buffer_line(cur_fline);
+			break;
+		}
+#endif
 #if ENABLE_FEATURE_LESS_FLAGS
 		update_num_lines();
 		num = num * (num_lines > 0 ? num_lines : max_lineno) / 100;
@@ -1591,6 +2170,9 @@ static void add_mark(void)
 
 		mark_lines[num_marks][0] = letter;
 		mark_lines[num_marks][1] = cur_fline;
+#if ENABLE_FEATURE_LESS_INDEX
+		G.mark_ofs[num_marks] = G.indexed ? index_line_ofs(cur_fline) : -1;
+#endif
 		num_marks++;
 	} else {
 		print_statusline("Invalid mark letter");
@@ -1609,6 +2191,13 @@ static void goto_mark(void)
 	if (isalpha(letter)) {
 		for (i = 0; i <= num_marks; i++)
 			if (letter == mark_lines[i][0]) {
+#if ENABLE_FEATURE_LESS_INDEX
+				if (G.indexed && G.mark_ofs[i] >= 0) {
+					index_goto_ofs(G.mark_ofs[i]);
+					buffer_line(cur_fline);
+					break;
+				}
+#endif
 				buffer_line(mark_lines[i][1]);
 				break;
 			}
@@ -1710,9 +2299,10 @@ static void keypress_process(int keypress)
 		buffer_up((max_displayed_line + 1) / 2);
 		break;
 	case KEYCODE_HOME: case 'g': case 'p': case '<': case '%':
-		buffer_line(0);
+		buffer_lineno(0);
 		break;
 	case KEYCODE_END: case 'G': case '>':
+		IF_FEATURE_LESS_INDEX(if (G.indexed) index_end();)
 		cur_fline = MAXLINES;
 		read_lines();
 		buffer_line(cur_fline);
@@ -110,6 +110,17 @@
 //config:	depends on TOP
 //config:	help
 //config:	Enable 's' in top (gives lots of memory info).
+//config:
+//config:config FEATURE_TOP_CACHE
+//config:	bool "Keep per-process state between refreshes"
+//config:	default y
+//config:	depends on TOP
+//config:	help
+//config:	Keep /proc/PID/stat files open between refreshes and reread
+//config:	them with pread, instead of opening every file anew.
+//config:	Username lookups and the process table are kept too.
+//config:	Makes top use much less CPU on systems with many processes,
+//config:	at the cost of one file descriptor per process.
 
 //applet:IF_TOP(APPLET(top, BB_DIR_USR_BIN, BB_SUID_DROP))
 
@@ -160,6 +171,10 @@ enum { LINE_BUF_SIZE = 512 - 64 };
 struct globals {
 	top_status_t *top;
 	int ntop;
+	int top_cap; /* allocated elements in top[] */
+#if ENABLE_FEATURE_TOP_CACHE
+	struct procps_cache *pscache;
+#endif
 	smallint inverted;
 #if ENABLE_FEATURE_TOPMEM
 	smallint sort_field;
@@ -758,6 +773,14 @@ static void clearmems(void)
 	clear_username_cache();
 	free(top);
 	top = NULL;
+	G.top_cap = 0;
+}
+
+/* Between refreshes: keep the memory if we can */
+static void clearmems_if_no_cache(void)
+{
+	if (!ENABLE_FEATURE_TOP_CACHE)
+		clearmems();
 }
 
 #if ENABLE_FEATURE_TOP_INTERACTIVE
@@ -1178,6 +1201,7 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 
 	/* change to /proc */
 	xchdir("/proc");
+	IF_FEATURE_TOP_CACHE(G.pscache = procps_cache_new();)
 
 #if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
 	sort_function[0] = pcpu_sort;
@@ -1225,12 +1249,21 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 
 		/* read process IDs & status for all the processes */
 		ntop = 0;
-		while ((p = procps_scan(p, scan_mask)) != NULL) {
+		while ((p =
+#if ENABLE_FEATURE_TOP_CACHE
+			procps_scan_cached(p, G.pscache, scan_mask)
+#else
+			procps_scan(p, scan_mask)
+#endif
+		) != NULL) {
 			int n;
 
 			IF_FEATURE_TOPMEM(if (scan_mask != TOPMEM_MASK)) {
-				n = ntop;
-				top = xrealloc_vector(top, 6, ntop++);
+				n = ntop++;
+				if (n == G.top_cap) {
+					top = xrealloc_vector(top, 6, n);
+					G.top_cap += 1 << 6;
+				}
 				top[n].pid = p->pid;
 				top[n].ppid = p->ppid;
 				top[n].vsz = p->vsz;
@@ -1248,9 +1281,12 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 			else { /* TOPMEM */
 				if (!(p->smaps.mapped_ro | p->smaps.mapped_rw))
 					continue; /* kernel threads are ignored */
-				n = ntop;
-				/* No bug here - top and topmem are the same */
-				top = xrealloc_vector(topmem, 6, ntop++);
+				n = ntop++;
+				if (n == G.top_cap) {
+					/* No bug here - top and topmem are the same */
+					top = xrealloc_vector(topmem, 6, n);
+					G.top_cap += 1 << 6;
+				}
 				strcpy(topmem[n].comm, p->comm);
 				topmem[n].pid      = p->pid;
 				topmem[n].vsz      = p->smaps.mapped_rw + p->smaps.mapped_ro;
@@ -1273,7 +1309,7 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 			if (!prev_hist_count) {
 				do_stats();
 				usleep(100000);
-				clearmems();
+				clearmems_if_no_cache();
 				continue;
 			}
 			do_stats();
@@ -1300,14 +1336,17 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 		if (iterations >= 0 && !--iterations)
 			break;
 #if !ENABLE_FEATURE_TOP_INTERACTIVE
-		clearmems();
+		clearmems_if_no_cache();
 		sleep_for_duration(interval);
 #else
 		new_mask = handle_input(scan_mask, interval);
 		if (new_mask == NO_RESCAN_MASK)
 			goto display;
+		if (new_mask != scan_mask)
+			clearmems(); /* top[] may change its type */
+		else
+			clearmems_if_no_cache();
 		scan_mask = new_mask;
-		clearmems();
 #endif
 	} /* end of "while (not Q)" */
 
@@ -1320,6 +1359,7 @@ int top_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_TOP_CPU_USAGE_PERCENTAGE
 		free(prev_hist);
 #endif
+		IF_FEATURE_TOP_CACHE(procps_cache_free(G.pscache);)
 	}
 	return EXIT_SUCCESS;
 }
@@ -43,4 +43,21 @@ struct ERR_svstatus_must_be_20_bytes {
 	char ERR_svstatus_must_be_20_bytes[sizeof(svstatus_t) == 20 ? 1 : -1];
 };
 
+/*
+ * Supervision of one service directory (runsv.c).
+ * Used by runsv, and by runsvdir -S for all services at once.
+ * All functions but runsv_is_child() expect current directory
+ * to be the service directory.
+ */
+typedef struct runsv_state runsv_state;
+runsv_state* runsv_open(const char *dir) FAST_FUNC;
+void runsv_close(runsv_state *r) FAST_FUNC;
+int runsv_start(runsv_state *r) FAST_FUNC;
+int runsv_pollfds(runsv_state *r, struct pollfd *x) FAST_FUNC;
+int runsv_is_child(runsv_state *r, pid_t child) FAST_FUNC;
+int runsv_reap(runsv_state *r, pid_t child, int wstat) FAST_FUNC;
+void runsv_control(runsv_state *r) FAST_FUNC;
+void runsv_exit(runsv_state *r) FAST_FUNC;
+int runsv_exited(runsv_state *r) FAST_FUNC;
+
 POP_SAVED_FUNCTION_VISIBILITY
@@ -96,82 +96,62 @@ struct svdir {
 	smallint ctrl;
 	smallint sd_want;
 	smallint islog;
+	smallint held;
+	unsigned hold_until;
 	struct timespec start;
 	int fdlock;
 	int fdcontrol;
 	int fdcontrolwrite;
+	int fdok;
 	int wstat;
 };
 
-struct globals {
+/* All state of one supervised service directory.
+ * runsv has exactly one of these, runsvdir -S has one per service.
+ */
+struct runsv_state {
 	smallint haslog;
-	smallint sigterm;
 	smallint pidchanged;
-	struct fd_pair selfpipe;
 	struct fd_pair logpipe;
-	char *dir;
+	const char *dir;
 	struct svdir svd[2];
-} FIX_ALIASING;
-#define G (*(struct globals*)bb_common_bufsiz1)
-#define haslog       (G.haslog      )
-#define sigterm      (G.sigterm     )
-#define pidchanged   (G.pidchanged  )
-#define selfpipe     (G.selfpipe    )
-#define logpipe      (G.logpipe     )
-#define dir          (G.dir         )
-#define svd          (G.svd         )
-#define INIT_G() do { \
-	setup_common_bufsiz(); \
-	pidchanged = 1; \
-} while (0)
+};
 
-static void fatal2_cannot(const char *m1, const char *m2)
+static void fatal2_cannot(runsv_state *r, const char *m1, const char *m2)
 {
-	bb_perror_msg_and_die("%s: fatal: can't %s%s", dir, m1, m2);
+	bb_perror_msg("%s: fatal: can't %s%s", r->dir, m1, m2);
 	/* was exiting 111 */
 }
-static void fatal_cannot(const char *m)
+static void fatal_cannot(runsv_state *r, const char *m)
 {
-	fatal2_cannot(m, "");
+	fatal2_cannot(r, m, "");
 	/* was exiting 111 */
 }
-static void fatal2x_cannot(const char *m1, const char *m2)
+static void fatal2x_cannot(runsv_state *r, const char *m1, const char *m2)
 {
-	bb_error_msg_and_die("%s: fatal: can't %s%s", dir, m1, m2);
+	bb_error_msg("%s: fatal: can't %s%s", r->dir, m1, m2);
 	/* was exiting 111 */
 }
-static void warn2_cannot(const char *m1, const char *m2)
+static void warn2_cannot(runsv_state *r, const char *m1, const char *m2)
 {
-	bb_perror_msg("%s: warning: can't %s%s", dir, m1, m2);
+	bb_perror_msg("%s: warning: can't %s%s", r->dir, m1, m2);
 }
-static void warn_cannot(const char *m)
+static void warn_cannot(runsv_state *r, const char *m)
 {
-	warn2_cannot(m, "");
+	warn2_cannot(r, m, "");
 }
 
-/* SIGCHLD/TERM handler is reentrancy-safe because they are unmasked
- * only over poll() call, not over memory allocations
- * or printouts. Do not need to save/restore errno either,
- * as poll() error is not checked there.
- */
-static void s_chld_term(int sig_no)
-{
-	if (sig_no == SIGTERM)
-		sigterm = 1;
-	write(selfpipe.wr, "", 1);
-}
-
-static int open_trunc_or_warn(const char *name)
+static int open_trunc_or_warn(runsv_state *r, const char *name)
 {
 	/* Why O_NDELAY? */
 	int fd = open(name, O_WRONLY | O_NDELAY | O_TRUNC | O_CREAT, 0644);
 	if (fd < 0)
 		bb_perror_msg("%s: warning: cannot open %s",
-				dir, name);
+				r->dir, name);
 	return fd;
 }
 
-static void update_status(struct svdir *s)
+static void update_status(runsv_state *r, struct svdir *s)
 {
 	ssize_t sz;
 	int fd;
@@ -193,8 +173,8 @@ static void update_status(struct svdir *s)
 	}
 
 	/* pid */
-	if (pidchanged) {
-		fd = open_trunc_or_warn(fpidnew);
+	if (r->pidchanged) {
+		fd = open_trunc_or_warn(r, fpidnew);
 		if (fd < 0)
 			return;
 		if (s->pid) {
@@ -205,11 +185,11 @@ static void update_status(struct svdir *s)
 		close(fd);
 		if (rename_or_warn(fpidnew, fpid))
 			return;
-		pidchanged = 0;
+		r->pidchanged = 0;
 	}
 
 	/* stat */
-	fd = open_trunc_or_warn(fstatnew);
+	fd = open_trunc_or_warn(r, fstatnew);
 	if (fd < -1)
 		return;
 
@@ -261,20 +241,20 @@ static void update_status(struct svdir *s)
 	if (s->ctrl & C_TERM)
 		status.got_term = 1;
 	status.run_or_finish = s->state;
-	fd = open_trunc_or_warn(fstatusnew);
+	fd = open_trunc_or_warn(r, fstatusnew);
 	if (fd < 0)
 		return;
 	sz = write(fd, &status, sizeof(status));
 	close(fd);
 	if (sz != sizeof(status)) {
-		warn2_cannot("write ", fstatusnew);
+		warn2_cannot(r, "write ", fstatusnew);
 		unlink(fstatusnew);
 		return;
 	}
 	rename_or_warn(fstatusnew, fstatus);
 }
 
-static unsigned custom(struct svdir *s, char c)
+static unsigned custom(runsv_state *r, struct svdir *s, char c)
 {
 	pid_t pid;
 	int w;
@@ -289,49 +269,50 @@ static unsigned custom(struct svdir *s, char c)
 		if (st.st_mode & S_IXUSR) {
 			pid = vfork();
 			if (pid == -1) {
-				warn2_cannot("vfork for ", a);
+				warn2_cannot(r, "vfork for ", a);
 				return 0;
 			}
 			if (pid == 0) {
 				/* child */
-				if (haslog && dup2(logpipe.wr, 1) == -1)
-					warn2_cannot("setup stdout for ", a);
+				if (r->haslog && dup2(r->logpipe.wr, 1) == -1)
+					warn2_cannot(r, "setup stdout for ", a);
 				execl(a, a, (char *) NULL);
-				fatal2_cannot("run ", a);
+				fatal2_cannot(r, "run ", a);
+				_exit(EXIT_FAILURE);
 			}
 			/* parent */
 			if (safe_waitpid(pid, &w, 0) == -1) {
-				warn2_cannot("wait for child ", a);
+				warn2_cannot(r, "wait for child ", a);
 				return 0;
 			}
 			return WEXITSTATUS(w) == 0;
 		}
 	} else {
 		if (errno != ENOENT)
-			warn2_cannot("stat ", a);
+			warn2_cannot(r, "stat ", a);
 	}
 	return 0;
 }
 
-static void stopservice(struct svdir *s)
+static void stopservice(runsv_state *r, struct svdir *s)
 {
-	if (s->pid && !custom(s, 't')) {
+	if (s->pid && !custom(r, s, 't')) {
 		kill(s->pid, SIGTERM);
 		s->ctrl |= C_TERM;
-		update_status(s);
+		update_status(r, s);
 	}
 	if (s->sd_want == W_DOWN) {
 		kill(s->pid, SIGCONT);
-		custom(s, 'd');
+		custom(r, s, 'd');
 		return;
 	}
 	if (s->sd_want == W_EXIT) {
 		kill(s->pid, SIGCONT);
-		custom(s, 'x');
+		custom(r, s, 'x');
 	}
 }
 
-static void startservice(struct svdir *s)
+static void startservice(runsv_state *r, struct svdir *s)
 {
 	int p;
 	const char *arg[4];
@@ -359,26 +340,26 @@ static void startservice(struct svdir *s)
 	} else {
 		arg[0] = "./run";
 		arg[1] = NULL;
-		custom(s, 'u');
+		custom(r, s, 'u');
 	}
 
 	if (s->pid != 0)
-		stopservice(s); /* should never happen */
+		stopservice(r, s); /* should never happen */
 	while ((p = vfork()) == -1) {
-		warn_cannot("vfork, sleeping");
+		warn_cannot(r, "vfork, sleeping");
 		sleep(5);
 	}
 	if (p == 0) {
 		/* child */
-		if (haslog) {
+		if (r->haslog) {
 			/* NB: bug alert! right order is close, then dup2 */
 			if (s->islog) {
 				xchdir("./log");
-				close(logpipe.wr);
-				xdup2(logpipe.rd, 0);
+				close(r->logpipe.wr);
+				xdup2(r->logpipe.rd, 0);
 			} else {
-				close(logpipe.rd);
-				xdup2(logpipe.wr, 1);
+				close(r->logpipe.rd);
+				xdup2(r->logpipe.wr, 1);
 			}
 		}
 		/* Non-ignored signals revert to SIG_DFL on exec.
@@ -392,7 +373,8 @@ static void startservice(struct svdir *s)
 		sig_unblock(SIGCHLD);
 		sig_unblock(SIGTERM);
 		execv(arg[0], (char**) arg);
-		fatal2_cannot(s->islog ? "start log/" : "start ", arg[0]);
+		fatal2_cannot(r, s->islog ? "start log/" : "start ", arg[0]);
+		_exit(EXIT_FAILURE);
 	}
 	/* parent */
 	if (s->state != S_FINISH) {
@@ -400,60 +382,60 @@ static void startservice(struct svdir *s)
 		s->state = S_RUN;
 	}
 	s->pid = p;
-	pidchanged = 1;
+	r->pidchanged = 1;
 	s->ctrl = C_NOOP;
-	update_status(s);
+	update_status(r, s);
 }
 
-static int ctrl(struct svdir *s, char c)
+static int ctrl(runsv_state *r, struct svdir *s, char c)
 {
 	int sig;
 
 	switch (c) {
 	case 'd': /* down */
 		s->sd_want = W_DOWN;
-		update_status(s);
+		update_status(r, s);
 		if (s->state == S_RUN)
-			stopservice(s);
+			stopservice(r, s);
 		break;
 	case 'u': /* up */
 		s->sd_want = W_UP;
-		update_status(s);
+		update_status(r, s);
 		if (s->state == S_DOWN)
-			startservice(s);
+			startservice(r, s);
 		break;
 	case 'x': /* exit */
 		if (s->islog)
 			break;
 		s->sd_want = W_EXIT;
-		update_status(s);
+		update_status(r, s);
 		/* FALLTHROUGH */
 	case 't': /* sig term */
 		if (s->state == S_RUN)
-			stopservice(s);
+			stopservice(r, s);
 		break;
 	case 'k': /* sig kill */
-		if ((s->state == S_RUN) && !custom(s, c))
+		if ((s->state == S_RUN) && !custom(r, s, c))
 			kill(s->pid, SIGKILL);
 		s->state = S_DOWN;
 		break;
 	case 'p': /* sig pause */
-		if ((s->state == S_RUN) && !custom(s, c))
+		if ((s->state == S_RUN) && !custom(r, s, c))
 			kill(s->pid, SIGSTOP);
 		s->ctrl |= C_PAUSE;
-		update_status(s);
+		update_status(r, s);
 		break;
 	case 'c': /* sig cont */
-		if ((s->state == S_RUN) && !custom(s, c))
+		if ((s->state == S_RUN) && !custom(r, s, c))
 			kill(s->pid, SIGCONT);
 		s->ctrl &= ~C_PAUSE;
-		update_status(s);
+		update_status(r, s);
 		break;
 	case 'o': /* once */
 		s->sd_want = W_DOWN;
-		update_status(s);
+		update_status(r, s);
 		if (s->state == S_DOWN)
-			startservice(s);
+			startservice(r, s);
 		break;
 	case 'a': /* sig alarm */
 		sig = SIGALRM;
@@ -476,165 +458,428 @@ static int ctrl(struct svdir *s, char c)
 	}
 	return 1;
  sendsig:
-	if ((s->state == S_RUN) && !custom(s, c))
+	if ((s->state == S_RUN) && !custom(r, s, c))
 		kill(s->pid, sig);
 	return 1;
 }
 
-static void open_control(const char *f, struct svdir *s)
+static int open_control(runsv_state *r, const char *f, struct svdir *s)
 {
 	struct stat st;
 	mkfifo(f, 0600);
-	if (stat(f, &st) == -1)
-		fatal2_cannot("stat ", f);
-	if (!S_ISFIFO(st.st_mode))
-		bb_error_msg_and_die("%s: fatal: %s exists but is not a fifo", dir, f);
-	s->fdcontrol = xopen(f, O_RDONLY|O_NDELAY);
+	if (stat(f, &st) == -1) {
+		fatal2_cannot(r, "stat ", f);
+		return -1;
+	}
+	if (!S_ISFIFO(st.st_mode)) {
+		bb_error_msg("%s: fatal: %s exists but is not a fifo", r->dir, f);
+		return -1;
+	}
+	s->fdcontrol = open(f, O_RDONLY|O_NDELAY);
+	if (s->fdcontrol < 0)
+		goto err;
 	close_on_exec_on(s->fdcontrol);
-	s->fdcontrolwrite = xopen(f, O_WRONLY|O_NDELAY);
+	s->fdcontrolwrite = open(f, O_WRONLY|O_NDELAY);
+	if (s->fdcontrolwrite < 0)
+		goto err;
 	close_on_exec_on(s->fdcontrolwrite);
-	update_status(s);
+	update_status(r, s);
+	return 0;
+ err:
+	fatal2_cannot(r, "open ", f);
+	return -1;
 }
 
-int runsv_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
-int runsv_main(int argc UNUSED_PARAM, char **argv)
+static int open_ok(runsv_state *r, const char *f, struct svdir *s)
 {
-	struct stat s;
-	int fd;
-	int r;
-	char buf[256];
+	mkfifo(f, 0600);
+	s->fdok = open(f, O_RDONLY|O_NDELAY);
+	if (s->fdok < 0) {
+		fatal2_cannot(r, "open ", f);
+		return -1;
+	}
+	close_on_exec_on(s->fdok);
+	return 0;
+}
 
-	INIT_G();
+static int open_lock(runsv_state *r, const char *f, struct svdir *s, int how)
+{
+	s->fdlock = open(f, O_WRONLY|O_NDELAY|O_APPEND|O_CREAT, 0600);
+	if (s->fdlock < 0) {
+		fatal2_cannot(r, "open ", f);
+		return -1;
+	}
+	close_on_exec_on(s->fdlock);
+	if (flock(s->fdlock, how) == -1) {
+		fatal2_cannot(r, "lock ", f);
+		return -1;
+	}
+	return 0;
+}
 
-	dir = single_argv(argv);
+/* Close everything runsv_open() managed to open */
+void FAST_FUNC runsv_close(runsv_state *r)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		struct svdir *s = &r->svd[i];
+		if (s->fdlock >= 0)
+			close(s->fdlock);
+		if (s->fdcontrol >= 0)
+			close(s->fdcontrol);
+		if (s->fdcontrolwrite >= 0)
+			close(s->fdcontrolwrite);
+		if (s->fdok >= 0)
+			close(s->fdok);
+	}
+	if (r->logpipe.rd >= 0) {
+		close(r->logpipe.rd);
+		close(r->logpipe.wr);
+	}
+	free(r);
+}
 
-	xpiped_pair(selfpipe);
-	close_on_exec_on(selfpipe.rd);
-	close_on_exec_on(selfpipe.wr);
-	ndelay_on(selfpipe.rd);
-	ndelay_on(selfpipe.wr);
+/* Set up supervise/ of the service in the current directory.
+ * Returns NULL (after logging the reason) if the service can't be
+ * supervised; the caller decides whether that is fatal.
+ */
+runsv_state* FAST_FUNC runsv_open(const char *dir)
+{
+	runsv_state *r;
+	struct stat s;
+	int fd;
+	int rr;
+	int fds[2];
+	char buf[256];
 
-	sig_block(SIGCHLD);
-	sig_block(SIGTERM);
-	/* No particular reason why we don't set SA_RESTART
-	 * (poll() wouldn't restart regardless of that flag),
-	 * we just follow what runit-2.1.2 does:
-	 */
-	bb_signals_norestart(0
-			+ (1 << SIGCHLD)
-			+ (1 << SIGTERM)
-			, s_chld_term);
+	r = xzalloc(sizeof(*r));
+	r->dir = dir;
+	r->pidchanged = 1;
+	r->logpipe.rd = r->logpipe.wr = -1;
+	for (rr = 0; rr < 2; rr++) {
+		r->svd[rr].fdlock = -1;
+		r->svd[rr].fdcontrol = -1;
+		r->svd[rr].fdcontrolwrite = -1;
+		r->svd[rr].fdok = -1;
+	}
 
-	xchdir(dir);
-	/* bss: svd[0].pid = 0; */
-	if (S_DOWN) svd[0].state = S_DOWN; /* otherwise already 0 (bss) */
-	if (C_NOOP) svd[0].ctrl = C_NOOP;
-	if (W_UP) svd[0].sd_want = W_UP;
-	/* bss: svd[0].islog = 0; */
-	/* bss: svd[1].pid = 0; */
-	gettimeofday_ns(&svd[0].start);
+	/* zalloc: svd[0].pid = 0; */
+	if (S_DOWN) r->svd[0].state = S_DOWN; /* otherwise already 0 */
+	if (C_NOOP) r->svd[0].ctrl = C_NOOP;
+	if (W_UP) r->svd[0].sd_want = W_UP;
+	/* zalloc: svd[0].islog = 0; */
+	/* zalloc: svd[1].pid = 0; */
+	gettimeofday_ns(&r->svd[0].start);
 	if (stat("down", &s) != -1)
-		svd[0].sd_want = W_DOWN;
+		r->svd[0].sd_want = W_DOWN;
 
 	if (stat("log", &s) == -1) {
 		if (errno != ENOENT)
-			warn_cannot("stat ./log");
+			warn_cannot(r, "stat ./log");
 	} else {
 		if (!S_ISDIR(s.st_mode)) {
 			errno = 0;
-			warn_cannot("stat log/down: log is not a directory");
+			warn_cannot(r, "stat log/down: log is not a directory");
 		} else {
-			haslog = 1;
-			svd[1].state = S_DOWN;
-			svd[1].ctrl = C_NOOP;
-			svd[1].sd_want = W_UP;
-			svd[1].islog = 1;
-			gettimeofday_ns(&svd[1].start);
+			r->haslog = 1;
+			r->svd[1].state = S_DOWN;
+			r->svd[1].ctrl = C_NOOP;
+			r->svd[1].sd_want = W_UP;
+			r->svd[1].islog = 1;
+			gettimeofday_ns(&r->svd[1].start);
 			if (stat("log/down", &s) != -1)
-				svd[1].sd_want = W_DOWN;
-			xpiped_pair(logpipe);
-			close_on_exec_on(logpipe.rd);
-			close_on_exec_on(logpipe.wr);
+				r->svd[1].sd_want = W_DOWN;
+			if (pipe(fds)) {
+				fatal_cannot(r, "create pipe");
+				goto err;
+			}
+			r->logpipe.rd = fds[0];
+			r->logpipe.wr = fds[1];
+			close_on_exec_on(r->logpipe.rd);
+			close_on_exec_on(r->logpipe.wr);
 		}
 	}
 
 	if (mkdir("supervise", 0700) == -1) {
-		r = readlink("supervise", buf, sizeof(buf));
-		if (r != -1) {
-			if (r == sizeof(buf))
-				fatal2x_cannot("readlink ./supervise", ": name too long");
-			buf[r] = 0;
+		rr = readlink("supervise", buf, sizeof(buf));
+		if (rr != -1) {
+			if (rr == sizeof(buf)) {
+				fatal2x_cannot(r, "readlink ./supervise", ": name too long");
+				goto err;
+			}
+			buf[rr] = 0;
 			mkdir(buf, 0700);
 		} else {
-			if ((errno != ENOENT) && (errno != EINVAL))
-				fatal_cannot("readlink ./supervise");
+			if ((errno != ENOENT) && (errno != EINVAL)) {
+				fatal_cannot(r, "readlink ./supervise");
+				goto err;
+			}
 		}
 	}
-	svd[0].fdlock = xopen3("log/supervise/lock"+4,
-			O_WRONLY|O_NDELAY|O_APPEND|O_CREAT, 0600);
-	if (flock(svd[0].fdlock, LOCK_EX | LOCK_NB) == -1)
-		fatal_cannot("lock supervise/lock");
-	close_on_exec_on(svd[0].fdlock);
-	if (haslog) {
+	if (open_lock(r, "log/supervise/lock"+4, &r->svd[0], LOCK_EX | LOCK_NB))
+		goto err;
+	if (r->haslog) {
 		if (mkdir("log/supervise", 0700) == -1) {
-			r = readlink("log/supervise", buf, 256);
-			if (r != -1) {
-				if (r == 256)
-					fatal2x_cannot("readlink ./log/supervise", ": name too long");
-				buf[r] = 0;
-				fd = xopen(".", O_RDONLY|O_NDELAY);
-				xchdir("./log");
-				mkdir(buf, 0700);
-				if (fchdir(fd) == -1)
-					fatal_cannot("change back to service directory");
+			rr = readlink("log/supervise", buf, 256);
+			if (rr != -1) {
+				if (rr == 256) {
+					fatal2x_cannot(r, "readlink ./log/supervise", ": name too long");
+					goto err;
+				}
+				buf[rr] = 0;
+				fd = open(".", O_RDONLY|O_NDELAY);
+				if (fd < 0) {
+					fatal_cannot(r, "open service directory");
+					goto err;
+				}
+				if (chdir("./log") == 0) {
+					mkdir(buf, 0700);
+					if (fchdir(fd) == -1) {
+						fatal_cannot(r, "change back to service directory");
+						xfunc_die();
+					}
+				}
 				close(fd);
 			}
 			else {
-				if ((errno != ENOENT) && (errno != EINVAL))
-					fatal_cannot("readlink ./log/supervise");
+				if ((errno != ENOENT) && (errno != EINVAL)) {
+					fatal_cannot(r, "readlink ./log/supervise");
+					goto err;
+				}
 			}
 		}
-		svd[1].fdlock = xopen3("log/supervise/lock",
-				O_WRONLY|O_NDELAY|O_APPEND|O_CREAT, 0600);
-		if (flock(svd[1].fdlock, LOCK_EX) == -1)
-			fatal_cannot("lock log/supervise/lock");
-		close_on_exec_on(svd[1].fdlock);
+		if (open_lock(r, "log/supervise/lock", &r->svd[1], LOCK_EX))
+			goto err;
+	}
+
+	if (open_control(r, "log/supervise/control"+4, &r->svd[0]))
+		goto err;
+	if (r->haslog) {
+		if (open_control(r, "log/supervise/control", &r->svd[1]))
+			goto err;
+	}
+	if (open_ok(r, "log/supervise/ok"+4, &r->svd[0]))
+		goto err;
+	if (r->haslog) {
+		if (open_ok(r, "log/supervise/ok", &r->svd[1]))
+			goto err;
+	}
+	return r;
+ err:
+	runsv_close(r);
+	return NULL;
+}
+
+static int may_start(struct svdir *s, int *timeout)
+{
+	if (s->held) {
+		int left = (int)(s->hold_until - (unsigned)monotonic_ms());
+		if (left > 0) {
+			if (*timeout < 0 || left < *timeout)
+				*timeout = left;
+			return 0;
+		}
+		s->held = 0;
+	}
+	return 1;
+}
+
+/* Start whatever should be running. Returns poll timeout in ms
+ * until the next held-off restart is due, or -1 if none is pending.
+ */
+int FAST_FUNC runsv_start(runsv_state *r)
+{
+	int timeout = -1;
+
+	if (r->haslog)
+		if (!r->svd[1].pid && r->svd[1].sd_want == W_UP)
+			if (may_start(&r->svd[1], &timeout))
+				startservice(r, &r->svd[1]);
+	if (!r->svd[0].pid)
+		if (r->svd[0].sd_want == W_UP || r->svd[0].state == S_FINISH)
+			if (may_start(&r->svd[0], &timeout))
+				startservice(r, &r->svd[0]);
+	return timeout;
+}
+
+/* Fills up to two pollfds for the control fifos, returns their count */
+int FAST_FUNC runsv_pollfds(runsv_state *r, struct pollfd *x)
+{
+	x[0].fd = r->svd[0].fdcontrol;
+	x[0].events = POLLIN;
+	/* x[1] is used only if haslog == 1 */
+	x[1].fd = r->svd[1].fdcontrol;
+	x[1].events = POLLIN;
+	return 1 + r->haslog;
+}
+
+static void died(runsv_state *r, struct svdir *s)
+{
+	unsigned deadline;
+
+	deadline = s->start.tv_sec + 1;
+	gettimeofday_ns(&s->start);
+	update_status(r, s);
+	if (LESS(s->start.tv_sec, deadline)) {
+		/* Respawning too fast. Instead of sleeping for a second
+		 * (and not reacting to anything), hold off the restart.
+		 */
+		s->held = 1;
+		s->hold_until = (unsigned)monotonic_ms() + 1000;
 	}
+}
+
+/* Is child our ./run or log/run? Works in any current directory */
+int FAST_FUNC runsv_is_child(runsv_state *r, pid_t child)
+{
+	return child == r->svd[0].pid
+		|| (r->haslog && child == r->svd[1].pid);
+}
+
+/* Returns 1 if child was ours (and is now accounted for) */
+int FAST_FUNC runsv_reap(runsv_state *r, pid_t child, int wstat)
+{
+	int fd;
 
-	open_control("log/supervise/control"+4, &svd[0]);
-	if (haslog) {
-		open_control("log/supervise/control", &svd[1]);
+	if (child == r->svd[0].pid) {
+		r->svd[0].wstat = wstat;
+		r->svd[0].pid = 0;
+		r->pidchanged = 1;
+		r->svd[0].ctrl &= ~C_TERM;
+		if (r->svd[0].state != S_FINISH) {
+			fd = open("finish", O_RDONLY|O_NDELAY);
+			if (fd != -1) {
+				close(fd);
+				r->svd[0].state = S_FINISH;
+				update_status(r, &r->svd[0]);
+				return 1;
+			}
+		}
+		r->svd[0].state = S_DOWN;
+		died(r, &r->svd[0]);
+		return 1;
 	}
-	mkfifo("log/supervise/ok"+4, 0600);
-	fd = xopen("log/supervise/ok"+4, O_RDONLY|O_NDELAY);
-	close_on_exec_on(fd);
-	if (haslog) {
-		mkfifo("log/supervise/ok", 0600);
-		fd = xopen("log/supervise/ok", O_RDONLY|O_NDELAY);
-		close_on_exec_on(fd);
+	if (r->haslog) {
+		if (child == r->svd[1].pid) {
+			r->svd[0].wstat = wstat;
+			r->svd[1].pid = 0;
+			r->pidchanged = 1;
+			r->svd[1].state = S_DOWN;
+			r->svd[1].ctrl &= ~C_TERM;
+			died(r, &r->svd[1]);
+			return 1;
+		}
 	}
+	return 0;
+}
+
+/* Act on pending commands in the control fifos */
+void FAST_FUNC runsv_control(runsv_state *r)
+{
+	char ch;
+
+	if (read(r->svd[0].fdcontrol, &ch, 1) == 1)
+		ctrl(r, &r->svd[0], ch);
+	if (r->haslog)
+		if (read(r->svd[1].fdcontrol, &ch, 1) == 1)
+			ctrl(r, &r->svd[1], ch);
+}
+
+/* What runsv does on SIGTERM: stop service, then its log, then exit */
+void FAST_FUNC runsv_exit(runsv_state *r)
+{
+	ctrl(r, &r->svd[0], 'x');
+}
+
+/* Returns 1 when service was asked to exit and it and its log are down */
+int FAST_FUNC runsv_exited(runsv_state *r)
+{
+	if (r->svd[0].sd_want == W_EXIT && r->svd[0].state == S_DOWN) {
+		if (r->svd[1].pid == 0)
+			return 1;
+		if (r->svd[1].sd_want != W_EXIT) {
+			r->svd[1].sd_want = W_EXIT;
+			/* stopservice(&svd[1]); */
+			update_status(r, &r->svd[1]);
+			close(r->logpipe.wr);
+			close(r->logpipe.rd);
+			r->logpipe.rd = r->logpipe.wr = -1;
+		}
+	}
+	return 0;
+}
+
+#if ENABLE_RUNSV
+struct globals {
+	smallint sigterm;
+	struct fd_pair selfpipe;
+} FIX_ALIASING;
+#define G (*(struct globals*)bb_common_bufsiz1)
+#define sigterm      (G.sigterm     )
+#define selfpipe     (G.selfpipe    )
+#define INIT_G() do { \
+	setup_common_bufsiz(); \
+} while (0)
+
+/* SIGCHLD/TERM handler is reentrancy-safe because they are unmasked
+ * only over poll() call, not over memory allocations
+ * or printouts. Do not need to save/restore errno either,
+ * as poll() error is not checked there.
+ */
+static void s_chld_term(int sig_no)
+{
+	if (sig_no == SIGTERM)
+		sigterm = 1;
+	write(selfpipe.wr, "", 1);
+}
+
+int runsv_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
+int runsv_main(int argc UNUSED_PARAM, char **argv)
+{
+	runsv_state *r;
+	char *dir;
+
+	INIT_G();
+
+	dir = single_argv(argv);
+
+	xpiped_pair(selfpipe);
+	close_on_exec_on(selfpipe.rd);
+	close_on_exec_on(selfpipe.wr);
+	ndelay_on(selfpipe.rd);
+	ndelay_on(selfpipe.wr);
+
+	sig_block(SIGCHLD);
+	sig_block(SIGTERM);
+	/* No particular reason why we don't set SA_RESTART
+	 * (poll() wouldn't restart regardless of that flag),
+	 * we just follow what runit-2.1.2 does:
+	 */
+	bb_signals_norestart(0
+			+ (1 << SIGCHLD)
+			+ (1 << SIGTERM)
+			, s_chld_term);
+
+	xchdir(dir);
+	r = runsv_open(dir);
+	if (!r)
+		xfunc_die();
+
 	for (;;) {
 		struct pollfd x[3];
-		unsigned deadline;
+		int timeout;
 		char ch;
 
-		if (haslog)
-			if (!svd[1].pid && svd[1].sd_want == W_UP)
-				startservice(&svd[1]);
-		if (!svd[0].pid)
-			if (svd[0].sd_want == W_UP || svd[0].state == S_FINISH)
-				startservice(&svd[0]);
+		timeout = runsv_start(r);
+		if (timeout < 0) /* no restart is being held off */
+			timeout = 3600*1000;
 
 		x[0].fd = selfpipe.rd;
 		x[0].events = POLLIN;
-		x[1].fd = svd[0].fdcontrol;
-		x[1].events = POLLIN;
-		/* x[2] is used only if haslog == 1 */
-		x[2].fd = svd[1].fdcontrol;
-		x[2].events = POLLIN;
 		sig_unblock(SIGTERM);
 		sig_unblock(SIGCHLD);
-		poll(x, 2 + haslog, 3600*1000);
+		poll(x, 1 + runsv_pollfds(r, x + 1), timeout);
 		/* NB: signal handlers can trash errno of poll() */
 		sig_block(SIGTERM);
 		sig_block(SIGCHLD);
@@ -651,65 +896,19 @@ int runsv_main(int argc UNUSED_PARAM, char **argv)
 				break;
 			if ((child == -1) && (errno != EINTR))
 				break;
-			if (child == svd[0].pid) {
-				svd[0].wstat = wstat;
-				svd[0].pid = 0;
-				pidchanged = 1;
-				svd[0].ctrl &= ~C_TERM;
-				if (svd[0].state != S_FINISH) {
-					fd = open("finish", O_RDONLY|O_NDELAY);
-					if (fd != -1) {
-						close(fd);
-						svd[0].state = S_FINISH;
-						update_status(&svd[0]);
-						continue;
-					}
-				}
-				svd[0].state = S_DOWN;
-				deadline = svd[0].start.tv_sec + 1;
-				gettimeofday_ns(&svd[0].start);
-				update_status(&svd[0]);
-				if (LESS(svd[0].start.tv_sec, deadline))
-					sleep1();
-			}
-			if (haslog) {
-				if (child == svd[1].pid) {
-					svd[0].wstat = wstat;
-					svd[1].pid = 0;
-					pidchanged = 1;
-					svd[1].state = S_DOWN;
-					svd[1].ctrl &= ~C_TERM;
-					deadline = svd[1].start.tv_sec + 1;
-					gettimeofday_ns(&svd[1].start);
-					update_status(&svd[1]);
-					if (LESS(svd[1].start.tv_sec, deadline))
-						sleep1();
-				}
-			}
+			runsv_reap(r, child, wstat);
 		} /* for (;;) */
-		if (read(svd[0].fdcontrol, &ch, 1) == 1)
-			ctrl(&svd[0], ch);
-		if (haslog)
-			if (read(svd[1].fdcontrol, &ch, 1) == 1)
-				ctrl(&svd[1], ch);
+		runsv_control(r);
 
 		if (sigterm) {
-			ctrl(&svd[0], 'x');
+			runsv_exit(r);
 			sigterm = 0;
 		}
 
-		if (svd[0].sd_want == W_EXIT && svd[0].state == S_DOWN) {
-			if (svd[1].pid == 0)
-				_exit_SUCCESS();
-			if (svd[1].sd_want != W_EXIT) {
-				svd[1].sd_want = W_EXIT;
-				/* stopservice(&svd[1]); */
-				update_status(&svd[1]);
-				close(logpipe.wr);
-				close(logpipe.rd);
-			}
-		}
+		if (runsv_exited(r))
+			_exit_SUCCESS();
 	} /* for (;;) */
 	/* not reached */
 	return 0;
 }
+#endif
@@ -43,16 +43,30 @@ ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //config:	Enable feature where second parameter of runsvdir holds last error
 //config:	message (viewable via top/ps). Otherwise (feature is off
 //config:	or no parameter), error messages go to stderr only.
+//config:
+//config:config FEATURE_RUNSVDIR_SUPERVISE
+//config:	bool "Supervise services without runsv processes (-S)"
+//config:	depends on RUNSVDIR
+//config:	default y
+//config:	help
+//config:	With -S, runsvdir supervises all services itself, in one
+//config:	event loop, instead of starting one runsv per service.
+//config:	supervise/ directories are maintained exactly as runsv does,
+//config:	so sv works as usual. Saves one process per service.
 
 //applet:IF_RUNSVDIR(APPLET(runsvdir, BB_DIR_USR_BIN, BB_SUID_DROP))
 
 //kbuild:lib-$(CONFIG_RUNSVDIR) += runsvdir.o
+//kbuild:lib-$(CONFIG_FEATURE_RUNSVDIR_SUPERVISE) += runsv.o
 
 //usage:#define runsvdir_trivial_usage
-//usage:       "[-P] [-s SCRIPT] DIR"
+//usage:       "[-P"IF_FEATURE_RUNSVDIR_SUPERVISE("S")"] [-s SCRIPT] DIR"
 //usage:#define runsvdir_full_usage "\n\n"
 //usage:       "Start a runsv process for each subdirectory. If it exits, restart it.\n"
 //usage:     "\n	-P		Put each runsv in a new session"
+//usage:	IF_FEATURE_RUNSVDIR_SUPERVISE(
+//usage:     "\n	-S		Supervise services directly, without runsv processes"
+//usage:	)
 //usage:     "\n	-s SCRIPT	Run SCRIPT <signo> after signal is processed"
 
 #include <sys/file.h>
@@ -72,6 +86,13 @@ struct service {
 	ino_t ino;
 	pid_t pid;
 	smallint isgone;
+#if ENABLE_FEATURE_RUNSVDIR_SUPERVISE
+	/* -S: */
+	smallint exiting;
+	int dirfd;
+	char *name;
+	runsv_state *rs;
+#endif
 };
 
 struct globals {
@@ -83,6 +104,13 @@ struct globals {
 	struct fd_pair logpipe;
 	struct pollfd pfd[1];
 	unsigned stamplog;
+#endif
+	int curdir;
+	int exitcode;
+#if ENABLE_FEATURE_RUNSVDIR_SUPERVISE
+	struct fd_pair selfpipe;
+	struct pollfd *svpfd;
+	sigset_t oldmask;
 #endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
@@ -93,8 +121,15 @@ struct globals {
 #define logpipe     (G.logpipe     )
 #define pfd         (G.pfd         )
 #define stamplog    (G.stamplog    )
+#define curdir      (G.curdir      )
+#define exitcode    (G.exitcode    )
+#define selfpipe    (G.selfpipe    )
+#define svpfd       (G.svpfd       )
+#define oldmask     (G.oldmask     )
 #define INIT_G() do { setup_common_bufsiz(); } while (0)
 
+#define OPT_S (ENABLE_FEATURE_RUNSVDIR_SUPERVISE && (option_mask32 & 4))
+
 static void fatal2_cannot(const char *m1, const char *m2)
 {
 	bb_perror_msg_and_die("%s: fatal: can't %s%s", svdir, m1, m2);
@@ -149,6 +184,196 @@ static NOINLINE pid_t runsv(const char *name)
 	return pid;
 }
 
+#if ENABLE_FEATURE_RUNSVDIR_SUPERVISE
+/* -S mode: we are runsv for every service.
+ * Children (./run, ./finish, log/run) are ours, control fifos
+ * and supervise/ files are handled by runsv.c code, which expects
+ * to run in the service directory - hence all the fchdir'ing.
+ */
+static void record_signo_and_wake(int signo)
+{
+	if (signo != SIGCHLD)
+		bb_got_signal = signo;
+	write(selfpipe.wr, "", 1);
+}
+
+static NOINLINE int open_sv(struct service *s, const char *name, int back_fd)
+{
+	s->exiting = 0;
+	s->pid = 0;
+	s->rs = NULL;
+	/* If we got signaled, stop spawning children at once! */
+	if (bb_got_signal)
+		return 1;
+	s->dirfd = open(name, O_RDONLY|O_NDELAY);
+	if (s->dirfd < 0) {
+		warn2_cannot("open ", name);
+		return 1;
+	}
+	close_on_exec_on(s->dirfd);
+	s->name = xstrdup(name);
+	if (fchdir(s->dirfd) == 0)
+		s->rs = runsv_open(s->name);
+	else
+		warn2_cannot("change directory to ", name);
+	xfchdir(back_fd);
+	if (!s->rs) {
+		close(s->dirfd);
+		free(s->name);
+		return 1; /* retry on next rescan */
+	}
+	return 0;
+}
+
+static void drop_sv(int i)
+{
+	if (sv[i].rs) {
+		runsv_close(sv[i].rs);
+		close(sv[i].dirfd);
+		free(sv[i].name);
+	}
+	svnum--;
+	sv[i] = sv[svnum];
+}
+
+static void exit_sv(struct service *s)
+{
+	if (s->rs && !s->exiting) {
+		s->exiting = 1;
+		xfchdir(s->dirfd);
+		runsv_exit(s->rs);
+	}
+}
+
+/* Returns ms until the earliest held-off restart, or -1 */
+static NOINLINE int tend_services(int *need_rescan)
+{
+	int i;
+	int timeout = -1;
+
+	for (i = 0; i < svnum; i++) {
+		int t;
+
+		if (!sv[i].rs) { /* runsv_open() failed, will be retried */
+			if (exitcode >= 0) {
+				drop_sv(i);
+				i--;
+			}
+			continue;
+		}
+		xfchdir(sv[i].dirfd);
+		runsv_control(sv[i].rs);
+		if (runsv_exited(sv[i].rs)) {
+			drop_sv(i);
+			i--;
+			*need_rescan = 1; /* restart it if it's not gone */
+			continue;
+		}
+		t = runsv_start(sv[i].rs);
+		if (t >= 0 && (timeout < 0 || t < timeout))
+			timeout = t;
+	}
+	xfchdir(curdir);
+	return timeout;
+}
+
+static NOINLINE void reap_services(void)
+{
+	for (;;) {
+		int i;
+		int wstat;
+		pid_t pid = wait_any_nohang(&wstat);
+		if (pid <= 0)
+			break;
+		for (i = 0; i < svnum; i++) {
+			if (sv[i].rs && runsv_is_child(sv[i].rs, pid)) {
+				xfchdir(sv[i].dirfd);
+				runsv_reap(sv[i].rs, pid, wstat);
+				xfchdir(curdir);
+				break;
+			}
+		}
+	}
+}
+
+static NOINLINE void poll_services(unsigned timeout)
+{
+	int i, n;
+
+	svpfd = xrealloc(svpfd, (2 + 2 * svnum) * sizeof(svpfd[0]));
+	svpfd[0].fd = selfpipe.rd;
+	svpfd[0].events = POLLIN;
+	n = 1;
+#if ENABLE_FEATURE_RUNSVDIR_LOG
+	if (rplog)
+		svpfd[n++] = pfd[0];
+#endif
+	for (i = 0; i < svnum; i++)
+		if (sv[i].rs)
+			n += runsv_pollfds(sv[i].rs, svpfd + n);
+
+	sig_unblock(SIGTERM);
+	sig_unblock(SIGCHLD);
+	poll(svpfd, n, timeout);
+	sig_block(SIGTERM);
+	sig_block(SIGCHLD);
+
+	while (read(selfpipe.rd, &i, 1) == 1)
+		continue;
+#if ENABLE_FEATURE_RUNSVDIR_LOG
+	if (rplog)
+		pfd[0].revents = svpfd[1].revents;
+#endif
+}
+
+static void setup_supervise(bool i_am_init)
+{
+	struct rlimit rl;
+	sigset_t set;
+
+	/* A dozen fds per service: make sure we won't run out */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	xpiped_pair(selfpipe);
+	close_on_exec_on(selfpipe.rd);
+	close_on_exec_on(selfpipe.wr);
+	ndelay_on(selfpipe.rd);
+	ndelay_on(selfpipe.wr);
+
+	/* As in runsv: SIGCHLD and SIGTERM are only unmasked over poll(),
+	 * children we start unmask them before exec.
+	 */
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGTERM);
+	sigprocmask(SIG_BLOCK, &set, &oldmask);
+	bb_signals_norestart(0
+		| (1 << SIGCHLD)
+		| (1 << SIGTERM)
+		| (1 << SIGHUP)
+		| (i_am_init ? ((1 << SIGUSR1) | (1 << SIGUSR2) | (1 << SIGINT)) : 0)
+		, record_signo_and_wake);
+}
+#else
+# define open_sv(s, name, back_fd) 0
+# define reap_services() ((void)0)
+# define tend_services(need_rescan) (-1)
+# define poll_services(timeout) ((void)(timeout))
+# define setup_supervise(i_am_init) ((void)0)
+#endif
+
+static int sv_running(struct service *s)
+{
+#if ENABLE_FEATURE_RUNSVDIR_SUPERVISE
+	if (OPT_S)
+		return s->rs != NULL;
+#endif
+	return s->pid != 0;
+}
+
 /* gcc 4.3.0 does better with NOINLINE */
 static NOINLINE int do_rescan(void)
 {
@@ -186,7 +411,7 @@ static NOINLINE int do_rescan(void)
 			 && sv[i].dev == s.st_dev
 #endif
 			) {
-				if (sv[i].pid == 0) /* restart if it has died */
+				if (!sv_running(&sv[i])) /* restart if it has died */
 					goto run_ith_sv;
 				sv[i].isgone = 0; /* "we still see you" */
 				goto next_dentry;
@@ -206,7 +431,10 @@ static NOINLINE int do_rescan(void)
 #endif
 			sv[i].ino = s.st_ino;
  run_ith_sv:
-			sv[i].pid = runsv(d->d_name);
+			if (OPT_S)
+				need_rescan |= open_sv(&sv[i], d->d_name, dirfd(dir));
+			else
+				sv[i].pid = runsv(d->d_name);
 			sv[i].isgone = 0;
 		}
  next_dentry: ;
@@ -223,6 +451,13 @@ static NOINLINE int do_rescan(void)
 	for (i = 0; i < svnum; i++) {
 		if (!sv[i].isgone)
 			continue;
+#if ENABLE_FEATURE_RUNSVDIR_SUPERVISE
+		if (OPT_S && sv[i].rs) {
+			/* Entry goes away once service and its log are down */
+			exit_sv(&sv[i]);
+			continue;
+		}
+#endif
 		if (sv[i].pid)
 			kill(sv[i].pid, SIGTERM);
 		svnum--;
@@ -239,7 +474,6 @@ int runsvdir_main(int argc UNUSED_PARAM, char **argv)
 	dev_t last_dev = last_dev; /* for gcc */
 	ino_t last_ino = last_ino; /* for gcc */
 	time_t last_mtime;
-	int curdir;
 	unsigned stampcheck;
 	int i;
 	int need_rescan;
@@ -250,25 +484,29 @@ int runsvdir_main(int argc UNUSED_PARAM, char **argv)
 
 	opt_s_argv[0] = NULL;
 	opt_s_argv[2] = NULL;
-	getopt32(argv, "^" "Ps:" "\0" "-1", &opt_s_argv[0]);
+	getopt32(argv, "^" "Ps:"IF_FEATURE_RUNSVDIR_SUPERVISE("S") "\0" "-1", &opt_s_argv[0]);
 	argv += optind;
 
 	i_am_init = (getpid() == 1);
-	bb_signals(0
-		| (1 << SIGTERM)
-		| (1 << SIGHUP)
-		/* For busybox's init, SIGTERM == reboot,
-		 * SIGUSR1 == halt,
-		 * SIGUSR2 == poweroff,
-		 * Ctlr-ALt-Del sends SIGINT to init,
-		 * so we need to intercept SIGUSRn and SIGINT too.
-		 * Note that we do not implement actual reboot
-		 * (killall(TERM) + umount, etc), we just pause
-		 * respawing and avoid exiting (-> making kernel oops).
-		 * The user is responsible for the rest.
-		 */
-		| (i_am_init ? ((1 << SIGUSR1) | (1 << SIGUSR2) | (1 << SIGINT)) : 0)
-		, record_signo);
+	if (OPT_S) {
+		setup_supervise(i_am_init);
+	} else {
+		bb_signals(0
+			| (1 << SIGTERM)
+			| (1 << SIGHUP)
+			/* For busybox's init, SIGTERM == reboot,
+			 * SIGUSR1 == halt,
+			 * SIGUSR2 == poweroff,
+			 * Ctlr-ALt-Del sends SIGINT to init,
+			 * so we need to intercept SIGUSRn and SIGINT too.
+			 * Note that we do not implement actual reboot
+			 * (killall(TERM) + umount, etc), we just pause
+			 * respawing and avoid exiting (-> making kernel oops).
+			 * The user is responsible for the rest.
+			 */
+			| (i_am_init ? ((1 << SIGUSR1) | (1 << SIGUSR2) | (1 << SIGINT)) : 0)
+			, record_signo);
+	}
 	svdir = *argv++;
 
 #if ENABLE_FEATURE_RUNSVDIR_LOG
@@ -306,27 +544,33 @@ int runsvdir_main(int argc UNUSED_PARAM, char **argv)
 	stampcheck = monotonic_sec();
 	need_rescan = 1;
 	last_mtime = 0;
+	exitcode = -1;
 
 	for (;;) {
 		unsigned now;
 		unsigned sig;
+		int timeout = -1;
 
-		/* collect children */
-		for (;;) {
-			pid_t pid = wait_any_nohang(NULL);
-			if (pid <= 0)
-				break;
-			for (i = 0; i < svnum; i++) {
-				if (pid == sv[i].pid) {
-					/* runsv has died */
-					sv[i].pid = 0;
-					need_rescan = 1;
+		if (OPT_S) {
+			reap_services();
+		} else {
+			/* collect children */
+			for (;;) {
+				pid_t pid = wait_any_nohang(NULL);
+				if (pid <= 0)
+					break;
+				for (i = 0; i < svnum; i++) {
+					if (pid == sv[i].pid) {
+						/* runsv has died */
+						sv[i].pid = 0;
+						need_rescan = 1;
+					}
 				}
 			}
 		}
 
 		now = monotonic_sec();
-		if ((int)(now - stampcheck) >= 0) {
+		if ((int)(now - stampcheck) >= 0 && exitcode < 0) {
 			/* wait at least a second */
 			stampcheck = now + 1;
 
@@ -358,6 +602,13 @@ int runsvdir_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 
+		if (OPT_S) {
+			timeout = tend_services(&need_rescan);
+			/* Exiting, and all services are down? */
+			if (exitcode >= 0 && svnum == 0)
+				return exitcode;
+		}
+
 #if ENABLE_FEATURE_RUNSVDIR_LOG
 		if (rplog) {
 			if ((int)(now - stamplog) >= 0) {
@@ -369,6 +620,9 @@ int runsvdir_main(int argc UNUSED_PARAM, char **argv)
 #endif
 		{
 			unsigned deadline = (need_rescan ? 1 : 5);
+			if (OPT_S)
+				poll_services((unsigned)timeout < deadline*1000 ? timeout : deadline*1000);
+			else
 #if ENABLE_FEATURE_RUNSVDIR_LOG
 			if (rplog)
 				poll(pfd, 1, deadline*1000);
@@ -402,8 +656,21 @@ int runsvdir_main(int argc UNUSED_PARAM, char **argv)
 
 			/* Single parameter: signal# */
 			opt_s_argv[1] = utoa(sig);
+#if ENABLE_FEATURE_RUNSVDIR_SUPERVISE
+			if (OPT_S) {
+				/* SCRIPT should not inherit our blocked signals */
+				sigset_t set;
+				sigprocmask(SIG_SETMASK, &oldmask, &set);
+				pid = spawn(opt_s_argv);
+				sigprocmask(SIG_SETMASK, &set, NULL);
+			} else
+#endif
 			pid = spawn(opt_s_argv);
 			if (pid > 0) {
+				/* -S: children are services, don't reap them here */
+				if (OPT_S)
+					safe_waitpid(pid, NULL, 0);
+				else
 				/* Remembering to wait for _any_ children,
 				 * not just pid */
 				while (wait(NULL) != pid)
@@ -411,6 +678,21 @@ int runsvdir_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 
+#if ENABLE_FEATURE_RUNSVDIR_SUPERVISE
+		if (OPT_S) {
+			/* We can't leave services unsupervised:
+			 * stop them all, exit when they are down */
+			if (sig == SIGHUP || !i_am_init) {
+				for (i = 0; i < svnum; i++)
+					exit_sv(&sv[i]);
+				xfchdir(curdir);
+			}
+			if (!i_am_init)
+				exitcode = (SIGHUP == sig) ? 111 : EXIT_SUCCESS;
+			continue;
+		}
+#endif
+
 		if (sig == SIGHUP) {
 			for (i = 0; i < svnum; i++)
 				if (sv[i].pid)
@@ -60,6 +60,12 @@ ttimeout
 !processor
     tells svlogd to feed each recent log file through processor
     (see above) on log file rotation. By default log files are not processed.
+z
+    tells svlogd to gzip each recent log file on log file rotation.
+    Unlike !gzip, this doesn't make svlogd wait for the previous file
+    to be compressed before it can rotate again: files are queued,
+    and up to -j of them (over all log directories) are compressed
+    at once, in the background. Ignored if !processor is set.
 ua.b.c.d[:port]
     tells svlogd to transmit the first len characters of selected
     log messages to the IP address a.b.c.d, port number port.
@@ -130,13 +136,32 @@ log message, you can use a pattern like this instead
 //config:	svlogd continuously reads log data from its standard input, optionally
 //config:	filters log messages, and writes the data to one or more automatically
 //config:	rotated logs.
+//config:
+//config:config FEATURE_SVLOGD_SPLICE
+//config:	bool "Move unmodified log data with splice()"
+//config:	default y
+//config:	depends on SVLOGD
+//config:	help
+//config:	If stdin is a pipe and there is only one log directory,
+//config:	without timestamps, filters and character replacement,
+//config:	let the kernel move data from stdin to the log file
+//config:	instead of copying it through userspace.
+//config:
+//config:config FEATURE_SVLOGD_COMPRESS
+//config:	bool "Built-in background compression of rotated logs"
+//config:	default y
+//config:	depends on SVLOGD
+//config:	help
+//config:	Support "z" in DIR/config: gzip rotated log files
+//config:	in background workers instead of through !processor,
+//config:	so that rotation never waits for compression.
 
 //applet:IF_SVLOGD(APPLET(svlogd, BB_DIR_USR_SBIN, BB_SUID_DROP))
 
 //kbuild:lib-$(CONFIG_SVLOGD) += svlogd.o
 
 //usage:#define svlogd_trivial_usage
-//usage:       "[-tttv] [-r C] [-R CHARS] [-l MATCHLEN] [-b BUFLEN] DIR..."
+//usage:       "[-tttv] [-r C] [-R CHARS] [-l MATCHLEN] [-b BUFLEN]"IF_FEATURE_SVLOGD_COMPRESS(" [-j N]")" DIR..."
 //usage:#define svlogd_full_usage "\n\n"
 //usage:       "Read log data from stdin and write to rotated log files in DIRs"
 //usage:   "\n"
@@ -146,6 +171,9 @@ log message, you can use a pattern like this instead
 //usage:   "\n""	-tt	Timestamp with yyyy-mm-dd_hh:mm:ss.sssss"
 //usage:   "\n""	-ttt	Timestamp with yyyy-mm-ddThh:mm:ss.sssss"
 //usage:   "\n""	-v	Verbose"
+//usage:	IF_FEATURE_SVLOGD_COMPRESS(
+//usage:   "\n""	-j N	Run up to N compressors at once (default 2)"
+//usage:	)
 //usage:   "\n"
 //usage:   "\n""DIR/config file modifies behavior:"
 //usage:   "\n""sSIZE - when to rotate logs (default 1000000, 0 disables)"
@@ -153,6 +181,9 @@ log message, you can use a pattern like this instead
 ///////:   "\n""NNUM - min number files to retain" - confusing
 ///////:   "\n""tSEC - rotate file if it get SEC seconds old" - confusing
 //usage:   "\n""!PROG - process rotated log with PROG"
+//usage:	IF_FEATURE_SVLOGD_COMPRESS(
+//usage:   "\n""z - gzip rotated logs in background"
+//usage:	)
 ///////:   "\n""uIPADDR - send log over UDP" - unsupported
 ///////:   "\n""UIPADDR - send log over UDP and DONT log" - unsupported
 ///////:   "\n""pPFX - prefix each line with PFX" - unsupported
@@ -184,12 +215,29 @@ struct logdir {
 	int fdcur;
 	FILE* filecur; ////
 	int fdlock;
+#if ENABLE_FEATURE_SVLOGD_SPLICE
+	int fdsplice;
+	loff_t spliceofs;
+#endif
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+	smallint compress;
+	/* rotated files may be waiting for compression */
+	smallint zpending;
+#endif
 	unsigned next_rotate;
 	char fnsave[FMT_PTIME];
 	char match;
 	char matcherr;
 };
 
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+struct zworker {
+	pid_t pid;
+	struct logdir *ld;
+	char fn[FMT_PTIME];
+};
+#endif
+
 
 struct globals {
 	struct logdir *dir;
@@ -216,6 +264,15 @@ struct globals {
 	const char *replace;
 	int fl_flag_0;
 	unsigned dirn;
+	unsigned timestamp;
+#if ENABLE_FEATURE_SVLOGD_SPLICE
+	smallint stdin_is_pipe;
+	smallint nosplice;
+#endif
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+	unsigned zmax;
+	struct zworker *zw;
+#endif
 
 	sigset_t blocked_sigset;
 };
@@ -240,6 +297,7 @@ struct globals {
 #define blocked_sigset (G.blocked_sigset)
 #define fl_flag_0      (G.fl_flag_0     )
 #define dirn           (G.dirn          )
+#define timestamp      (G.timestamp     )
 #define line bb_common_bufsiz1
 #define INIT_G() do { \
 	setup_common_bufsiz(); \
@@ -248,6 +306,7 @@ struct globals {
 	/*buflen = 1024;*/ \
 	linecomplete = 1; \
 	replace = ""; \
+	IF_FEATURE_SVLOGD_COMPRESS(G.zmax = 2;) \
 } while (0)
 
 
@@ -505,6 +564,179 @@ static unsigned processorstop(struct logdir *ld)
 	return 1;
 }
 
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+/* Is fn (any suffix) being compressed by a worker? */
+static struct zworker *zworker_find(struct logdir *ld, const char *fn)
+{
+	unsigned i;
+
+	for (i = 0; i < G.zmax; i++) {
+		struct zworker *w = &G.zw[i];
+		if (w->pid && w->ld == ld && memcmp(w->fn, fn, 26) == 0)
+			return w;
+	}
+	return NULL;
+}
+
+/* Start compressing the oldest rotated file of ld which is not
+ * being compressed yet. Returns 0 if there is no such file.
+ */
+static int zworker_start(struct zworker *w, struct logdir *ld)
+{
+	DIR *d;
+	struct dirent *f;
+	char tmp[FMT_PTIME];
+	int pid;
+
+	while (fchdir(ld->fddir) == -1)
+		pause2cannot("change directory, want compress", ld->name);
+	w->fn[0] = 'A'; w->fn[1] = w->fn[27] = '\0';
+	d = opendir(".");
+	if (d) {
+		while ((f = readdir(d))) {
+			if ((f->d_name[0] == '@') && (strlen(f->d_name) == 27)
+			 && (f->d_name[26] == 'u')
+			 && (strcmp(f->d_name, w->fn) < 0)
+			 && !zworker_find(ld, f->d_name)
+			) {
+				memcpy(w->fn, f->d_name, 27);
+			}
+		}
+		closedir(d);
+	}
+	if (w->fn[0] != '@')
+		goto ret;
+
+	memcpy(tmp, w->fn, 28);
+	tmp[26] = 't';
+	while ((pid = vfork()) == -1)
+		pause2cannot("vfork for compressor", ld->name);
+	if (!pid) {
+		/* child */
+		static const char *const gzip_argv[] = { "gzip", NULL };
+		int fd;
+
+		sigprocmask(SIG_UNBLOCK, &blocked_sigset, NULL);
+		fd = open_or_warn(w->fn, O_RDONLY|O_NDELAY);
+		if (fd < 0)
+			_exit(1);
+		xmove_fd(fd, 0);
+		fd = xopen(tmp, O_WRONLY|O_NDELAY|O_TRUNC|O_CREAT);
+		xmove_fd(fd, 1);
+		BB_EXECVP((char*)gzip_argv[0], (char**)gzip_argv);
+		bb_perror_msg_and_die(FATAL"can't %s processor %s", "run", "gzip");
+	}
+	if (verbose)
+		bb_error_msg(INFO"compressing: %s/%s", ld->name, w->fn);
+	w->pid = pid;
+	w->ld = ld;
+ ret:
+	while (fchdir(fdwdir) == -1)
+		pause1cannot("change to initial working directory");
+	return (w->pid != 0);
+}
+
+static void rmoldest(struct logdir *ld);
+
+static void zworker_done(struct zworker *w, int status)
+{
+	struct logdir *ld = w->ld;
+	char f[FMT_PTIME];
+
+	w->pid = 0;
+	if (ld->fddir == -1)
+		return; /* logdir_open() will pick it up again */
+	while (fchdir(ld->fddir) == -1)
+		pause2cannot("change directory, want compress", ld->name);
+	memcpy(f, w->fn, 28);
+	f[26] = 't';
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		/* Compressed data replaces the file */
+		w->fn[26] = 's';
+		if (rename(f, w->fn) == 0) {
+			chmod(w->fn, 0744);
+			w->fn[26] = 'u';
+			unlink(w->fn);
+			if (verbose)
+				bb_error_msg(INFO"compressed: %s/%s", ld->name, w->fn);
+		}
+	} else {
+		/* Don't retry forever: keep it uncompressed */
+		warnx("compressor failed", ld->name);
+		unlink(f);
+		memcpy(f, w->fn, 28);
+		f[26] = 's';
+		rename(w->fn, f);
+	}
+	/* rmoldest() did not count it while it was being compressed */
+	rmoldest(ld);
+	while (fchdir(fdwdir) == -1)
+		pause1cannot("change to initial working directory");
+}
+
+static void zworkers_kick(void)
+{
+	unsigned i, l;
+
+	for (l = 0; l < dirn; ++l) {
+		struct logdir *ld = &dir[l];
+
+		while (ld->zpending) {
+			for (i = 0; i < G.zmax; i++)
+				if (!G.zw[i].pid)
+					break;
+			if (i == G.zmax)
+				return; /* all busy */
+			if (ld->fddir == -1 || !zworker_start(&G.zw[i], ld))
+				ld->zpending = 0;
+		}
+	}
+}
+
+static int zworker_reap(pid_t pid)
+{
+	unsigned i;
+
+	for (i = 0; i < G.zmax; i++) {
+		if (G.zw[i].pid == pid) {
+			zworker_done(&G.zw[i], wstat);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void zworkers_wait(void)
+{
+	unsigned i;
+
+	for (i = 0; i < G.zmax; i++) {
+		if (G.zw[i].pid) {
+			while (safe_waitpid(G.zw[i].pid, &wstat, 0) == -1)
+				pause2cannot("wait for compressor", G.zw[i].ld->name);
+			zworker_done(&G.zw[i], wstat);
+		}
+	}
+}
+#else
+# define zworker_find(ld, fn) 0
+# define zworkers_kick() ((void)0)
+# define zworker_reap(pid) 0
+# define zworkers_wait() ((void)0)
+#endif
+
+#if ENABLE_FEATURE_SVLOGD_SPLICE
+static void splice_close(struct logdir *ld)
+{
+	if (ld->fdsplice >= 0) {
+		close(ld->fdsplice);
+		ld->fdsplice = -1;
+	}
+}
+#else
+# define splice_close(ld) ((void)0)
+#endif
+
 static void rmoldest(struct logdir *ld)
 {
 	DIR *d;
@@ -518,6 +750,10 @@ static void rmoldest(struct logdir *ld)
 	errno = 0;
 	while ((f = readdir(d))) {
 		if ((f->d_name[0] == '@') && (strlen(f->d_name) == 27)) {
+			/* .u being compressed will come back as .s, its .t
+			 * is not a leftover: leave both alone */
+			if (zworker_find(ld, f->d_name))
+				continue;
 			if (f->d_name[26] == 't') {
 				if (unlink(f->d_name) == -1)
 					warn2("can't unlink processor leftover", f->d_name);
@@ -560,7 +796,7 @@ static unsigned rotate(struct logdir *ld)
 	/* create new filename */
 	ld->fnsave[25] = '.';
 	ld->fnsave[26] = 's';
-	if (ld->processor)
+	if (ld->processor IF_FEATURE_SVLOGD_COMPRESS(|| ld->compress))
 		ld->fnsave[26] = 'u';
 	ld->fnsave[27] = '\0';
 	do {
@@ -583,6 +819,7 @@ static unsigned rotate(struct logdir *ld)
 			pause2cannot("set mode of current", ld->name);
 		////close(ld->fdcur);
 		fclose(ld->filecur);
+		splice_close(ld);
 
 		if (verbose) {
 			bb_error_msg(INFO"rename: %s/current %s %u", ld->name,
@@ -602,6 +839,10 @@ static unsigned rotate(struct logdir *ld)
 
 		rmoldest(ld);
 		processorstart(ld);
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+		if (ld->compress)
+			ld->zpending = 1;
+#endif
 	}
 
 	while (fchdir(fdwdir) == -1)
@@ -693,6 +934,7 @@ static void logdir_close(struct logdir *ld)
 		pause2cannot("set mode of current", ld->name);
 	////close(ld->fdcur);
 	fclose(ld->filecur);
+	splice_close(ld);
 	ld->fdcur = -1;
 	if (ld->fdlock == -1)
 		return; /* impossible */
@@ -742,6 +984,7 @@ static NOINLINE unsigned logdir_open(struct logdir *ld, const char *fn)
 	ld->name = (char*)fn;
 	ld->ppid = 0;
 	ld->match = '+';
+	IF_FEATURE_SVLOGD_COMPRESS(ld->compress = ld->zpending = 0;)
 	free(ld->inst); ld->inst = NULL;
 	free(ld->processor); ld->processor = NULL;
 
@@ -809,9 +1052,20 @@ static NOINLINE unsigned logdir_open(struct logdir *ld, const char *fn)
 					ld->processor = wstrdup(&s[1]);
 				}
 				break;
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+			case 'z':
+				ld->compress = 1;
+				break;
+#endif
 			}
 			s = np;
 		}
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+		if (ld->processor)
+			ld->compress = 0;
+		/* Pick up files left uncompressed by previous run */
+		ld->zpending = ld->compress;
+#endif
 		/* Convert "aa\nbb\ncc\n\0" to "aa\0bb\0cc\0\0" */
 		s = ld->inst;
 		while (s) {
@@ -899,7 +1153,65 @@ static ssize_t ndelay_read(int fd, void *buf, size_t count)
 	return count;
 }
 
-/* Used for reading stdin */
+#if ENABLE_FEATURE_SVLOGD_SPLICE
+/* Nothing to do to the data on its way to the one log directory? */
+static int can_splice(void)
+{
+	struct logdir *ld = &dir[0];
+
+	return G.stdin_is_pipe && !G.nosplice
+		&& dirn == 1 && ld->fddir != -1 && !ld->inst
+		&& !timestamp && !repl
+		/* Close to rotation, find the line end the usual way */
+		&& (!ld->sizemax || ld->size + linemax < ld->sizemax);
+}
+
+static int splice_to_current(struct logdir *ld, unsigned len)
+{
+	ssize_t i;
+	char last;
+
+	if (ld->fdsplice < 0) {
+		/* splice() refuses O_APPEND fds, fdcur is one */
+		while (fchdir(ld->fddir) == -1)
+			pause2cannot("change directory, want splice", ld->name);
+		ld->fdsplice = open("current", O_RDWR|O_NDELAY);
+		while (fchdir(fdwdir) == -1)
+			pause1cannot("change to initial working directory");
+		if (ld->fdsplice < 0)
+			goto nosplice;
+		close_on_exec_on(ld->fdsplice);
+		/* fdcur is unbuffered in splice mode, but if we come
+		 * from a period of filtering/timestamping... */
+		fflush(ld->filecur);
+		ld->spliceofs = lseek(ld->fdsplice, 0, SEEK_END);
+	}
+	i = splice(STDIN_FILENO, NULL, ld->fdsplice, &ld->spliceofs, len,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (i > 0) {
+		if (pread(ld->fdsplice, &last, 1, ld->spliceofs - 1) == 1)
+			linecomplete = (last == '\n');
+		return i;
+	}
+	if (i == 0 || errno == EAGAIN || errno == EINTR)
+		return i;
+ nosplice:
+	/* Filesystem can't do it? Fall back to read+write */
+	if (verbose)
+		bb_perror_msg(INFO"splice: %s", ld->name);
+	G.nosplice = 1;
+	errno = EINTR;
+	return -1;
+}
+#else
+# define can_splice() 0
+# define splice_to_current(ld, len) -1
+#endif
+
+/* Used for reading stdin.
+ * With s == NULL, data is spliced into dir[0] instead;
+ * returns -2 if that is no longer possible.
+ */
 static int buffer_pread(/*int fd, */char *s, unsigned len)
 {
 	unsigned now;
@@ -924,6 +1236,9 @@ static int buffer_pread(/*int fd, */char *s, unsigned len)
 			logdirs_reopen();
 			reopenasap = 0;
 		}
+		if (!s && !can_splice())
+			return -2;
+		zworkers_kick();
 		now = monotonic_sec();
 		nearest_rotate = now + (45 * 60 + 45);
 		for (i = 0; i < dirn; ++i) {
@@ -944,7 +1259,10 @@ static int buffer_pread(/*int fd, */char *s, unsigned len)
 		poll(&input, 1, i * 1000);
 		sigprocmask(SIG_BLOCK, &blocked_sigset, NULL);
 
-		i = ndelay_read(STDIN_FILENO, s, len);
+		if (!s)
+			i = splice_to_current(&dir[0], len);
+		else
+			i = ndelay_read(STDIN_FILENO, s, len);
 		if (i >= 0)
 			break;
 		if (errno == EINTR)
@@ -956,7 +1274,7 @@ static int buffer_pread(/*int fd, */char *s, unsigned len)
 		/* else: EAGAIN - normal, repeat silently */
 	} while (!exitasap);
 
-	if (i > 0) {
+	if (i > 0 && s) {
 		int cnt;
 		linecomplete = (s[i-1] == '\n');
 		if (!repl)
@@ -984,6 +1302,26 @@ static int buffer_pread(/*int fd, */char *s, unsigned len)
 	return i;
 }
 
+#if ENABLE_FEATURE_SVLOGD_SPLICE
+/* buffer_pwrite(), minus the data copying.
+ * Rotation is left to buffer_pwrite(), see can_splice(). */
+static int splice_pwrite(void)
+{
+	struct logdir *ld = &dir[0];
+	unsigned len = 64 * 1024;
+	int i;
+
+	/* can_splice() made sure we are not near ld->sizemax */
+	if (ld->sizemax)
+		if (len > (ld->sizemax - linemax - ld->size))
+			len = ld->sizemax - linemax - ld->size;
+	i = buffer_pread(NULL, len);
+	if (i > 0)
+		ld->size += i;
+	return i;
+}
+#endif
+
 static void sig_term_handler(int sig_no UNUSED_PARAM)
 {
 	if (verbose)
@@ -999,6 +1337,8 @@ static void sig_child_handler(int sig_no UNUSED_PARAM)
 	if (verbose)
 		bb_error_msg(INFO"sig%s received", "child");
 	while ((pid = wait_any_nohang(&wstat)) > 0) {
+		if (zworker_reap(pid))
+			continue;
 		for (l = 0; l < dirn; ++l) {
 			if (dir[l].ppid == pid) {
 				dir[l].ppid = 0;
@@ -1054,13 +1394,14 @@ int svlogd_main(int argc, char **argv)
 	ssize_t stdin_cnt = 0;
 	int i;
 	unsigned opt;
-	unsigned timestamp = 0;
 
 	INIT_G();
 
 	opt = getopt32(argv, "^"
-			"r:R:l:b:tv" "\0" "tt:vv",
-			&r, &replace, &l, &b, &timestamp, &verbose
+			"r:R:l:b:tv"IF_FEATURE_SVLOGD_COMPRESS("j:+") "\0" "tt:vv",
+			&r, &replace, &l, &b
+			IF_FEATURE_SVLOGD_COMPRESS(, &G.zmax)
+			, &timestamp, &verbose
 	);
 	if (opt & 1) { // -r
 		repl = r[0];
@@ -1095,6 +1436,7 @@ int svlogd_main(int argc, char **argv)
 	for (i = 0; i < dirn; ++i) {
 		dir[i].fddir = -1;
 		dir[i].fdcur = -1;
+		IF_FEATURE_SVLOGD_SPLICE(dir[i].fdsplice = -1;)
 		////dir[i].btmp = xmalloc(buflen);
 		/*dir[i].ppid = 0;*/
 	}
@@ -1104,6 +1446,17 @@ int svlogd_main(int argc, char **argv)
 	 * _isn't_ per-process! It is shared among all other processes
 	 * with the same stdin */
 	fl_flag_0 = fcntl(0, F_GETFL);
+#if ENABLE_FEATURE_SVLOGD_SPLICE
+	{
+		struct stat st;
+		G.stdin_is_pipe = (fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode));
+	}
+#endif
+#if ENABLE_FEATURE_SVLOGD_COMPRESS
+	if (G.zmax == 0)
+		G.zmax = 1;
+	G.zw = xzalloc(G.zmax * sizeof(G.zw[0]));
+#endif
 
 	sigemptyset(&blocked_sigset);
 	sigaddset(&blocked_sigset, SIGTERM);
@@ -1136,6 +1489,21 @@ int svlogd_main(int argc, char **argv)
 		int printlen;
 		char ch;
 
+#if ENABLE_FEATURE_SVLOGD_SPLICE
+		if (stdin_cnt == 0 && !exitasap && can_splice()) {
+			i = splice_pwrite();
+			if (i == 0 || i == -1) { /* EOF or error on stdin */
+				exitasap = 1;
+				/* Finish the last line, as the read() path does */
+				if (!linecomplete) {
+					buffer_pwrite(0, (char*)"\n", 1);
+					linecomplete = 1;
+				}
+			}
+			fflush_all();
+			continue;
+		}
+#endif
 		lineptr = line;
 		if (timestamp)
 			lineptr += 26;
@@ -1251,6 +1619,7 @@ int svlogd_main(int argc, char **argv)
 		fflush_all();////
 	}
 
+	zworkers_wait();
 	for (i = 0; i < dirn; ++i) {
 		if (dir[i].ppid)
 			while (!processorstop(&dir[i]))
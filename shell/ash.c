@@ -153,6 +153,40 @@
 //config:	you to run the specified command or builtin,
 //config:	even when there is a function with the same name.
 //config:
+//config:config ASH_NOFORK_SUBST
+//config:	bool "Run simple builtins in $(...) and pipes without forking"
+//config:	default y
+//config:	depends on SHELL_ASH
+//config:	help
+//config:	Run $(cmd), and leading commands of a pipe (cmd | ...),
+//config:	in the shell process itself, without a fork,
+//config:	if cmd is a simple command without assignments and it is
+//config:	echo, printf, test, true, false, pwd, type, or a NOFORK applet
+//config:	(if FEATURE_SH_NOFORK is enabled). The output is collected
+//config:	in a memory-backed file of up to 1 MB; if cmd prints more,
+//config:	it is run again in a subshell. Other commands are run
+//config:	in a subshell as usual.
+//config:
+//config:config ASH_LASTPIPE
+//config:	bool "lastpipe option"
+//config:	default y
+//config:	depends on SHELL_ASH
+//config:	help
+//config:	"set -o lastpipe" runs the last command of a pipeline
+//config:	in the current shell if job control is off, as bash's
+//config:	"shopt -s lastpipe" does: "echo a | read v" sets v.
+//config:
+//config:config ASH_VFORK
+//config:	bool "Start external commands with vfork()"
+//config:	default y
+//config:	depends on SHELL_ASH
+//config:	help
+//config:	Run external commands with vfork() + exec instead of fork(),
+//config:	unless job control is on or the command is a NOEXEC applet.
+//config:	This saves copying the page tables of a big shell
+//config:	for every command, which speeds up scripts that run
+//config:	many external programs.
+//config:
 //config:endif # ash options
 
 //applet:IF_ASH(APPLET(ash, BB_DIR_BIN, BB_SUID_DROP))
@@ -305,9 +339,24 @@ typedef long arith_t;
 
 /* ============ Hash table sizes. Configurable. */
 
-#define VTABSIZE 39
+/* Variable and command tables grow (doubling) when they have
+ * more entries than buckets. Sizes must be powers of 2.
+ */
+#define VTABSIZE 64             /* initial */
 #define ATABSIZE 39
-#define CMDTABLESIZE 31         /* should be prime */
+#define CMDTABLESIZE 32         /* initial */
+
+/* Hash of a string up to NUL or "stop" char */
+static unsigned
+hash_str(const char *p, int stop)
+{
+	unsigned hashval = 0;
+
+	while (*p && *p != stop)
+		hashval = hashval * 31 + (unsigned char) *p++;
+	/* Mix high bits in: tables use the low ones */
+	return hashval ^ (hashval >> 11) ^ (hashval >> 22);
+}
 
 
 /* ============ Shell options */
@@ -343,6 +392,9 @@ static const char *const optletters_optnames[] ALIGN_PTR = {
 #if BASH_PIPEFAIL
 	,"\0"  "pipefail"
 #endif
+#if ENABLE_ASH_LASTPIPE
+	,"\0"  "lastpipe"
+#endif
 #if DEBUG
 	,"\0"  "nolog"
 	,"\0"  "debug"
@@ -441,9 +493,14 @@ struct globals_misc {
 #else
 # define pipefail 0
 #endif
+#if ENABLE_ASH_LASTPIPE
+# define lastpipe optlist[16 + BASH_PIPEFAIL]
+#else
+# define lastpipe 0
+#endif
 #if DEBUG
-# define nolog optlist[16 + BASH_PIPEFAIL]
-# define debug optlist[17 + BASH_PIPEFAIL]
+# define nolog optlist[16 + BASH_PIPEFAIL + ENABLE_ASH_LASTPIPE]
+# define debug optlist[17 + BASH_PIPEFAIL + ENABLE_ASH_LASTPIPE]
 #endif
 
 	/* trap handler commands */
@@ -2164,7 +2221,9 @@ struct globals_var {
 	struct shparam shellparam;      /* $@ current positional parameters */
 	struct redirtab *redirlist;
 	int preverrout_fd;   /* stderr fd: usually 2, unless redirect moved it */
-	struct var *vartab[VTABSIZE];
+	struct var **vartab;
+	unsigned vtabsize;
+	unsigned varcount;
 	struct var varinit[ARRAY_SIZE(varinit_data)];
 	int lineno;
 	char linenovar[sizeof("LINENO=") + sizeof(int)*3];
@@ -2179,6 +2238,8 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 //#define redirlist     (G_var.redirlist    )
 #define preverrout_fd (G_var.preverrout_fd)
 #define vartab        (G_var.vartab       )
+#define vtabsize      (G_var.vtabsize     )
+#define varcount      (G_var.varcount     )
 #define varinit       (G_var.varinit      )
 #define lineno        (G_var.lineno       )
 #define linenovar     (G_var.linenovar    )
@@ -2213,6 +2274,8 @@ extern struct globals_var *BB_GLOBAL_CONST ash_ptr_to_globals_var;
 #define INIT_G_var() do { \
 	unsigned i; \
 	XZALLOC_CONST_PTR(&ash_ptr_to_globals_var, sizeof(G_var)); \
+	vtabsize = VTABSIZE; \
+	vartab = xzalloc(VTABSIZE * sizeof(vartab[0])); \
 	for (i = 0; i < ARRAY_SIZE(varinit_data); i++) { \
 		varinit[i].flags    = varinit_data[i].flags; \
 		varinit[i].var_text = varinit_data[i].var_text; \
@@ -2285,12 +2348,29 @@ varcmp(const char *p, const char *q)
 static struct var **
 hashvar(const char *p)
 {
-	unsigned hashval;
+	return &vartab[hash_str(p, '=') & (vtabsize - 1)];
+}
 
-	hashval = ((unsigned char) *p) << 4;
-	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+/* Double the number of buckets */
+static void
+grow_vartab(void)
+{
+	unsigned i, newsize = vtabsize * 2;
+	struct var **newtab = xzalloc(newsize * sizeof(newtab[0]));
+
+	for (i = 0; i < vtabsize; i++) {
+		struct var *vp = vartab[i];
+		while (vp) {
+			struct var *next = vp->next;
+			struct var **vpp = &newtab[hash_str(vp->var_text, '=') & (newsize - 1)];
+			vp->next = *vpp;
+			*vpp = vp;
+			vp = next;
+		}
+	}
+	free(vartab);
+	vartab = newtab;
+	vtabsize = newsize;
 }
 
 static int
@@ -2324,6 +2404,7 @@ initvar(void)
 		vpp = hashvar(vp->var_text);
 		vp->next = *vpp;
 		*vpp = vp;
+		varcount++;
 	} while (++vp < end);
 }
 
@@ -2440,6 +2521,7 @@ setvareq(char *s, int flags)
 		if (((flags & (VEXPORT|VREADONLY|VSTRFIXED|VUNSET)) | (vp->flags & VSTRFIXED)) == VUNSET) {
 			*vpp = vp->next;
 			free(vp);
+			varcount--;
  out_free:
 			if ((flags & (VTEXTFIXED|VSTACK|VNOSAVE)) == VNOSAVE)
 				free(s);
@@ -2457,6 +2539,10 @@ setvareq(char *s, int flags)
 			goto out;
 		if ((flags & (VEXPORT|VREADONLY|VSTRFIXED|VUNSET)) == VUNSET)
 			goto out_free;
+		if (++varcount > vtabsize) {
+			grow_vartab();
+			vpp = hashvar(s);
+		}
 		vp = ckzalloc(sizeof(*vp));
 		vp->next = *vpp;
 		/*vp->func = NULL; - ckzalloc did it */
@@ -2568,7 +2654,7 @@ listvars(int on, int off, struct strlist *lp, char ***end)
 #endif
 			}
 		}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vtabsize);
 
 #if ENABLE_FEATURE_SH_NOFORK
 	while (lp) {
@@ -5468,10 +5554,23 @@ stoppedjobs(void)
 #define EMPTY -2                /* marks an unused slot in redirtab */
 #define CLOSED -1               /* marks a slot of previously-closed fd */
 
+/* Returns -1 if memfd_create() is not supported */
+static int
+create_memfd(int cloexec)
+{
+#ifdef MFD_CLOEXEC
+	return memfd_create("ash", cloexec ? MFD_CLOEXEC : 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 /*
- * Handle here documents.  Normally we fork off a process to write the
- * data to a pipe.  If the document is short, we can stuff the data in
- * the pipe without forking.
+ * Handle here documents.  If the document fits into the pipe buffer,
+ * we stuff the data in the pipe.  Otherwise we give out a memfd with
+ * the data, or if that fails, fork off a process to write the data
+ * to a pipe.
  */
 /* openhere needs this forward reference */
 static void expandhere(union node *arg);
@@ -5481,6 +5580,7 @@ openhere(union node *redir)
 	char *p;
 	int pip[2];
 	size_t len = 0;
+	int fd;
 
 	if (pipe(pip) < 0)
 		ash_msg_and_raise_perror("can't create pipe");
@@ -5492,11 +5592,32 @@ openhere(union node *redir)
 	}
 
 	len = strlen(p);
-	if (len <= PIPE_BUF) {
+	if (len <= PIPE_BUF
+#ifdef F_GETPIPE_SZ
+	/* Pipe can take it all without blocking? (usually up to 64k) */
+	 || (ssize_t)len <= fcntl(pip[1], F_GETPIPE_SZ)
+#endif
+	) {
 		xwrite(pip[1], p, len);
 		goto out;
 	}
 
+	/* Too big for the pipe. Give the command a memory-backed file
+	 * instead of forking a child to feed the pipe.
+	 * Not CLOEXEC: it may end up being the fd we redirect.
+	 */
+	fd = create_memfd(0);
+	if (fd >= 0) {
+		if (full_write(fd, p, len) == (ssize_t)len
+		 && lseek(fd, 0, SEEK_SET) == 0
+		) {
+			close(pip[0]);
+			close(pip[1]);
+			return fd;
+		}
+		close(fd);
+	}
+
 	if (forkshell((struct job *)NULL, (union node *)NULL, FORK_NOJOB) == 0) {
 		/* child */
 		close(pip[0]);
@@ -5941,6 +6062,26 @@ pushfd(int fd)
 }
 #endif
 
+#if ENABLE_ASH_LASTPIPE
+/* Redirect stdin from fd (and close fd). popredir() undoes it */
+static void
+pushstdin(int fd)
+{
+	struct redirtab *sv;
+
+	INT_OFF;
+	sv = ckzalloc(sizeof(*sv) + sizeof(sv->two_fd[0]));
+	sv->pair_count = 1;
+	sv->two_fd[0].orig_fd = sv->two_fd[0].moved_to = EMPTY;
+	sv->next = redirlist;
+	redirlist = sv;
+	save_fd_on_redirect(0, fd, sv);
+	dup2_or_raise(fd, 0);
+	close(fd);
+	INT_ON;
+}
+#endif
+
 static struct redirtab*
 pushredir(union node *redir)
 {
@@ -6576,6 +6717,10 @@ evaltreenr(union node *n, int flags)
 	/* NOTREACHED */
 }
 
+#if ENABLE_ASH_NOFORK_SUBST
+static int evalbackcmd_nofork(union node *n, struct backcmd *result);
+#endif
+
 static void FAST_FUNC
 evalbackcmd(union node *n, struct backcmd *result
 				IF_BASH_PROCESS_SUBST(, int ctl))
@@ -6599,6 +6744,10 @@ evalbackcmd(union node *n, struct backcmd *result
 	if (n == NULL) {
 		goto out;
 	}
+#if ENABLE_ASH_NOFORK_SUBST
+	if (ctl == CTLBACKQ && evalbackcmd_nofork(n, result) == 0)
+		goto out;
+#endif
 
 	if (pipe(pip) < 0)
 		ash_msg_and_raise_perror("can't create pipe");
@@ -7854,8 +8003,14 @@ expmeta(exp_t *exp, char *name, unsigned name_len, unsigned expdir_len)
 	char *endname;
 	int metaflag;
 	struct stat statb;
+#if ENABLE_FEATURE_SH_GLOB_CACHE
+	struct shell_dir *dirp;
+#else
 	DIR *dirp;
 	struct dirent *dp;
+#endif
+	const char *dname;
+	unsigned prefix_len, suffix_len;
 	int atend;
 	int matchdot;
 	int esc;
@@ -7916,7 +8071,11 @@ expmeta(exp_t *exp, char *name, unsigned name_len, unsigned expdir_len)
 	expdir_len = enddir - cp;
 	if (!expdir_len)
 		cp = ".";
+#if ENABLE_FEATURE_SH_GLOB_CACHE
+	dirp = shell_opendir(cp);
+#else
 	dirp = opendir(cp);
+#endif
 	if (dirp == NULL)
 		return;
 	if (*endname == 0) {
@@ -7933,34 +8092,63 @@ expmeta(exp_t *exp, char *name, unsigned name_len, unsigned expdir_len)
 		p++;
 	if (*p == '.')
 		matchdot++;
+	/* Literal prefix of the pattern is compared directly.
+	 * "PREFIX*SUFFIX" patterns are matched without pmatch() at all.
+	 */
+	prefix_len = strcspn(start, "*?[\\");
+	suffix_len = -1;
+	if (start[prefix_len] == '*') {
+		p = start + prefix_len + 1;
+		if (p[strcspn(p, "*?[\\")] == '\0')
+			suffix_len = strlen(p);
+	}
+#if ENABLE_FEATURE_SH_GLOB_CACHE
+	for (dname = dirp->names; !pending_int && *dname; dname += strlen(dname) + 1) {
+#else
 	while (!pending_int && (dp = readdir(dirp)) != NULL) {
-		if (dp->d_name[0] == '.' && !matchdot)
+		dname = dp->d_name;
+#endif
+		if (dname[0] == '.' && !matchdot)
 			continue;
-		if (pmatch(start, dp->d_name)) {
-			if (atend) {
-				strcpy(enddir, dp->d_name);
-				addfname(expdir);
-			} else {
-				unsigned offset;
-				unsigned len;
-
-				p = stpcpy(enddir, dp->d_name);
-				*p = '/';
-
-				offset = p - expdir + 1;
-				len = offset + name_len + NAME_MAX;
-				if (len > expdir_max) {
-					len += PATH_MAX;
-					expdir = ckrealloc(expdir, len);
-					expdir_max = len;
-				}
-
-				expmeta(exp, endname, name_len, offset);
-				enddir = expdir + expdir_len;
+		if (strncmp(dname, start, prefix_len) != 0)
+			continue;
+		if (suffix_len != (unsigned)-1) {
+			size_t len = strlen(dname);
+			if (len < prefix_len + suffix_len
+			 || strcmp(dname + len - suffix_len, start + prefix_len + 1) != 0
+			) {
+				continue;
 			}
+		} else if (!pmatch(start, dname)) {
+			continue;
+		}
+		if (atend) {
+			strcpy(enddir, dname);
+			addfname(expdir);
+		} else {
+			unsigned offset;
+			unsigned len;
+
+			p = stpcpy(enddir, dname);
+			*p = '/';
+
+			offset = p - expdir + 1;
+			len = offset + name_len + NAME_MAX;
+			if (len > expdir_max) {
+				len += PATH_MAX;
+				expdir = ckrealloc(expdir, len);
+				expdir_max = len;
+			}
+
+			expmeta(exp, endname, name_len, offset);
+			enddir = expdir + expdir_len;
 		}
 	}
+#if ENABLE_FEATURE_SH_GLOB_CACHE
+	shell_closedir(dirp);
+#else
 	closedir(dirp);
+#endif
 	if (!atend)
 		endname[-esc - 1] = esc ? '\\' : '/';
 #undef expdir
@@ -8229,7 +8417,10 @@ struct tblentry {
 };
 
 static struct tblentry **cmdtable;
+static unsigned cmdtabsize;
+static unsigned cmdcount;
 #define INIT_G_cmdtable() do { \
+	cmdtabsize = CMDTABLESIZE; \
 	cmdtable = xzalloc(CMDTABLESIZE * sizeof(cmdtable[0])); \
 } while (0)
 
@@ -8353,6 +8544,89 @@ static void shellexec(char *prog, char **argv, const char *path, int idx)
 	/* NOTREACHED */
 }
 
+#if ENABLE_ASH_VFORK
+/*
+ * Start an external command with vfork() + execve(), without copying
+ * the whole shell as forkshell() + shellexec() do. Only done if the
+ * child would do nothing but exec anyway (no job control).
+ * The vforked child shares our memory: path and environment are
+ * prepared here, and the child only resets signals and execs.
+ * Returns 0 if the caller should use forkshell() instead:
+ * for NOEXEC applets, or if exec failed (the forked child then
+ * retries the full $PATH search and reports the error).
+ */
+static int
+vforkexec(struct job *jp, union node *n, char **argv, const char *path, int idx)
+{
+	volatile int failed;
+	const char *prog;
+	char **envp;
+	sigset_t omask;
+	pid_t pid;
+
+#if JOBS
+	if (jp->jobctl)
+		return 0;
+#endif
+	envp = listvars(VEXPORT, VUNSET, /*strlist:*/ NULL, /*end:*/ NULL);
+	prog = argv[0];
+	if (!strchr(prog, '/')) {
+#if ENABLE_FEATURE_SH_STANDALONE
+		int applet_no = find_applet_by_name(prog);
+		if (applet_no >= 0) {
+			if (APPLET_IS_NOEXEC(applet_no))
+				return 0;
+			prog = bb_busybox_exec_path;
+		} else
+#endif
+		{
+			/* Same $PATH element shellexec() would try first */
+			while (padvance(&path, argv[0]) >= 0) {
+				if (--idx < 0 && pathopt == NULL) {
+					prog = stackblock();
+					break;
+				}
+			}
+			if (prog == argv[0])
+				return 0;
+		}
+	}
+
+	/* No signal handlers must run in the child: block all signals
+	 * until it has reset them to what forkchild() would have set */
+	sigfillset(&omask);
+	sigprocmask2(SIG_BLOCK, &omask);
+	failed = 0;
+	pid = vfork();
+	if (pid == 0) {
+		int sig;
+		for (sig = 1; sig < NSIG; sig++) {
+			char m = sigmode[sig - 1];
+			if (m == S_CATCH
+			 || (m == S_IGN && rootshell && !trap[sig]
+			    && (sig == SIGQUIT || (sig == SIGTERM && iflag)))
+			) {
+				signal(sig, SIG_DFL);
+			}
+		}
+		sigprocmask(SIG_SETMASK, &omask, NULL);
+		execve(prog, argv, envp);
+		failed = errno;
+		_exit(127);
+	}
+	sigprocmask(SIG_SETMASK, &omask, NULL);
+	if (pid < 0)
+		return 0;
+	if (failed) {
+		safe_waitpid(pid, NULL, 0);
+		return 0;
+	}
+	TRACE(("vforkexec: child %d\n", pid));
+	forkparent(jp, n, FORK_FG, pid);
+	return 1;
+}
+#endif
+
 static void
 printentry(struct tblentry *cmdp)
 {
@@ -8380,7 +8654,7 @@ clearcmdentry(void)
 	struct tblentry *cmdp;
 
 	INT_OFF;
-	for (tblp = cmdtable; tblp < &cmdtable[CMDTABLESIZE]; tblp++) {
+	for (tblp = cmdtable; tblp < &cmdtable[cmdtabsize]; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if (cmdp->cmdtype == CMDNORMAL
@@ -8391,6 +8665,7 @@ clearcmdentry(void)
 			) {
 				*pp = cmdp->next;
 				free(cmdp);
+				cmdcount--;
 			} else {
 				pp = &cmdp->next;
 			}
@@ -8410,20 +8685,38 @@ clearcmdentry(void)
  */
 static struct tblentry **lastcmdentry;
 
+/* Double the number of buckets */
+static void
+grow_cmdtable(void)
+{
+	unsigned i, newsize = cmdtabsize * 2;
+	struct tblentry **newtab = xzalloc(newsize * sizeof(newtab[0]));
+
+	for (i = 0; i < cmdtabsize; i++) {
+		struct tblentry *cmdp = cmdtable[i];
+		while (cmdp) {
+			struct tblentry *next = cmdp->next;
+			struct tblentry **pp = &newtab[hash_str(cmdp->cmdname, '\0') & (newsize - 1)];
+			cmdp->next = *pp;
+			*pp = cmdp;
+			cmdp = next;
+		}
+	}
+	free(cmdtable);
+	cmdtable = newtab;
+	cmdtabsize = newsize;
+}
+
 static struct tblentry *
 cmdlookup(const char *name, int add)
 {
-	unsigned int hashval;
-	const char *p;
 	struct tblentry *cmdp;
 	struct tblentry **pp;
 
-	p = name;
-	hashval = (unsigned char)*p << 4;
-	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+	/* Grow before lookup: lastcmdentry must stay valid */
+	if (add && cmdcount >= cmdtabsize)
+		grow_cmdtable();
+	pp = &cmdtable[hash_str(name, '\0') & (cmdtabsize - 1)];
 	for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 		if (strcmp(cmdp->cmdname, name) == 0)
 			break;
@@ -8437,6 +8730,7 @@ cmdlookup(const char *name, int add)
 		/*cmdp->next = NULL; - ckzalloc did it */
 		cmdp->cmdtype = CMDUNKNOWN;
 		strcpy(cmdp->cmdname, name);
+		cmdcount++;
 	}
 	lastcmdentry = pp;
 	return cmdp;
@@ -8456,6 +8750,7 @@ delete_cmd_entry(void)
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	free(cmdp);
+	cmdcount--;
 	INT_ON;
 }
 
@@ -8492,7 +8787,7 @@ hashcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 	}
 
 	if (*argptr == NULL) {
-		for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+		for (pp = cmdtable; pp < &cmdtable[cmdtabsize]; pp++) {
 			for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -8532,7 +8827,7 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+	for (pp = cmdtable; pp < &cmdtable[cmdtabsize]; pp++) {
 		for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL
 			 || (cmdp->cmdtype == CMDBUILTIN
@@ -9656,27 +9951,67 @@ expredir(union node *n)
  * of the shell, which make the last process in a pipeline the parent
  * of all the rest.)
  */
+#if ENABLE_ASH_NOFORK_SUBST
+static int evalnofork(union node *n, int infd, int *statusp);
+#endif
 static int
 evalpipe(union node *n, int flags)
 {
 	struct job *jp;
-	struct nodelist *lp;
+	struct nodelist *lp, *lp2;
+	union node *last;
 	int pipelen;
 	int prevfd;
 	int pip[2];
 	int status = 0;
+	IF_ASH_NOFORK_SUBST(int prefix_status = 0;)
 
 	TRACE(("evalpipe(0x%lx) called\n", (long)n));
-	pipelen = 0;
-	for (lp = n->npipe.cmdlist; lp; lp = lp->next)
+	prevfd = -1;
+	lp = n->npipe.cmdlist;
+#if ENABLE_ASH_NOFORK_SUBST
+	/* Leading builtins and NOFORK applets (echo "$x" | ...) run here,
+	 * one after another. They don't read stdin, and their output
+	 * is bounded by their arguments: it is collected in a memfd
+	 * which becomes stdin of the next command. A command whose
+	 * output does not fit into the memfd is run in the pipe instead.
+	 */
+	if (!n->npipe.pipe_backgnd) {
+		while (lp->next) {
+			int st;
+			int fd = evalnofork(lp->n, prevfd, &st);
+			if (fd < 0)
+				break;
+			if (prevfd >= 0)
+				close(prevfd);
+			lseek(fd, 0, SEEK_SET);
+			prevfd = fd;
+			if (st)
+				prefix_status = st;
+			lp = lp->next;
+		}
+	}
+#endif
+	/* "set -o lastpipe": run the last command in this shell */
+	last = NULL;
+	if (lastpipe && !n->npipe.pipe_backgnd && !doing_jobctl) {
+		for (lp2 = lp; lp2->next; lp2 = lp2->next)
+			continue;
+		last = lp2->n;
+	}
+	pipelen = last ? -1 : 0;
+	for (lp2 = lp; lp2; lp2 = lp2->next)
 		pipelen++;
+
 	flags |= EV_EXIT;
 	INT_OFF;
-	if (n->npipe.pipe_backgnd == 0)
-		get_tty_state();
-	jp = makejob(/*n,*/ pipelen);
-	prevfd = -1;
-	for (lp = n->npipe.cmdlist; lp; lp = lp->next) {
+	jp = NULL;
+	if (pipelen != 0) {
+		if (n->npipe.pipe_backgnd == 0)
+			get_tty_state();
+		jp = makejob(/*n,*/ pipelen);
+	}
+	for (; pipelen != 0; lp = lp->next, pipelen--) {
 		prehash(lp->n);
 		pip[1] = -1;
 		if (lp->next) {
@@ -9710,10 +10045,29 @@ evalpipe(union node *n, int flags)
 		if (pip[1] != -1)
 			close(pip[1]);
 	}
+#if ENABLE_ASH_LASTPIPE
+	if (last) {
+		int last_status;
+
+		INT_ON;
+		pushstdin(prevfd);
+		last_status = evaltree(last, flags & ~EV_EXIT);
+		popredir(/*drop:*/ 0);
+		INT_OFF;
+		if (jp)
+			status = waitforjob(jp);
+		if (!pipefail || last_status)
+			status = last_status;
+	} else
+#endif
 	if (n->npipe.pipe_backgnd == 0) {
 		status = waitforjob(jp);
 		TRACE(("evalpipe:  job done exit status %d\n", status));
 	}
+#if ENABLE_ASH_NOFORK_SUBST
+	if (pipefail && status == 0)
+		status = prefix_status;
+#endif
 	INT_ON;
 
 	return status;
@@ -10546,6 +10900,10 @@ evalcommand(union node *cmd, int flags)
 			INT_OFF;
 			get_tty_state();
 			jp = makejob(/*cmd,*/ 1);
+#if ENABLE_ASH_VFORK
+			if (vforkexec(jp, cmd, argv, path, cmdentry.u.index))
+				break;
+#endif
 			if (forkshell(jp, cmd, FORK_FG) != 0) {
 				/* parent */
 				break;
@@ -10649,6 +11007,310 @@ prehash(union node *n)
 		find_command(n->ncmd.args->narg.text, &entry, 0, pathval());
 }
 
+#if ENABLE_ASH_NOFORK_SUBST
+/*
+ * Builtins which only produce output and do not change shell state
+ * (if they did, the change would be visible to the parent shell).
+ */
+static int
+is_pure_builtin(const struct builtincmd *cmd)
+{
+	return cmd->builtin == truecmd
+	    || cmd->builtin == falsecmd
+	    || cmd->builtin == pwdcmd
+	    || cmd->builtin == typecmd
+#if ENABLE_ASH_ECHO
+	    || cmd->builtin == echocmd
+#endif
+#if ENABLE_ASH_PRINTF
+	    || cmd->builtin == printfcmd
+#endif
+#if ENABLE_ASH_TEST || BASH_TEST2
+	    || cmd->builtin == testcmd
+#endif
+	;
+}
+
+/*
+ * Can expanding this word change shell state? $((i+=1)), ${v=x}
+ * and ${v?msg} can, and $(cmd) runs arbitrary code. In a forked
+ * child the change would be lost, here it would leak to the parent.
+ */
+static int
+word_has_side_effects(union node *n)
+{
+	const char *p;
+
+	if (!n)
+		return 0;
+	for (p = n->narg.text; *p; p++) {
+		unsigned char c = *p;
+		if (c == CTLESC) {
+			p++;
+			continue;
+		}
+		if (c == CTLARI || c == CTLBACKQ
+#if BASH_PROCESS_SUBST
+		 || c == CTLTOPROC || c == CTLFROMPROC
+#endif
+		) {
+			return 1;
+		}
+		if (c == CTLVAR) {
+			int subtype = (unsigned char)*++p & VSTYPE;
+			if (subtype == VSASSIGN || subtype == VSQUESTION)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Output of a command run by evalnofork() must fit in this many bytes,
+ * else we discard it and run the command again in a subshell,
+ * where its output goes to a pipe.
+ */
+#define NOFORK_OUTPUT_MAX (1024 * 1024)
+
+/*
+ * A memfd (fd >= 10) which can't grow past NOFORK_OUTPUT_MAX:
+ * writes beyond that fail. Returns -1 if the kernel can't do it.
+ */
+static int
+create_bounded_memfd(void)
+{
+#if defined(MFD_ALLOW_SEALING) && defined(F_SEAL_GROW)
+	int fd, fd10;
+
+	fd = memfd_create("ash", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+	fd10 = -1;
+	/* The file is sparse, unwritten pages take no memory */
+	if (ftruncate(fd, NOFORK_OUTPUT_MAX) == 0
+	 && fcntl(fd, F_ADD_SEALS, F_SEAL_GROW) == 0
+	) {
+		fd10 = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+	}
+	close(fd);
+	return fd10;
+#else
+	return -1;
+#endif
+}
+
+/* Undo fcntl(fd, F_DUPFD_CLOEXEC, 10) which returned sv (-1 if fd was closed) */
+static void
+restore_fd(int sv, int fd)
+{
+	if (sv >= 0) {
+		dup2(sv, fd);
+		close(sv);
+	} else if (sv == -1) {
+		close(fd);
+	}
+}
+
+/*
+ * Run n in this shell, but as if it was forked: if it is a simple
+ * command which would run as a pure builtin or a NOFORK applet anyway,
+ * run it here with stdin from infd (if infd >= 0) and stdout redirected
+ * to a memfd, then undo what it could change only in a forked child.
+ * Returns the memfd (offset at the end of output, fd >= 10) and sets
+ * *statusp, or returns -1 if n is not eligible (nothing was run).
+ * Also returns -1 if output to stdout or stderr did not fit into
+ * NOFORK_OUTPUT_MAX: the caller then runs n again, forked. Running it
+ * twice is harmless: the arguments were expanded without side effects,
+ * pure builtins have none, and NOFORK applets which do have them
+ * (mkdir, kill...) do not print that much.
+ */
+static int
+evalnofork(union node *n, int infd, int *statusp)
+{
+	struct cmdentry entry;
+	union node *ap;
+	struct jmploc *volatile savehandler;
+	struct jmploc jmploc;
+	volatile int saveint;
+	struct localvar_list *localvar_stop;
+	struct parsefile *file_stop;
+	struct redirtab *redir_stop;
+	char *sv_expdest;
+	struct nodelist *sv_argbackq;
+	struct ifsregion sv_ifsfirst;
+	struct ifsregion *sv_ifslastp;
+	char **sv_argptr;
+	char *sv_optptr;
+	int sv_exitstatus, sv_eflag, sv_lineno;
+	int fd, efd, sv_fd0, sv_fd1, sv_fd2, err;
+	off_t len, elen;
+
+	/* (traps would run with our stdout) */
+	if (n->type != NCMD || !n->ncmd.args || n->ncmd.assign
+	 || !goodname(n->ncmd.args->narg.text)
+	 || may_have_traps
+	) {
+		return -1;
+	}
+	for (ap = n->ncmd.args; ap; ap = ap->narg.next)
+		if (word_has_side_effects(ap))
+			return -1;
+	for (ap = n->ncmd.redirect; ap; ap = ap->nfile.next) {
+		if (ap->type == NHERE)
+			continue;
+		if (word_has_side_effects(ap->type == NXHERE ? ap->nhere.doc : ap->nfile.fname))
+			return -1;
+	}
+	find_command(n->ncmd.args->narg.text, &entry, 0, pathval());
+	if (entry.cmdtype == CMDBUILTIN) {
+		if (!is_pure_builtin(entry.u.cmd))
+			return -1;
+	} else
+#if ENABLE_FEATURE_SH_STANDALONE \
+ && ENABLE_FEATURE_SH_NOFORK \
+ && NUM_APPLETS > 1
+	/* find_command() encodes applet_no as (-2 - applet_no) */
+	if (entry.cmdtype != CMDNORMAL
+	 || entry.u.index > -2
+	 || !APPLET_IS_NOFORK(- entry.u.index - 2)
+	)
+#endif
+	{
+		return -1;
+	}
+
+	/* Move user's fds out of the way (-1: fd was closed) */
+	flush_stdout_stderr();
+	sv_fd0 = -2; /* "not redirected" */
+	if (infd >= 0) {
+		sv_fd0 = fcntl(0, F_DUPFD_CLOEXEC, 10);
+		if (sv_fd0 < 0 && errno != EBADF)
+			return -1;
+		dup2(infd, 0);
+	}
+	fd = efd = -1;
+	sv_fd1 = fcntl(1, F_DUPFD_CLOEXEC, 10);
+	sv_fd2 = fcntl(2, F_DUPFD_CLOEXEC, 10);
+	if ((sv_fd1 >= 0 || errno == EBADF) && (sv_fd2 >= 0 || errno == EBADF)) {
+		fd = create_bounded_memfd();
+		efd = create_bounded_memfd();
+	}
+	if (fd < 0 || efd < 0) {
+		if (fd >= 0)
+			close(fd);
+		if (efd >= 0)
+			close(efd);
+		if (sv_fd1 >= 0)
+			close(sv_fd1);
+		if (sv_fd2 >= 0)
+			close(sv_fd2);
+		restore_fd(sv_fd0, 0);
+		return -1;
+	}
+	/* Collect stderr too: if output does not fit, the messages
+	 * (such as "write error") must go away with it */
+	dup2(fd, 1);
+	dup2(efd, 2);
+
+	/* The state a forked child would modify only for itself */
+	sv_expdest = expdest;
+	sv_argbackq = argbackq;
+	sv_ifsfirst = ifsfirst;
+	sv_ifslastp = ifslastp;
+	ifsfirst.next = NULL;
+	ifslastp = NULL;
+	sv_argptr = argptr;
+	sv_optptr = optptr;
+	sv_exitstatus = exitstatus;
+	sv_eflag = eflag;
+	sv_lineno = lineno;
+	eflag = 0; /* see evalbackcmd(); a forked child would exit */
+
+	localvar_stop = localvar_stack;
+	file_stop = g_parsefile;
+	redir_stop = redirlist;
+	savehandler = exception_handler;
+	SAVE_INT(saveint);
+	err = setjmp(jmploc.loc);
+	if (!err) {
+		exception_handler = &jmploc;
+		evaltree(n, 0);
+	}
+	exception_handler = savehandler;
+	if (err) {
+		/* A forked child would exit. We clean up like it never ran */
+		unwindredir(redir_stop);
+		unwindfiles(file_stop);
+		unwindlocalvars(localvar_stop);
+		ifsfree();
+	}
+	flush_stdout_stderr();
+	*statusp = exitstatus;
+
+	expdest = sv_expdest;
+	argbackq = sv_argbackq;
+	ifsfirst = sv_ifsfirst;
+	ifslastp = sv_ifslastp;
+	argptr = sv_argptr;
+	optptr = sv_optptr;
+	exitstatus = sv_exitstatus;
+	eflag = sv_eflag;
+	lineno = sv_lineno;
+
+	restore_fd(sv_fd2, 2);
+	restore_fd(sv_fd1, 1);
+	restore_fd(sv_fd0, 0);
+	len = lseek(fd, 0, SEEK_CUR);
+	elen = lseek(efd, 0, SEEK_CUR);
+	if (len < NOFORK_OUTPUT_MAX && elen < NOFORK_OUTPUT_MAX) {
+		/* Readers of fd expect EOF at the end of output */
+		ftruncate(fd, len);
+		if (elen > 0 && sv_fd2 >= 0) {
+			lseek(efd, 0, SEEK_SET);
+			bb_copyfd_size(efd, 2, elen);
+		}
+	} else {
+		close(fd);
+		fd = -1;
+	}
+	close(efd);
+	if (err && exception_type != EXERROR) {
+		if (fd >= 0)
+			close(fd);
+		longjmp(exception_handler->loc, 1);
+	}
+	RESTORE_INT(saveint);
+	return fd;
+}
+
+/*
+ * Try to run the command of $(cmd) without forking,
+ * and give the collected output to expbackq() in result->buf.
+ * Returns nonzero if the command is not eligible (or its output
+ * was discarded, see evalnofork()).
+ */
+static int
+evalbackcmd_nofork(union node *n, struct backcmd *result)
+{
+	int fd, status;
+	off_t len;
+
+	fd = evalnofork(n, -1, &status);
+	if (fd < 0)
+		return 1;
+	len = lseek(fd, 0, SEEK_END);
+	if (len > 0) {
+		result->buf = ckmalloc(len);
+		result->nleft = pread(fd, result->buf, len, 0);
+		if (result->nleft < 0)
+			result->nleft = 0;
+	}
+	close(fd);
+	back_exitstatus = status;
+	return 0;
+}
+#endif
+
 
 /* ============ Builtin commands
  *
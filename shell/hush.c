@@ -318,6 +318,31 @@
 //config:	default y
 //config:	depends on SHELL_HUSH
 //config:
+//config:config HUSH_SOURCE_CACHE
+//config:	bool "Cache parsed files run by '.'"
+//config:	default y
+//config:	depends on SHELL_HUSH
+//config:	help
+//config:	Keep the parsed form of recently sourced files and reuse it
+//config:	when the same, unmodified file is sourced again,
+//config:	instead of parsing its text anew.
+//config:
+//config:config HUSH_SOURCE_CACHE_SIZE
+//config:	int "How many files to remember"
+//config:	default 16
+//config:	range 1 1024
+//config:	depends on HUSH_SOURCE_CACHE
+//config:
+//config:config HUSH_VFORK
+//config:	bool "Start external commands with vfork()"
+//config:	default y
+//config:	depends on SHELL_HUSH && !NOMMU
+//config:	help
+//config:	Run simple external commands (no pipes, redirections,
+//config:	or variable assignments) with vfork() + exec instead of fork().
+//config:	This saves copying the page tables of a big shell
+//config:	for every command.
+//config:
 //config:config HUSH_MEMLEAK
 //config:	bool "memleak builtin (debugging)"
 //config:	default n
@@ -798,6 +823,24 @@ struct function {
 };
 #endif
 
+#if ENABLE_HUSH_SOURCE_CACHE
+/* Parsed form of a file run by ". FILE" */
+struct source_cache {
+	struct source_cache *next;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_nsec;
+	unsigned busy;      /* how many ". FILE" are running it now */
+	smallint complete;  /* lists[] cover the whole file */
+	smallint filling;   /* someone is appending to lists[] */
+	smallint stale;     /* file changed or had errors: free when !busy */
+	unsigned cnt;
+	struct pipe **lists;
+};
+#endif
+
 
 /* set -/+o OPT support. (TODO: make it optional)
  * bash supports the following opts:
@@ -986,6 +1029,10 @@ struct globals {
 #endif
 	HFILE *HFILE_list;
 	HFILE *HFILE_stdin;
+#if ENABLE_HUSH_SOURCE_CACHE
+	struct source_cache *source_cache;
+	unsigned source_cache_cnt;
+#endif
 	/* Which signals have non-DFL handler (even with no traps set)?
 	 * Set at the start to:
 	 * (SIGQUIT + maybe SPECIAL_INTERACTIVE_SIGS + maybe SPECIAL_JOBSTOP_SIGS)
@@ -3284,6 +3331,60 @@ static int o_get_last_ptr(o_string *o, int n)
  * should be is made using that encoded representation. Not glob pattern.
  */
 
+#if ENABLE_FEATURE_SH_GLOB_CACHE && defined(GLOB_ALTDIRFUNC)
+/* Make glob() read directories from the listing cache */
+struct glob_dir {
+	struct shell_dir *dir;
+	const char *pos;
+	struct dirent de;
+};
+static void *glob_opendir(const char *path)
+{
+	struct shell_dir *dir;
+	struct glob_dir *gd;
+
+	dir = shell_opendir(path);
+	if (!dir)
+		return NULL;
+	gd = xzalloc(sizeof(*gd));
+	gd->dir = dir;
+	gd->pos = dir->names;
+	return gd;
+}
+static struct dirent *glob_readdir(void *p)
+{
+	struct glob_dir *gd = p;
+	size_t len;
+
+	len = strlen(gd->pos);
+	if (len == 0)
+		return NULL;
+	safe_strncpy(gd->de.d_name, gd->pos, sizeof(gd->de.d_name));
+	gd->de.d_ino = 1; /* glob() may skip entries with zero inode */
+	gd->de.d_type = DT_UNKNOWN;
+	gd->pos += len + 1;
+	return &gd->de;
+}
+static void glob_closedir(void *p)
+{
+	struct glob_dir *gd = p;
+
+	shell_closedir(gd->dir);
+	free(gd);
+}
+static int hush_glob(const char *pattern, glob_t *globdata)
+{
+	globdata->gl_opendir = glob_opendir;
+	globdata->gl_readdir = glob_readdir;
+	globdata->gl_closedir = glob_closedir;
+	globdata->gl_stat = stat;
+	globdata->gl_lstat = lstat;
+	return glob(pattern, GLOB_ALTDIRFUNC, NULL, globdata);
+}
+#else
+# define hush_glob(pattern, globdata) glob(pattern, 0, NULL, globdata)
+#endif
+
 #if ENABLE_HUSH_BRACE_EXPANSION
 /* There in a GNU extension, GLOB_BRACE, but it is not usable:
  * first, it processes even {a} (no commas), second,
@@ -3420,7 +3521,7 @@ static int glob_brace(char *pattern, o_string *o, int n)
 		glob_t globdata;
 
 		memset(&globdata, 0, sizeof(globdata));
-		gr = glob(pattern, 0, NULL, &globdata);
+		gr = hush_glob(pattern, &globdata);
 		debug_printf_glob("glob('%s'):%d\n", pattern, gr);
 		if (gr != 0) {
 			if (gr == GLOB_NOMATCH) {
@@ -3526,7 +3627,7 @@ static int perform_glob(o_string *o, int n)
 	 * to fall back to using literal "*.*", but GLOB_NOCHECK
 	 * will return "*.\*"!
 	 */
-	gr = glob(pattern, 0, NULL, &globdata);
+	gr = hush_glob(pattern, &globdata);
 	debug_printf_glob("glob('%s'):%d\n", pattern, gr);
 	if (gr != 0) {
 		if (gr == GLOB_NOMATCH) {
@@ -7596,6 +7697,168 @@ static void parse_and_run_file(HFILE *fp)
 	IF_HUSH_LINENO_VAR(G.parse_lineno = sv;)
 }
 
+#if ENABLE_HUSH_SOURCE_CACHE
+/* ". FILE" remembers the parsed trees of the last few sourced files,
+ * keyed by the file's dev/ino/size/mtime, and runs them again
+ * on the next ". FILE" instead of parsing the text again.
+ * Trees are executed by run_list() without being freed,
+ * just like function bodies are.
+ */
+static void free_source_cache(struct source_cache *sc)
+{
+	while (sc->cnt)
+		free_pipe_list(sc->lists[--sc->cnt]);
+	free(sc->lists);
+	free(sc);
+}
+
+static void unlink_source_cache(struct source_cache *sc)
+{
+	struct source_cache **scp = &G.source_cache;
+
+	while (*scp) {
+		if (*scp == sc) {
+			*scp = sc->next;
+			G.source_cache_cnt--;
+			break;
+		}
+		scp = &(*scp)->next;
+	}
+}
+
+static void release_source_cache(struct source_cache *sc)
+{
+	if (--sc->busy == 0 && sc->stale) {
+		unlink_source_cache(sc);
+		free_source_cache(sc);
+	}
+}
+
+static struct source_cache *get_source_cache(int fd)
+{
+	struct stat st;
+	struct source_cache *sc, *victim;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return NULL;
+
+	victim = NULL;
+	for (sc = G.source_cache; sc; sc = sc->next) {
+		if (sc->dev == st.st_dev && sc->ino == st.st_ino && !sc->stale) {
+			if (sc->size == st.st_size
+			 && sc->mtime == st.st_mtime
+			 && sc->mtime_nsec == st.st_mtim.tv_nsec
+			) {
+				/* Move to front: it's most recently used */
+				unlink_source_cache(sc);
+				goto link;
+			}
+			/* The file was modified */
+			sc->stale = 1;
+			sc->busy++;
+			release_source_cache(sc);
+			break;
+		}
+	}
+
+	if (G.source_cache_cnt >= CONFIG_HUSH_SOURCE_CACHE_SIZE) {
+		/* Evict the least recently used one not being run now */
+		for (sc = G.source_cache; sc; sc = sc->next)
+			if (!sc->busy)
+				victim = sc;
+		if (!victim)
+			return NULL;
+		unlink_source_cache(victim);
+		free_source_cache(victim);
+	}
+
+	sc = xzalloc(sizeof(*sc));
+	sc->dev = st.st_dev;
+	sc->ino = st.st_ino;
+	sc->size = st.st_size;
+	sc->mtime = st.st_mtime;
+	sc->mtime_nsec = st.st_mtim.tv_nsec;
+ link:
+	sc->next = G.source_cache;
+	G.source_cache = sc;
+	G.source_cache_cnt++;
+	return sc;
+}
+
+static void run_cached_list(struct pipe *pipe_list)
+{
+	debug_print_tree(pipe_list, 0);
+	if (!G.o_opt[OPT_O_NOEXEC])
+		run_list(pipe_list);
+}
+
+/* Like parse_and_run_file(), but takes already parsed lists from sc,
+ * and (if nobody else is doing it) stores newly parsed ones there.
+ */
+static void parse_and_run_cached_file(HFILE *fp, struct source_cache *sc)
+{
+	struct in_str input;
+	unsigned i, n;
+	smallint fill;
+	IF_HUSH_LINENO_VAR(unsigned sv = G.parse_lineno;)
+
+	sc->busy++;
+	/* sc->cnt and sc->lists may change under us
+	 * if the file sources itself - re-read them every time */
+	for (i = 0; i < sc->cnt; i++) {
+		run_cached_list(sc->lists[i]);
+		if (G_flag_return_in_progress == 1)
+			goto ret;
+	}
+	if (sc->complete)
+		goto ret;
+
+	/* Parse the rest. The first i lists were already run, skip them */
+	fill = !sc->filling && !sc->stale;
+	if (fill)
+		sc->filling = 1;
+	IF_HUSH_LINENO_VAR(G.parse_lineno = 1;)
+	setup_file_in_str(&input, fp);
+	for (n = 0; ; n++) {
+		struct pipe *pipe_list;
+
+		pipe_list = parse_stream(NULL, NULL, &input, ';');
+		if (!pipe_list) { /* EOF */
+			sc->complete = fill;
+			break;
+		}
+		if (pipe_list == ERR_PTR) {
+			/* Can only get here if interactive: scripts die
+			 * on syntax errors. Don't remember such file */
+			int ch = input.last_char;
+			sc->stale = 1;
+			/* Discard cached input (rest of line) */
+			while (ch != EOF && ch != '\n')
+				ch = i_getch(&input);
+			continue;
+		}
+		if (n < i) {
+			free_pipe_list(pipe_list);
+			continue;
+		}
+		if (fill && !sc->stale) {
+			sc->lists = xrealloc_vector(sc->lists, 4, sc->cnt);
+			sc->lists[sc->cnt++] = pipe_list;
+			run_cached_list(pipe_list);
+		} else {
+			run_and_free_list(pipe_list);
+		}
+		if (G_flag_return_in_progress == 1)
+			break;
+	}
+	if (fill)
+		sc->filling = 0;
+	IF_HUSH_LINENO_VAR(G.parse_lineno = sv;)
+ ret:
+	release_source_cache(sc);
+}
+#endif
+
 #if ENABLE_HUSH_TICK
 static int generate_stream_from_string(const char *s, pid_t *pid_p)
 {
@@ -8322,13 +8585,24 @@ static void unset_func(const char *name)
 	struct function *funcp = *funcpp;
 
 	if (funcp != NULL) {
+		struct command *cmd = funcp->parent_cmd;
 		debug_printf_exec("freeing function '%s'\n", funcp->name);
 		*funcpp = funcp->next;
 		/* funcp is unlinked now, deleting it.
+		 * If the "f() {...}" command which created it is still alive
+		 * (in a loop body, or in a cached sourced file),
+		 * give the body back to it, as new_function() does:
+		 * executing that command again must define f again.
 		 * Note: if !funcp->body, the function was created by
 		 * "-F name body", do not free ->body_as_string
 		 * and ->name as they were not malloced. */
-		if (funcp->body) {
+		if (cmd) {
+			cmd->argv[0] = funcp->name;
+			cmd->group = funcp->body;
+#  if !BB_MMU
+			cmd->group_as_string = funcp->body_as_string;
+#  endif
+		} else if (funcp->body) {
 			free_pipe_list(funcp->body);
 			free(funcp->name);
 #  if !BB_MMU
@@ -9177,6 +9451,91 @@ static int checkjobs_and_fg_shell(struct pipe *fg_pipe)
 }
 #endif
 
+#if ENABLE_HUSH_VFORK && BB_MMU
+/* Start a single external command with vfork() + exec.
+ * Only the cases where the forked child would not touch any shell
+ * state are handled: one command, no redirects or assignments,
+ * no job control, not a NOEXEC applet. The program is looked up
+ * here, the vforked child only resets signal handlers and execs.
+ * Returns the pid, or 0 if the caller should fork as usual
+ * (also if exec failed: the forked child will report it).
+ */
+static pid_t vfork_exec(struct pipe *pi, char **argv)
+{
+	volatile int failed;
+	struct command *command = &pi->cmds[0];
+	const char *path;
+	char *prog;
+	sigset_t omask;
+	pid_t pid;
+
+	if (pi->num_cmds != 1 || !argv
+	 || command->assignment_cnt || command->redirects
+	 || pi->followup == PIPE_BG
+	 IF_HUSH_JOB(|| (G.run_list_level == 1 && G_interactive_fd))
+	 IF_HUSH_MODE_X(|| G_x_mode)
+	) {
+		return 0;
+	}
+	if (strchr(argv[0], '/')) {
+		prog = xstrdup(argv[0]);
+	} else {
+#if ENABLE_FEATURE_SH_STANDALONE
+		int a = find_applet_by_name(argv[0]);
+		if (a >= 0) {
+			if (APPLET_IS_NOEXEC(a))
+				return 0;
+			prog = xstrdup(bb_busybox_exec_path);
+		} else
+#endif
+		{
+			path = get_local_var_value("PATH");
+			if (!path)
+				return 0;
+			prog = find_executable(argv[0], (char**)&path);
+			if (!prog)
+				return 0;
+		}
+	}
+
+	/* No signal handlers must run in the child: block all signals
+	 * until it has reset the caught ones */
+	sigfillset(&omask);
+	sigprocmask2(SIG_BLOCK, &omask);
+	failed = 0;
+	pid = vfork();
+	if (pid == 0) {
+		unsigned sig;
+		for (sig = 1; sig < NSIG; sig++) {
+# if ENABLE_HUSH_TRAP
+			if (G_traps && G_traps[sig]) {
+				if (!G_traps[sig][0])
+					continue; /* trap '': remains SIG_IGN */
+				signal(sig, SIG_DFL);
+				continue;
+			}
+# endif
+			if (sig < sizeof(unsigned)*8
+			 && ((G.special_sig_mask | G_fatal_sig_mask) & (1 << sig))
+			) {
+				signal(sig, SIG_DFL);
+			}
+		}
+		sigprocmask(SIG_SETMASK, &omask, NULL);
+		execv(prog, argv);
+		failed = errno;
+		_exit(127);
+	}
+	sigprocmask(SIG_SETMASK, &omask, NULL);
+	free(prog);
+	if (pid > 0 && failed) {
+		safe_waitpid(pid, NULL, 0);
+		pid = 0;
+	}
+	return pid > 0 ? pid : 0;
+}
+#endif
+
 /* Start all the jobs, but don't wait for anything to finish.
  * See checkjobs().
  *
@@ -9546,6 +9905,25 @@ static NOINLINE int run_pipe(struct pipe *pi)
 	 * might include `cmd` runs! Do not rerun it! We *must*
 	 * use argv_expanded if it's non-NULL */
 
+#if ENABLE_HUSH_VFORK && BB_MMU
+	command = &pi->cmds[0];
+	command->pid = vfork_exec(pi, argv_expanded);
+	if (command->pid) {
+# if ENABLE_HUSH_FAST
+		G.count_SIGCHLD++;
+# endif
+		free(argv_expanded);
+		pi->alive_cmds = 1;
+# if ENABLE_HUSH_JOB
+		if (pi->pgrp < 0)
+			pi->pgrp = command->pid;
+# endif
+		debug_leave();
+		debug_printf_exec("run_pipe return -1 (vforked %d)\n", command->pid);
+		return -1;
+	}
+#endif
+
 	/* Going to fork a child per each pipe member */
 	pi->alive_cmds = 0;
 	next_infd = 0;
@@ -11601,7 +11979,17 @@ static int FAST_FUNC builtin_source(char **argv)
 
 	/* "false; . ./empty_line; echo Zero:$?" should print 0 */
 	G.last_exitcode = 0;
+#if ENABLE_HUSH_SOURCE_CACHE
+	{
+		struct source_cache *sc = get_source_cache(input->fd);
+		if (sc)
+			parse_and_run_cached_file(input, sc);
+		else
+			parse_and_run_file(input);
+	}
+#else
 	parse_and_run_file(input);
+#endif
 	hfclose(input);
 
 	if (args_need_save) /* can't use argv[1] instead: "shift" can mangle it */
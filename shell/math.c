@@ -239,6 +239,10 @@ typedef struct {
 	char second_val_present;
 	/* If NULL then it's just a number, else it's a named variable */
 	char *var;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+	/* where the code computing this value starts in the program */
+	unsigned pc;
+#endif
 } var_or_num_t;
 
 typedef struct remembered_name {
@@ -246,6 +250,35 @@ typedef struct remembered_name {
 	const char *var;
 } remembered_name;
 
+#if ENABLE_FEATURE_SH_MATH_CACHE
+/* While evaluating an expression, we record what was done as a postfix
+ * program: TOK_NUM pushes a number or a variable name, TOK_LPAREN
+ * resolves "(var)" to its value, other ops are given to arith_apply().
+ * How an expression parses does not depend on variable values,
+ * so running the program is the same as evaluating the string again,
+ * only without tokenizing it. Operators with constant operands
+ * are folded while recording.
+ */
+typedef struct arith_insn {
+	const char *var;
+	arith_t val;
+	operator op;
+} arith_insn;
+
+typedef struct arith_prog {
+	struct arith_prog *next;
+	const char *expr;
+	unsigned cnt;
+	arith_insn insn[];
+} arith_prog;
+
+# define ARITH_CACHE_HASH  64
+# define ARITH_CACHE_CHAIN 4
+static arith_prog *arith_cache[ARITH_CACHE_HASH];
+/* Nonzero while a cached program runs: programs can't be freed then */
+static unsigned arith_cache_busy;
+#endif
+
 
 static arith_t
 evaluate_string(arith_state_t *math_state, const char *expr);
@@ -462,6 +495,139 @@ arith_apply(arith_state_t *math_state, operator op, var_or_num_t *numstack, var_
 #undef NUMPTR
 }
 
+#if ENABLE_FEATURE_SH_MATH_CACHE
+static arith_prog **
+arith_cache_bucket(const char *expr)
+{
+	unsigned h = 0;
+	while (*expr)
+		h = h * 31 + (unsigned char)*expr++;
+	return &arith_cache[h % ARITH_CACHE_HASH];
+}
+
+static arith_prog *
+arith_cache_find(arith_prog **bucket, const char *expr)
+{
+	arith_prog **pp, *prog;
+
+	for (pp = bucket; (prog = *pp) != NULL; pp = &prog->next) {
+		if (strcmp(prog->expr, expr) == 0) {
+			/* move to front of the chain */
+			*pp = prog->next;
+			prog->next = *bucket;
+			*bucket = prog;
+			return prog;
+		}
+	}
+	return NULL;
+}
+
+static void
+arith_cache_store(arith_prog **bucket, const char *expr, const arith_insn *insn, unsigned cnt)
+{
+	arith_prog *prog, **pp;
+	unsigned i;
+	size_t size;
+	char *s;
+
+	/* chain is full? drop its least recently used program */
+	i = 0;
+	for (pp = bucket; *pp; pp = &(*pp)->next) {
+		if (++i == ARITH_CACHE_CHAIN) {
+			if (arith_cache_busy)
+				return;
+			free(*pp);
+			*pp = NULL;
+			break;
+		}
+	}
+
+	size = sizeof(*prog) + cnt * sizeof(insn[0]) + strlen(expr) + 1;
+	for (i = 0; i < cnt; i++)
+		if (insn[i].var)
+			size += strlen(insn[i].var) + 1;
+	prog = xmalloc(size);
+	s = (char*)&prog->insn[cnt];
+	prog->expr = s;
+	s = stpcpy(s, expr) + 1;
+	prog->cnt = cnt;
+	for (i = 0; i < cnt; i++) {
+		prog->insn[i] = insn[i];
+		if (insn[i].var) {
+			prog->insn[i].var = s;
+			s = stpcpy(s, insn[i].var) + 1;
+		}
+	}
+	prog->next = *bucket;
+	*bucket = prog;
+}
+
+/* Records op which was just applied. right is the topmost operand
+ * before the op, numstackptr[-1] is the result. Returns new pc */
+static unsigned
+arith_record_op(arith_insn *prog, unsigned pc, operator op,
+		var_or_num_t *right, var_or_num_t *numstackptr)
+{
+	var_or_num_t *res = numstackptr - 1;
+
+	if (!is_assign_op(op)
+	 && PREC(op) != PREC(TOK_CONDITIONAL) /* not ? or : */
+	 && prog[res->pc].op == TOK_NUM && !prog[res->pc].var
+	) {
+		if (res == right) {
+			/* Unary op on a constant */
+			if (res->pc + 1 == pc) {
+				prog[res->pc].val = res->val;
+				return pc;
+			}
+		} else
+		if (res->pc + 1 == right->pc && right->pc + 1 == pc
+		 && !prog[right->pc].var
+		) {
+			/* Binary op on two constants */
+			prog[res->pc].val = res->val;
+			return right->pc;
+		}
+	}
+	prog[pc].op = op;
+	prog[pc].var = NULL;
+	return pc + 1;
+}
+
+static arith_t
+arith_run(arith_state_t *math_state, const arith_prog *prog)
+{
+	var_or_num_t *const numstack = alloca(prog->cnt * sizeof(numstack[0]));
+	var_or_num_t *numstackptr = numstack;
+	const arith_insn *insn;
+	const char *errmsg = NULL;
+
+	arith_cache_busy++;
+	for (insn = prog->insn; insn != &prog->insn[prog->cnt]; insn++) {
+		if (insn->op == TOK_NUM) {
+			numstackptr->var = (char*)insn->var;
+			numstackptr->val = insn->val;
+			numstackptr->second_val_present = 0;
+			numstackptr++;
+			continue;
+		}
+		if (insn->op == TOK_LPAREN) {
+			errmsg = arith_lookup_val(math_state, &numstackptr[-1]);
+			numstackptr[-1].var = NULL;
+		} else {
+			errmsg = arith_apply(math_state, insn->op, numstack, &numstackptr);
+		}
+		if (errmsg) {
+			numstack->val = -1;
+			break;
+		}
+	}
+	arith_cache_busy--;
+	math_state->errmsg = errmsg;
+	return numstack->val;
+}
+#endif
+
 /* longest must be first */
 static const char op_tokens[] ALIGN1 = {
 	'<','<','=',0, TOK_LSHIFT_ASSIGN,
@@ -593,6 +759,35 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 	/* Stack of operator tokens */
 	operator *const stack = alloca(expr_len * sizeof(stack[0]));
 	operator *stackptr = stack;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+	/* Each token adds at most one instruction, +1 for final ")" */
+	arith_insn *const prog = alloca(expr_len * sizeof(prog[0]));
+	unsigned pc = 0;
+	arith_prog **bucket = NULL;
+#endif
+
+	if (isdigit(*expr)) {
+		/* Fast path for plain numbers, typically variable values */
+		char *end;
+		arith_t val;
+
+		errno = 0;
+		val = strto_arith_t(expr, &end);
+		if (*end == '\0') {
+			math_state->errmsg = NULL;
+			return errno ? 0 : val; /* bash compat */
+		}
+	}
+#if ENABLE_FEATURE_SH_MATH_CACHE
+	if (*expr) {
+		arith_prog *cached;
+
+		bucket = arith_cache_bucket(expr);
+		cached = arith_cache_find(bucket, expr);
+		if (cached)
+			return arith_run(math_state, cached);
+	}
+#endif
 
 	/* Start with a left paren */
 	*stackptr++ = lasttok = TOK_LPAREN;
@@ -642,6 +837,13 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 			expr = p;
  num:
 			numstackptr->second_val_present = 0;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+			numstackptr->pc = pc;
+			prog[pc].op = TOK_NUM;
+			prog[pc].var = numstackptr->var;
+			prog[pc].val = numstackptr->var ? 0 : numstackptr->val;
+			pc++;
+#endif
 			numstackptr++;
 			lasttok = TOK_NUM;
 			continue;
@@ -760,6 +962,9 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 			 * tokens and apply them */
 			while (stackptr != stack) {
 				operator prev_op = *--stackptr;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+				var_or_num_t *top_before_apply = numstackptr - 1;
+#endif
 				if (op == TOK_RPAREN) {
 //bb_error_msg("op == TOK_RPAREN");
 					if (prev_op == TOK_LPAREN) {
@@ -770,6 +975,10 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 							errmsg = arith_lookup_val(math_state, &numstackptr[-1]);
 							if (errmsg)
 								goto err_with_custom_msg;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+							prog[pc].op = TOK_LPAREN;
+							prog[pc++].var = NULL;
+#endif
 							/* Erase var name: (var) is just a number, for example, (var) = 1 is not valid */
 							numstackptr[-1].var = NULL;
 						}
@@ -795,6 +1004,9 @@ evaluate_string(arith_state_t *math_state, const char *expr)
 				errmsg = arith_apply(math_state, prev_op, numstack, &numstackptr);
 				if (errmsg)
 					goto err_with_custom_msg;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+				pc = arith_record_op(prog, pc, prev_op, top_before_apply, numstackptr);
+#endif
 			}
 			if (op == TOK_RPAREN)
 				goto err;
@@ -811,6 +1023,10 @@ evaluate_string(arith_state_t *math_state, const char *expr)
  err_with_custom_msg:
 	numstack->val = -1;
  ret:
+#if ENABLE_FEATURE_SH_MATH_CACHE
+	if (!errmsg && pc != 0)
+		arith_cache_store(bucket, start_expr, prog, pc);
+#endif
 	math_state->errmsg = errmsg;
 	return numstack->val;
 }
@@ -820,6 +1036,11 @@ arith(arith_state_t *math_state, const char *expr)
 {
 	math_state->errmsg = NULL;
 	math_state->list_of_recursed_names = NULL;
+#if ENABLE_FEATURE_SH_MATH_CACHE
+	/* arith() is not reentered: if setvar() longjmp'ed out
+	 * of a cached program last time, it is not running now */
+	arith_cache_busy = 0;
+#endif
 	return evaluate_string(math_state, expr);
 }
 
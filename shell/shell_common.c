@@ -688,3 +688,130 @@ shell_builtin_ulimit(char **argv)
 
 	return EXIT_SUCCESS;
 }
+
+#if ENABLE_FEATURE_SH_GLOB_CACHE
+/* Directory cache for globbing */
+
+#include <sys/vfs.h>
+
+# define DIR_CACHE_MAX      16
+# define DIR_CACHE_MAX_SIZE (256 * 1024)
+
+static struct shell_dir *dir_cache;
+
+/* On these filesystems, creating or deleting a file
+ * always updates directory mtime.
+ */
+static int dir_mtime_is_reliable(const char *path)
+{
+	static const uint32_t fs_magic[] ALIGN4 = {
+		0xEF53,     /* ext2/3/4 */
+		0x58465342, /* xfs */
+		0x9123683E, /* btrfs */
+		0x01021994, /* tmpfs */
+		0xF2F52010, /* f2fs */
+	};
+	struct statfs stfs;
+	unsigned i;
+
+	if (statfs(path, &stfs) != 0)
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(fs_magic); i++)
+		if ((uint32_t)stfs.f_type == fs_magic[i])
+			return 1;
+	return 0;
+}
+
+/* Returns the listing of the directory, or NULL if it can't be read.
+ * Must be released with shell_closedir().
+ */
+struct shell_dir* FAST_FUNC shell_opendir(const char *path)
+{
+	struct stat st;
+	struct shell_dir *dir, **dpp;
+	DIR *dirp;
+	struct dirent *dp;
+	size_t len, size;
+	unsigned cnt;
+
+	if (stat(path, &st) != 0)
+		return NULL;
+
+	for (dpp = &dir_cache; (dir = *dpp) != NULL; dpp = &dir->next) {
+		if (dir->dev != st.st_dev || dir->ino != st.st_ino)
+			continue;
+		if (dir->mtime == st.st_mtime
+		 && dir->mtime_nsec == (unsigned long)st.st_mtim.tv_nsec
+		) {
+			/* Unchanged: move to front and use it */
+			*dpp = dir->next;
+			dir->next = dir_cache;
+			dir_cache = dir;
+			dir->busy++;
+			return dir;
+		}
+		/* Stale */
+		*dpp = dir->next;
+		dir->cached = 0;
+		if (!dir->busy)
+			free(dir);
+		break;
+	}
+
+	dirp = opendir(path);
+	if (!dirp)
+		return NULL;
+	size = 1024;
+	dir = xmalloc(sizeof(*dir) + size);
+	len = 0;
+	while ((dp = readdir(dirp)) != NULL) {
+		size_t l = strlen(dp->d_name) + 1;
+		if (len + l >= size) {
+			size = (len + l) * 2;
+			dir = xrealloc(dir, sizeof(*dir) + size);
+		}
+		memcpy(dir->names + len, dp->d_name, l);
+		len += l;
+	}
+	closedir(dirp);
+	dir->names[len] = '\0';
+	dir->dev = st.st_dev;
+	dir->ino = st.st_ino;
+	dir->mtime = st.st_mtime;
+	dir->mtime_nsec = st.st_mtim.tv_nsec;
+	dir->busy = 1;
+
+	/* A change made in the same second we read the directory
+	 * might not change its mtime: don't cache recently modified ones.
+	 */
+	dir->cached = (st.st_mtime < time(NULL) - 1
+		&& len < DIR_CACHE_MAX_SIZE
+		&& dir_mtime_is_reliable(path)
+	);
+	if (dir->cached) {
+		dir->next = dir_cache;
+		dir_cache = dir;
+		/* Drop least recently used listings if there are too many */
+		cnt = 0;
+		for (dpp = &dir_cache; (dir = *dpp) != NULL;) {
+			if (++cnt > DIR_CACHE_MAX) {
+				*dpp = dir->next;
+				dir->cached = 0;
+				if (!dir->busy)
+					free(dir);
+				continue;
+			}
+			dpp = &dir->next;
+		}
+		dir = dir_cache;
+	}
+	return dir;
+}
+
+void FAST_FUNC shell_closedir(struct shell_dir *dir)
+{
+	dir->busy--;
+	if (!dir->cached && !dir->busy)
+		free(dir);
+}
+#endif
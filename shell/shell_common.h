@@ -54,6 +54,24 @@ shell_builtin_read(struct builtin_read_params *params);
 int FAST_FUNC
 shell_builtin_ulimit(char **argv);
 
+#if ENABLE_FEATURE_SH_GLOB_CACHE
+/* Directory listing for globbing, possibly shared with the cache.
+ * names[] holds NUL-terminated names, with an empty name at the end.
+ */
+struct shell_dir {
+	struct shell_dir *next;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	unsigned long mtime_nsec;
+	unsigned busy;
+	smallint cached;
+	char names[];
+};
+struct shell_dir* FAST_FUNC shell_opendir(const char *path);
+void FAST_FUNC shell_closedir(struct shell_dir *dir);
+#endif
+
 POP_SAVED_FUNCTION_VISIBILITY
 
 #endif
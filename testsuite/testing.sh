@@ -108,6 +108,53 @@ testing()
   return $RETVAL
 }
 
+# The "bench" function is for *.bench scripts, which time an applet
+# on bigger inputs. It runs command $2, prints its wall clock time
+# and the start of the md5sum of its output.
+#
+# A *.bench script takes the commands to time as arguments, by default
+# the applets of $bindir/busybox ($bindir defaults to ..). Run it against
+# two builds, or against another implementation, to compare: the md5
+# column tells whether they printed the same. Where the script generates
+# its input, N sets its size.
+
+bench()
+{
+  start=$(date +%s%N)
+  sum=$(eval "$2" | md5sum)
+  end=$(date +%s%N)
+  printf "%-20s %7d ms  %.8s\n" "$1" $(( (end - start) / 1000000 )) "$sum"
+}
+
+# Set up for a *.bench script: $BB is the busybox binary (absolute path,
+# so that the script can cd), $N the input size (default $1), and $tmp
+# a scratch directory which is removed on exit.
+
+bench_init()
+{
+  BB=$(cd "${bindir:-..}" && pwd)/busybox
+  N=${N:-$1}
+  tmp=${TMPDIR:-/tmp}/bench.$$
+  mkdir -p "$tmp" || exit 1
+  trap 'rm -rf "$tmp"' EXIT
+}
+
+# Generate bench input: "bench_data SEED PROG [FILE]..." runs awk PROG
+# with n = $N and rnd(m), which returns a pseudo-random number 0..m-1
+# (and leaves it before the modulo in x). The Park-Miller generator
+# never loses precision in doubles, unlike rand(), so the data is
+# the same on every run.
+
+bench_data()
+{
+  seed=$1
+  prog=$2
+  shift 2
+  "$BB" awk -v n="$N" -v x="$seed" "
+  function rnd(m) { x = (x * 16807) % 2147483647; return x % m }
+  $prog" "$@"
+}
+
 # Recursively grab an executable and all the libraries needed to run it.
 # Source paths beginning with / will be copied into destpath, otherwise
 # the file is assumed to already be there and only its library dependencies